@@ -0,0 +1,136 @@
+/*
+ * AreaDownloadJob.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef AREADOWNLOADJOB_H_
+#define AREADOWNLOADJOB_H_
+
+#include <e32base.h>
+#include <f32file.h>
+#include <lbsposition.h>
+#include "Map.h"
+
+
+class MAreaDownloadJobObserver
+	{
+public:
+	// Called when all tiles of area have been processed (aErrCode is KErrNone)
+	// or job has been stopped because of error. Progress is kept in the
+	// last case, so job may be resumed later.
+	virtual void OnAreaDownloadFinished(TInt aErrCode) = 0;
+	};
+
+
+/* Downloads all tiles of rectangular area for range of zoom levels to
+ * tile store (for offline usage). Tiles already present in store are
+ * skipped. Tiles are requested one by one through CTileBitmapManager
+ * with lowest priority and limited rate, so on screen tiles are loaded
+ * first and not evicted from memory cache.
+ * 
+ * Progress is saved to file periodically, unfinished job may be resumed
+ * after application restart by ResumeL().
+ */
+class CAreaDownloadJob : public CBase, public MTileStoreDownloadObserver
+	{
+// Base methods
+public:
+	~CAreaDownloadJob();
+	static CAreaDownloadJob* NewL(CTileBitmapManager* aManager, RFs aFs,
+			const TDesC &aStateFileName, MAreaDownloadJobObserver* aObserver);
+	static CAreaDownloadJob* NewLC(CTileBitmapManager* aManager, RFs aFs,
+			const TDesC &aStateFileName, MAreaDownloadJobObserver* aObserver);
+
+private:
+	CAreaDownloadJob(CTileBitmapManager* aManager, RFs aFs,
+			MAreaDownloadJobObserver* aObserver);
+	void ConstructL(const TDesC &aStateFileName);
+	
+// From MTileStoreDownloadObserver
+public:
+	void OnTileStoredL(const TTile &aTile, TInt aErrCode);
+	
+// Custom properties and methods
+private:
+	CTileBitmapManager* iManager;
+	RFs iFs;
+	MAreaDownloadJobObserver* iObserver;
+	TFileName iStateFileName;
+	CPeriodic* iTimer; // Used for delay between requests
+	TInt iMinRequestInterval; // In microseconds
+	TBool iIsRunning;
+	TBool iIsWaitingTile; // Tile has been requested from manager
+	TTime iRequestTime; // When last tile was requested
+	TTime iStartTime; // When job was started or resumed
+	
+	// Area
+	TCoordinate iTopLeft;
+	TCoordinate iBottomRight;
+	TZoom iMinZoom;
+	TZoom iMaxZoom;
+	
+	// Progress
+	TTile iCurrentTile; // Next tile to process
+	TBool iIsCompleted;
+	TInt iTilesTotal;
+	TInt iTilesDownloaded;
+	TInt iTilesSkipped;
+	TInt iTilesFailed;
+	TInt iConsecutiveFailures;
+	TInt iSessionTilesDownloaded; // Since job started or resumed
+	TInt iUnsavedTilesCount; // Processed after state has been saved
+	
+	// Get range of tiles covering area at given zoom
+	void TilesRange(TZoom aZoom, TTile &aTopLeft, TTile &aBottomRight) const;
+	static void TilesRange(const TCoordinate &aTopLeft, const TCoordinate &aBottomRight,
+			TZoom aZoom, TTile &aTopLeftTile, TTile &aBottomRightTile);
+	// Move to next tile in area
+	void Advance();
+	void ScheduleNext(TInt aDelay);
+	static TInt TimerCallback(TAny* aSelf);
+	void ProcessNextL();
+	void Finish(TInt aErrCode);
+	void SaveStateL();
+	void LoadStateL();
+	
+public:
+	// @return Total count of tiles in area for all zoom levels
+	static TInt TilesCount(const TCoordinate &aTopLeft, const TCoordinate &aBottomRight,
+			TZoom aMinZoom, TZoom aMaxZoom);
+	// @return Approximate size in bytes of aTilesCount tiles, based on
+	//         average tile size in store
+	TInt64 EstimatedSize(TInt aTilesCount) const;
+	// Start new job (current one is discarded)
+	void StartL(const TCoordinate &aTopLeft, const TCoordinate &aBottomRight,
+			TZoom aMinZoom, TZoom aMaxZoom);
+	// Continue job saved in state file
+	// @return EFalse if there is no unfinished job
+	TBool ResumeL();
+	// Pause job, it may be continued later by ResumeL()
+	void Stop();
+	// Stop and forget job
+	void Discard();
+	// Limit rate of requests
+	void SetMaxTilesPerSecond(TInt aTilesPerSecond);
+	inline TBool IsRunning() const
+		{ return iIsRunning; };
+	inline TBool IsCompleted() const
+		{ return iIsCompleted; };
+	inline TInt TilesTotal() const
+		{ return iTilesTotal; };
+	// @return Count of tiles which have been downloaded, skipped or failed
+	inline TInt TilesProcessed() const
+		{ return iTilesDownloaded + iTilesSkipped + iTilesFailed; };
+	inline TInt TilesDownloaded() const
+		{ return iTilesDownloaded; };
+	inline TInt TilesSkipped() const
+		{ return iTilesSkipped; };
+	inline TInt TilesFailed() const
+		{ return iTilesFailed; };
+	// @return Average download speed since job started or resumed
+	TReal TilesPerSecond() const;
+	};
+
+#endif /* AREADOWNLOADJOB_H_ */
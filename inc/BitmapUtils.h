@@ -0,0 +1,27 @@
+/*
+ * BitmapUtils.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef BITMAPUTILS_H_
+#define BITMAPUTILS_H_
+
+#include <e32base.h>
+#include <fbs.h>
+
+
+class BitmapUtils
+	{
+public:
+	// Fast nearest neighbour scaling of aSrcRect from aSrc to aDstRect of aDst.
+	// Destination rect may be out of aDst bounds, it is clipped. Both bitmaps
+	// must have the same display mode, only 16 and 32 bit modes are supported.
+	// @return KErrNotSupported for other display modes (use
+	//         CBitmapContext::DrawBitmap instead), KErrArgument for empty rects
+	static TInt ScaleNearest(const CFbsBitmap &aSrc, const TRect &aSrcRect,
+			CFbsBitmap &aDst, const TRect &aDstRect);
+	};
+
+#endif /* BITMAPUTILS_H_ */
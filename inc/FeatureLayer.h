@@ -0,0 +1,54 @@
+/*
+ * FeatureLayer.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef FEATURELAYER_H_
+#define FEATURELAYER_H_
+
+#include <e32base.h>
+#include <gdi.h>
+#include "Map.h"
+#include "SpatialIndex.h"
+
+
+// Draws point features (POIs, waypoints, etc.) with labels. Features which
+// would overlap already drawn ones are skipped.
+class CFeatureLayer : public CMapLayerBase
+	{
+// Base methods
+public:
+	~CFeatureLayer();
+	static CFeatureLayer* NewL(CS60MapsAppView* aMapView);
+	static CFeatureLayer* NewLC(CS60MapsAppView* aMapView);
+
+private:
+	CFeatureLayer(CS60MapsAppView* aMapView);
+	void ConstructL();
+
+// From CMapLayerBase
+public:
+	void Draw(CBitmapContext &aGc);
+
+// Custom properties and methods
+private:
+	CSpatialIndex* iIndex;
+	RArray<TInt> iFoundFeatures; // Reused between frames
+	RArray<TUint32> iOccupiedCells; // Bit mask of screen cells covered by drawn features
+	TInt iOccupancyColumns;
+	TInt iOccupancyRows;
+
+	void DrawL(CBitmapContext &aGc);
+	void ResetOccupancyL(const TSize &aScreenSize);
+	// Mark cells covered by rectangle as occupied
+	// @return EFalse if any of them has been already occupied
+	TBool Occupy(const TRect &aRect);
+
+public:
+	inline CSpatialIndex* Index() const
+		{ return iIndex; };
+	};
+
+#endif /* FEATURELAYER_H_ */
@@ -19,20 +19,54 @@
 // FORWARD DECLARATION
 class MHTTPClientObserver; 
 
+// CONSTANTS
+const TInt KMaxHostLength = 64;
+const TInt KHTTPDateLength = 29; // "Sun, 06 Nov 1994 08:49:37 GMT"
+
 // CLASS DECLARATION
 
+// Additional header of request
+class THTTPRequestHeader
+	{
+public:
+	inline THTTPRequestHeader(TInt aField, const TDesC8 &aValue) :
+		iField(aField), iValue(aValue)
+		{};
+	
+	TInt iField; // Index in HTTP string table (HTTP::EIfNoneMatch, ...)
+	TPtrC8 iValue; // Sent as is
+	};
+
+// Counters of connections reuse. HTTP framework doesn`t report about
+// opening and closing of sockets, so connections count is only an
+// estimate: new connection is supposed to be opened for request if all
+// already opened connections to the same host are busy and limit is not
+// reached, connection is supposed to be closed when server responds with
+// "Connection: close" or request fails or is cancelled. Kept-alive
+// connections closed while idle are not noticed.
+class THTTPClientStats
+	{
+public:
+	TUint iRequestsSent;
+	TUint iConnectionsOpened; // Estimated
+	
+	inline TReal RequestsPerConnection() const
+		{ return iConnectionsOpened ? TReal(iRequestsSent) / iConnectionsOpened : 0; };
+	};
+
 /**
  *  CHTTPClient
  * 
  */
-// ToDo: Allow to cancel ongoing request
 class CHTTPClient : public CBase
 	{
 	// Constructors and destructor
 public:
 	~CHTTPClient();
-	static CHTTPClient* NewL(MHTTPClientObserver* aObserver);
-	static CHTTPClient* NewLC(MHTTPClientObserver* aObserver);
+	// @param aObserver Default observer, may be NULL if all requests
+	// will be sent with their own observers
+	static CHTTPClient* NewL(MHTTPClientObserver* aObserver = NULL);
+	static CHTTPClient* NewLC(MHTTPClientObserver* aObserver = NULL);
 
 private:
 	CHTTPClient(MHTTPClientObserver* aObserver);
@@ -42,7 +76,29 @@ private:
 public:
 	// ToDo: Add other methods (POST, HEAD, etc...)
 	void GetL(const TDesC8 &aUrl);
+	// Send request with separate observer. Several requests may be
+	// processed in parallel.
+	// @return Opened transaction, it will be closed automatically on completion
+	RHTTPTransaction GetL(const TDesC8 &aUrl, MHTTPClientObserver &aObserver);
+	// The same, but with additional request headers (for example, for
+	// conditional request)
+	RHTTPTransaction GetL(const TDesC8 &aUrl, MHTTPClientObserver &aObserver,
+			const RArray<THTTPRequestHeader> &aHeaders);
+	// Abort ongoing request. No more events will be sent to observer.
+	void CancelRequest(RHTTPTransaction &aTransaction);
 	void SetUserAgentL(const TDesC8 &aDes);
+	// Limit count of simultaneously opened connections. Note: limit is
+	// session-wide, HTTP framework applies it to all hosts together, not
+	// to each host.
+	void SetMaxConnectionsL(TInt aMaxConnections);
+	// @param aMaxPipelinedRequests Max count of requests sent through one
+	//        connection without waiting for responses (ignored if aEnable
+	//        is EFalse)
+	void SetPipeliningL(TBool aEnable, TInt aMaxPipelinedRequests = 5);
+	inline const THTTPClientStats& Stats() const
+		{ return iStats; };
+	// Format time as in HTTP headers (RFC 1123)
+	static void FormatDate(const TTime &aTime, TDes8 &aDes);
 	
 private:
 	// Enum
@@ -52,19 +108,54 @@ private:
 		EGet
 		};
 	
+	class THostConnections
+		{
+	public:
+		TBuf8<KMaxHostLength> iHost;
+		TInt iActiveRequests;
+		TInt iOpenConnections;
+		};
+	
+	class TActiveTransaction
+		{
+	public:
+		TInt iTransactionId;
+		TInt iHostIdx; // Index in iHosts
+		};
+	
 	RHTTPSession iSession;
 	MHTTPClientObserver* iObserver;
+	TInt iMaxConnections;
+	RArray<THostConnections> iHosts;
+	RArray<TActiveTransaction> iActiveTransactions;
+	THTTPClientStats iStats;
 	
-	void SendRequestL(THTTPMethod aMethod, const TDesC8 &aUrl);
+	RHTTPTransaction SendRequestL(THTTPMethod aMethod, const TDesC8 &aUrl,
+			MHTTPClientObserver &aObserver,
+			const RArray<THTTPRequestHeader>* aHeaders = NULL);
 	void SetHeaderL(RHTTPHeaders aHeaders, TInt aHdrField, const TDesC8 &aHdrValue);
+	void SetConnectionPropertyL(TInt aProperty, const THTTPHdrVal &aValue);
+	// Update connection counters
+	void OnTransactionStartedL(const RHTTPTransaction &aTransaction, const TDesC8 &aHost);
+	void OnTransactionFinished(const RHTTPTransaction &aTransaction, TBool aIsConnectionKept);
+	TInt OpenConnectionsCount() const;
+	
+	friend class MHTTPClientObserver;
 	};
 
 
 class MHTTPClientObserver : public MHTTPTransactionCallback
 	{
+public:
+	inline MHTTPClientObserver() : iLastError(0), iClient(NULL)
+		{};
+	
 	// Inherited from MHTTPTransactionCallback
 private:
 	TInt iLastError;
+	CHTTPClient* iClient; // Client which sent the last request
+	
+	friend class CHTTPClient;
 	
 	virtual void MHFRunL(RHTTPTransaction aTransaction,
 			const THTTPEvent& aEvent);
@@ -19,6 +19,10 @@
 #include <e32std.h>		// For RTimer
 #include "HttpClient.h"
 #include "FileUtils.h"
+#include "TileStore.h"
+#include <bacntf.h>
+#include "LoggingDefs.h"
+#include "Profiling.h"
 
 
 // Constants
@@ -26,6 +30,7 @@ const TReal64 KMinLatitudeMapBound = -85.051129;
 const TReal64 KMaxLatitudeMapBound = 85.051129;
 const TReal64 KMinLongitudeMapBound = -180;
 const TReal64 KMaxLongitudeMapBound = 180;
+const TInt KDefaultTileBitmapsMemoryBudget = 10 * 1024 * 1024; // In bytes
 
 
 // Forward declaration
@@ -42,7 +47,7 @@ protected:
 	CS60MapsAppView* iMapView;
 public:
 	CMapLayerBase(/*const*/ CS60MapsAppView* aMapView);
-	virtual void Draw(CWindowGc &aGc) = 0;
+	virtual void Draw(CBitmapContext &aGc) = 0;
 	};
 
 // Observer class for image reader
@@ -83,7 +88,7 @@ class CMapLayerDebugInfo : public CMapLayerBase
 public:
 	CMapLayerDebugInfo(/*const*/ CS60MapsAppView* aMapView);
 	//~CMapLayerDebugInfo();
-	void Draw(CWindowGc &aGc);
+	void Draw(CBitmapContext &aGc);
 	};
 
 class CTileBitmapManager;
@@ -97,7 +102,17 @@ public:
 	virtual void OnTileLoadingFailed(const TTile &aTile, TInt aErrCode);
 	};
 
-// Class for drawing map tiles
+// Notified when tile requested by CTileBitmapManager::DownloadToStoreL()
+// has been saved to tile store (or failed)
+class MTileStoreDownloadObserver
+	{
+public:
+	virtual void OnTileStoredL(const TTile &aTile, TInt aErrCode) = 0;
+	};
+
+// Class for drawing map tiles. While tile is not loaded yet, it is
+// replaced by scaled part of cached tile with lower zoom (or by four
+// tiles with higher zoom).
 class CTiledMapLayer : public CMapLayerBase, public MTileBitmapManagerObserver
 	{
 // Base methods
@@ -112,19 +127,69 @@ private:
 	
 // From CMapLayerBase
 public:
-	void Draw(CWindowGc &aGc);
+	void Draw(CBitmapContext &aGc);
 	
 // From MTileBitmapManagerObserver
 public:
 	void OnTileLoaded(const TTile &aTile, const CFbsBitmap *aBitmap);
 	
 // Custom properties and methods
+public:
+	// Draw only tiles which intersect with aRect (in screen coordinates).
+	// Loading is requested for all visible tiles anyway.
+	void DrawArea(CBitmapContext &aGc, const TRect &aRect);
+	// Request loading of all visible tiles without drawing
+	void LoadVisibleTiles();
+	// Set count of tiles around viewport to load in advance, 0 disables
+	// prefetching and cancels queued prefetch loadings
+	void SetPrefetchRingWidth(TInt aWidth);
+	
 private:
 	CTileBitmapManager *iBitmapMgr;
 	TTileProviderBase *iTileProvider;
+	
+	// Prefetching
+	TInt iPrefetchRingWidth;
+	TTile iPrefetchTopLeft; // Viewport for which prefetch set was made
+	TTile iPrefetchBottomRight;
+	TPoint iPrefetchDirection; // Components are -1, 0 or 1
+	TPoint iLastCenter; // Projection coordinates of view center at last drawing
+	TZoom iLastCenterZoom;
+	TPoint iPanDirection;
+	// Update set of tiles to load in advance if viewport or direction of
+	// movement changed
+	void UpdatePrefetch();
+	// Expected direction of view movement: course of user when following,
+	// otherwise direction of last panning
+	// @param aLookAhead Count of extra tiles to prefetch in this direction
+	TPoint MovementDirection(TInt &aLookAhead);
+	
+#if LOGGING_ENABLED
+	// Count of frames which had blank tiles (without even fallback)
+	TInt iFramesCount;
+	TInt iBlankFramesCount;
+#endif
 	void VisibleTiles(RArray<TTile> &aTiles); // Return list of visible tiles
-	void DrawTile(CWindowGc &aGc, const TTile &aTile, const CFbsBitmap *aBitmap);
+	void DrawTile(CBitmapContext &aGc, const TTile &aTile, const CFbsBitmap *aBitmap);
+	// Draw approximation of not loaded tile from cached parent or children
+	// @return EFalse if nothing suitable found in cache
+	TBool DrawFallbackTile(CBitmapContext &aGc, const TTile &aTile);
+	TRect TileScreenRect(const TTile &aTile) const;
+	// Invalidate areas of visible tiles without own bitmap, for which
+	// aTile may be drawn as fallback
+	// @return EFalse if nothing to redraw
+	TBool InvalidateFallbackArea(const TTile &aTile);
+	
+#if LOGGING_ENABLED
+	// Used to measure time from zoom change to first frame without empty tiles
+	TZoom iLastDrawnZoom;
+	TStopwatch iZoomStopwatch;
+	TBool iIsWaitingMeaningfulFrame;
+#endif
 	
+public:
+	inline CTileBitmapManager* BitmapManager() const
+		{ return iBitmapMgr; };
 	};
 
 
@@ -134,12 +199,12 @@ class CUserPositionLayer : public CMapLayerBase
 // From CMapLayerBase
 public:
 	CUserPositionLayer(/*const*/ CS60MapsAppView* aMapView);
-	void Draw(CWindowGc &aGc);
+	void Draw(CBitmapContext &aGc);
 	
 // Own methods
 private:
-	void DrawDirectionMarkL(CWindowGc &aGc, const TPoint &aScreenPos, TReal aRotation);
-	void DrawRoundMark(CWindowGc &aGc, const TPoint &aScreenPos);
+	void DrawDirectionMarkL(CBitmapContext &aGc, const TPoint &aScreenPos, TReal aRotation);
+	void DrawRoundMark(CBitmapContext &aGc, const TPoint &aScreenPos);
 	};
 
 
@@ -177,12 +242,12 @@ class CTileBorderAndXYZLayer : public CMapLayerBase
 // From CMapLayerBase
 public:
 	CTileBorderAndXYZLayer(CS60MapsAppView* aMapView);
-	void Draw(CWindowGc &aGc);
+	void Draw(CBitmapContext &aGc);
 
 // Custom properties and methods
 private:
 	void VisibleTiles(RArray<TTile> &aTiles); // Return list of visible tiles
-	void DrawTile(CWindowGc &aGc, const TTile &aTile);
+	void DrawTile(CBitmapContext &aGc, const TTile &aTile);
 	
 	};
 #endif
@@ -206,27 +271,39 @@ class TTileProviderBase;
 
 class CTileBitmapManagerItem;
 
-// Stores and loads bitmaps for tiles. When count of stored bitmaps
-// reach maximum limit, oldest one will be deleted before insert new.
-class CTileBitmapManager : public CActive, public MHTTPClientObserver
+// Counters of bitmap cache usage
+class TTileBitmapManagerStats
+	{
+public:
+	TUint iHits;		// Requested bitmap was found in cache
+	TUint iMisses;		// Requested bitmap was absent in cache and has been added to loading
+	TUint iEvictions;	// Bitmaps deleted from cache to free space for new ones
+	TUint iPressureEvictions; // Bitmaps deleted because of low free memory in system
+	TInt iBytesHeld;	// Current size of bitmaps data (including expected size of loading ones)
+	TInt iBytesPeak;	// Maximum value of iBytesHeld
+	TUint iNotModified;	// Stale tiles which have been confirmed by server (304 response)
+	TUint iRefreshed;	// Stale tiles which have been downloaded again
+	};
+
+// Downloads one tile and decodes it to bitmap. CTileBitmapManager owns
+// several downloaders to process some tiles in parallel. Original image
+// is written to tile store by parts as they arrive (or buffered in memory
+// if size of response is not known in advance).
+class CTileDownloader : public CActive, public MHTTPClientObserver
 	{
 // Base methods
 public:
-	~CTileBitmapManager();
-	static CTileBitmapManager* NewL(MTileBitmapManagerObserver *aObserver,
-			RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir, TInt aLimit = 50);
-	static CTileBitmapManager* NewLC(MTileBitmapManagerObserver *aObserver,
-			RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir, TInt aLimit = 50);
+	~CTileDownloader();
+	static CTileDownloader* NewL(CTileBitmapManager* aManager, RFs aFs);
+	static CTileDownloader* NewLC(CTileBitmapManager* aManager, RFs aFs);
 
 private:
-	CTileBitmapManager(MTileBitmapManagerObserver *aObserver, RFs aFs,
-			TTileProviderBase* aTileProvider, TInt aLimit);
-	void ConstructL(const TDesC &aCacheDir);
+	CTileDownloader(CTileBitmapManager* aManager);
+	void ConstructL(RFs aFs);
 	
 // From CActive
 	void RunL();
 	void DoCancel();
-	//TInt RunError(TInt aError);
 
 // From MHTTPClientObserver
 public:
@@ -235,57 +312,337 @@ public:
 	virtual void OnHTTPResponse(const RHTTPTransaction aTransaction);
 	virtual void OnHTTPError(TInt aError, const RHTTPTransaction aTransaction);
 	virtual void OnHTTPHeadersRecieved(const RHTTPTransaction aTransaction);
+	virtual TInt MHFRunError(TInt aError, RHTTPTransaction aTransaction,
+			const THTTPEvent& aEvent);
 	
 // Custom properties and methods
 private:
-	MTileBitmapManagerObserver *iObserver;
-	TInt iLimit;
-	RPointerArray<CTileBitmapManagerItem> iItems;
-	/*TInt*/ void Append/*L*/(const TTile &aTile); 
-	
-	RArray<TTile> /*iItemsForLoading*/ iItemsLoadingQueue;
-	CHTTPClient* iHTTPClient;
-	TTileProviderBase* iTileProvider;
-	//TFileName iCacheDir;
-	//TBool iIsLoading;
 	enum TProcessingState
 		{
 		EIdle,
 		EDownloading,
 		EDecoding
 		};
+	CTileBitmapManager* iManager;
 	TProcessingState iState;
+	TTile iTile;
+	CHTTPClient* iHTTPClient;
+	RHTTPTransaction iTransaction;
 	CBufferedImageDecoder* iImgDecoder;
+	CFbsBitmap* iBitmap; // Owned until passed to manager
+	CTileStore* iStore; // NULL if tile should not be saved
+	TTileStoreReservation iReservation;
+	TBool iIsReserved;
+	RBuf8 iData; // Buffered image data if space has not been reserved in store
+	TBool iIsStoreOnly; // Save to store without decoding
+	TTileMetadata iMetadata; // From response headers
+	TBool iIsRevalidation; // Conditional request for tile which is already in store
+	TBool iIsNotModified; // Server responded with 304 status
+	// Image is decoded by parts as data arrives
+	TBool iIsDecodingStarted;
+	TBool iIsDecodingFinished; // Before the end of response
+	TInt iDecodingResult; // Valid if iIsDecodingFinished is set
+	TBool iHasNewData; // Data has been appended after last call of decoder
+	TStopwatch iRequestStopwatch;
+	TStopwatch iResponseStopwatch; // Since the end of response
+	
+	void Reset();
+	void ResetDecoding();
+	// Start or continue conversion of received data if decoder is not busy
+	void ContinueDecodingL();
+	void CancelReservation();
+	void SaveToStoreL();
+	// Reset downloader and pass error to corresponding manager`s callback
+	void ReportFailureL(TInt aError);
+	
+public:
+	// aStore may be NULL. If aStoreOnly is set, image is not decoded and
+	// manager is notified by OnTileStoredL() instead of OnTileDownloadedL().
+	void StartL(const TTile &aTile, CHTTPClient* aHTTPClient, const TDesC8 &aUrl,
+			CTileStore* aStore, TBool aStoreOnly = EFalse);
+	// Check stale tile in store by conditional request with validators
+	// from aCachedMetadata. If tile has changed, new image is saved to
+	// store (without decoding), otherwise only caching information of
+	// existing one is updated. Manager is notified by OnTileRevalidatedL().
+	void StartRevalidationL(const TTile &aTile, CHTTPClient* aHTTPClient, const TDesC8 &aUrl,
+			CTileStore* aStore, const TTileMetadata &aCachedMetadata);
+	// Continue current processing without saving to tile store
+	void DetachTileStore();
+	// Stop downloading or decoding without notification of manager
+	void Abort();
+	inline TBool IsIdle() const
+		{ return iState == EIdle; };
+	inline const TTile& Tile() const
+		{ return iTile; };
+	inline TBool IsStoreOnly() const
+		{ return iIsStoreOnly; };
+	inline TBool IsRevalidation() const
+		{ return iIsRevalidation; };
+	};
+
+// Reads tile bitmap from disk cache asynchronously. Image data is taken
+// from tile store, old cache with separate bitmap file per tile is used
+// if tile is absent in the store. Bitmaps readed from old cache are
+// encoded to PNG and moved to the store.
+class CTileDiskReader : public CActive
+	{
+// Base methods
+public:
+	~CTileDiskReader();
+	static CTileDiskReader* NewL(CTileBitmapManager* aManager, RFs aFs);
+	static CTileDiskReader* NewLC(CTileBitmapManager* aManager, RFs aFs);
+
+private:
+	CTileDiskReader(CTileBitmapManager* aManager, RFs aFs);
+	void ConstructL();
+	
+// From CActive
+	void RunL();
+	void DoCancel();
+
+// Custom properties and methods
+private:
+	enum TReadingState
+		{
+		EReading,
+		EDecoding,
+		EMigrating
+		};
+	CTileBitmapManager* iManager;
+	RFs iFs;
+	TReadingState iState;
+	TTile iTile;
+	CTileStore* iStore;
+	RBuf8 iData; // Image data readed from tile store
+	CImageDecoder* iDecoder;
+	CFbsBitmap* iBitmap; // Owned until passed to manager
+	
+	// Used for migration from old cache
+	TFileName iOldFileName; // Empty if tile is readed from store
+	CImageEncoder* iEncoder;
+	HBufC8* iEncodedData;
+	CFbsBitmap* iMigratedBitmap; // Duplicate of bitmap passed to manager
+	
+	void Reset();
+	// Start converting image to bitmap with already created decoder
+	void StartDecodingL();
+	// Start encoding of bitmap readed from old cache
+	void StartMigrationL(const CFbsBitmap &aBitmap);
+	void FinishMigrationL();
+	
+public:
+	// Leaves with KErrNotFound or KErrPathNotFound if tile is not cached yet.
+	// aStore may be NULL.
+	void StartL(const TTile &aTile, CTileStore* aStore, const TDesC &aFileName);
+	inline TBool IsIdle() const
+		{ return !IsActive(); };
+	inline const TTile& Tile() const
+		{ return iTile; };
+	};
+
+// Stores and loads bitmaps for tiles. When total size of stored bitmaps
+// reach memory budget, least recently used ones will be deleted before
+// insert new. Pinned (currently visible) tiles are never deleted. Budget
+// is reduced temporary when system is running low on free memory.
+// Items are indexed by hash table and linked in queue from least to most
+// recently used, so lookup and eviction don`t depend on limit value.
+// Bitmaps are read from disk cache (tile store) asynchronously, tiles
+// which are absent in cache are downloaded and saved to the store. Up to
+// aParallelDownloads tiles are downloaded at the same time. Queued tiles
+// closest to the viewport centre are downloaded first, tiles which went
+// far away from viewport are dropped.
+class CTileBitmapManager : public CBase
+	{
+// Base methods
+public:
+	~CTileBitmapManager();
+	static CTileBitmapManager* NewL(MTileBitmapManagerObserver *aObserver,
+			RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir,
+			TDisplayMode aDisplayMode = EColor16M, TInt aMemoryBudget = KDefaultTileBitmapsMemoryBudget,
+			TInt aParallelDownloads = 2);
+	static CTileBitmapManager* NewLC(MTileBitmapManagerObserver *aObserver,
+			RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir,
+			TDisplayMode aDisplayMode = EColor16M, TInt aMemoryBudget = KDefaultTileBitmapsMemoryBudget,
+			TInt aParallelDownloads = 2);
+
+private:
+	CTileBitmapManager(MTileBitmapManagerObserver *aObserver, RFs aFs,
+			TTileProviderBase* aTileProvider, TDisplayMode aDisplayMode, TInt aMemoryBudget);
+	void ConstructL(const TDesC &aCacheDir, TInt aParallelDownloads);
+	
+// Custom properties and methods
+private:
+	MTileBitmapManagerObserver *iObserver;
+	TInt iMaxMemoryBudget; // In bytes
+	TInt iMemoryBudget; // Current value, may be less than maximum at low memory
+	TDisplayMode iDisplayMode; // Pixel format of all tile bitmaps
+	CEnvironmentChangeNotifier* iEnvChangeNotifier;
+	TBool iIsEnvChangeNotifierStarted;
+	
+	// Hash table of items with chaining through CTileBitmapManagerItem::iNextInBucket
+	CTileBitmapManagerItem** iBuckets;
+	TInt iBucketsCount; // Always power of 2
+	TInt iItemsCount;
+	TDblQue<CTileBitmapManagerItem> iItemsQueue; // From least to most recently used
+	RArray<TTile> iPinnedTiles;
+	TTileBitmapManagerStats iStats;
+	
+	/*TInt*/ void Append/*L*/(const TTile &aTile); 
+	
+	RArray<TTile> iDiskLoadingQueue; // Unordered
+	CTileDiskReader* iDiskReader;
+	RArray<TTile> /*iItemsForLoading*/ iItemsLoadingQueue; // Unordered
+	TTile iViewportTopLeft;
+	TTile iViewportBottomRight;
+	CHTTPClient* iHTTPClient;
+	RPointerArray<CTileDownloader> iDownloaders;
+	TTileProviderBase* iTileProvider;
+	TFileName iCacheDir;
+	CTileStore* iTileStore; // May be NULL if store can not be opened
 	RFs iFs;
-	TTile iLoadingTile;
 	TBool iIsOfflineMode;
 	CFileTreeMapper* iFileMapper;
 	
+	// Download of single tile to store only (without bitmap in cache)
+	MTileStoreDownloadObserver* iStoreDownloadObserver; // Not NULL while in progress
+	TTile iStoreDownloadTile;
+	TBool iIsStoreDownloadPending; // Waiting for free downloader
+	
+	// Stale tiles which have been shown from store and should be checked
+	// on server when downloaders are not busy
+	RArray<TTile> iRevalidationQueue;
+	// Add tile to revalidation if its expiry time has passed
+	void CheckTileFreshness(const TTile &aTile);
+	
 	// @return Pointer to CTileBitmapManagerItem object or NULL if not found
 	CTileBitmapManagerItem* Find(const TTile &aTile) const;
-	void StartDownloadTileL(const TTile &aTile);
+	inline TInt BucketIndex(const TTile &aTile) const
+		{ TUint32 h = aTile.Hash(); return (h ^ (h >> 16)) & (iBucketsCount - 1); };
+	void ResizeBucketsL(TInt aCount);
+	void InsertItemL(CTileBitmapManagerItem* aItem);
+	void DeleteItem(CTileBitmapManagerItem* aItem); // Unlink and destroy
+	
+	enum TEvictionReason
+		{
+		EEvictionForSpace,
+		EEvictionForMemoryPressure
+		};
+	// Delete least recently used item which is not pinned
+	// @return EFalse if all items are pinned
+	TBool EvictLeastRecentlyUsed(TEvictionReason aReason);
+	// Delete items until total size fit in memory budget (but not pinned ones)
+	void EvictToBudget(TEvictionReason aReason);
+	void UpdateBytesHeld(TInt aDelta);
+	
+	static TInt EnvironmentChangeCallback(TAny* aSelf);
+	void HandleEnvironmentChange(TInt aChanges);
 	
-	// Save tile bitmap to file
-	void SaveBitmapL(const TTile &aTile, /*const*/ CFbsBitmap *aBitmap/*, TBool aRewrite = EFalse*/) /*const*/;
+	// Start reading of next queued tile from disk if reader is idle
+	void StartDiskLoadingL();
+	// Start downloading of queued tiles by all idle downloaders
+	void StartDownloadsL();
+	// @return ETrue if tile is still needed for current viewport
+	TBool IsTileRelevant(const TTile &aTile) const;
+	// @return ETrue if tile is in viewport or loading margin around it
+	TBool IsTileNearViewport(const TTile &aTile) const;
+	// Drop queued and abort ongoing loadings of tiles which are not relevant
+	void CancelIrrelevantLoadings();
 	
-	// Restore tile bitmap from file
-	void LoadBitmapL(const TTile &aTile, CFbsBitmap *aBitmap) /*const*/;
+	RArray<TTile> iPrefetchTiles; // From most to least important
+	// @return Distance based priority of loading, smaller value is more important
+	TInt LoadingPriority(const TTile &aTile) const;
+	// @return Index of the most important tile in loading queue
+	TInt NextLoadingIndex(const RArray<TTile> &aQueue) const;
+	void DropIrrelevantTiles(RArray<TTile> &aQueue);
 	
+	// Called by CTileDownloader. Ownership of aBitmap is transferred.
+	void OnTileDownloadedL(const TTile &aTile, CFbsBitmap* aBitmap);
+	void OnTileDownloadingFailedL(const TTile &aTile, TInt aErrCode);
+	void OnTileStoredL(const TTile &aTile, TInt aErrCode);
+	// Notify observer of tile for store which waits for free downloader
+	// that it will not be downloaded
+	void FailPendingStoreDownloadL(TInt aErrCode);
+	void OnTileRevalidatedL(const TTile &aTile, TInt aErrCode, TBool aIsModified);
+#if LOGGING_ENABLED
+	TTimeHistogram iDownloadLatencies; // From request to decoded bitmap
+	TTimeHistogram iDecodingTailTimes; // From the end of response to decoded bitmap
+	void LogDownloadLatency(TInt aLatency, TInt aDecodingTail);
+#endif
+	friend class CTileDownloader;
+	
+	// Called by CTileDiskReader. Ownership of aBitmap is transferred.
+	void OnTileReadedL(const TTile &aTile, CFbsBitmap* aBitmap);
+	void OnTileReadingFailedL(const TTile &aTile, TInt aErrCode);
+	void OnTileMigratedL(const TTile &aTile, TInt aErrCode);
+	friend class CTileDiskReader;
+	
+	// Pass loaded bitmap to cache item and notify observer.
+	// Ownership of aBitmap is transferred.
+	// @return ETrue if item still exists in cache
+	TBool SetItemBitmap(const TTile &aTile, CFbsBitmap* aBitmap);
+	
+	// Name of bitmap file in old cache format (one file per tile)
 	void TileFileName(const TTile &aTile, TFileName &aFileName) const;
-	TBool IsTileFileExists(const TTile &aTile) /*const*/;
 	
 public:
 	// @return Error codes: KErrNotFound, KErrNotReady or KErrNone
 	TInt GetTileBitmap(const TTile &aTile, CFbsBitmap* &aBitmap);
+	// Similar to GetTileBitmap(), but doesn`t affect usage order, stats
+	// and loading.
+	// @return Pointer to loaded bitmap or NULL
+	CFbsBitmap* PeekTileBitmap(const TTile &aTile) const;
 	void AddToLoading(const TTile &aTile);
+	// Replace set of tiles which must not be evicted from cache
+	void SetPinnedTiles(const RArray<TTile> &aTiles);
+	// Update visible area used for loading order. Queued and ongoing
+	// loadings of tiles which are not relevant anymore will be cancelled.
+	void SetViewport(const TTile &aTopLeft, const TTile &aBottomRight);
+	// Replace set of tiles to load in advance with lower priority (ordered
+	// from most to least important). Count of them is limited by part of
+	// memory budget. Loadings of previous set are cancelled.
+	void SetPrefetchTiles(const RArray<TTile> &aTiles);
+	// @return ETrue if tile is loaded only in advance (not for viewport)
+	TBool IsPrefetchOnly(const TTile &aTile) const;
+	inline void CancelPrefetch()
+		{ SetPrefetchTiles(RArray<TTile>()); };
+	inline const TTileBitmapManagerStats& Stats() const
+		{ return iStats; };
+	inline const THTTPClientStats& HTTPStats() const
+		{ return iHTTPClient->Stats(); };
+	inline TDisplayMode DisplayMode() const
+		{ return iDisplayMode; };
+	inline TInt Count() const
+		{ return iItemsCount; };
+	// @return Maximum size of all bitmaps in bytes
+	inline TInt MemoryBudget() const
+		{ return iMemoryBudget; };
+	// @return Size of one tile bitmap data in bytes
+	static inline TInt TileBitmapSize(TDisplayMode aMode)
+		{ return CFbsBitmap::ScanLineLength(KTileSize, aMode) * KTileSize; };
+	// @return Actual size of bitmap data in bytes
+	static TInt BitmapDataSize(const CFbsBitmap &aBitmap);
+	// Close tile store files (for example, to delete them). Tiles will be
+	// downloaded again until OpenTileStoreL() is called.
+	void CloseTileStore();
+	void OpenTileStoreL();
+	inline CTileStore* TileStore() const
+		{ return iTileStore; };
+	// Download tile and save it to store without decoding and caching
+	// bitmap. Download starts when there are no visible tiles in queue and
+	// one of downloaders is free. Only one such tile may be requested at
+	// the same time.
+	// Leaves with KErrNotReady if store is closed or in offline mode,
+	// KErrInUse if previous one is not finished yet.
+	void DownloadToStoreL(const TTile &aTile, MTileStoreDownloadObserver* aObserver);
+	void CancelDownloadToStore();
 	};
 
 
 /* Links Tile`s x,y,z with CFbsBitmap loaded to image server.
  * Used in CTileBitmapManager class.
  * 
- * Initially bitmap pointer is NULL. You need to call CreateBitmapIfNotExistL()
- * before start drawing bitmap. After drawing complete, you need to call SetReady().
+ * Initially bitmap pointer is NULL. Bitmap is passed by SetBitmap() after
+ * it has been completely loaded, after that you need to call SetReady().
  */
 class CTileBitmapManagerItem : public CBase
 	{
@@ -304,8 +661,16 @@ private:
 	TTile iTile;
 	CFbsBitmap* iBitmap;
 	TBool iIsReady; // ETrue when image completely drawn and ready to use
+	TBool iIsPinned; // ETrue when item must not be evicted from cache
+	TInt iMemorySize; // Size of bitmap data (expected until bitmap is loaded)
+	
+	// Links used by CTileBitmapManager for indexing
+	TDblQueLink iLink;
+	CTileBitmapManagerItem* iNextInBucket;
+	friend class CTileBitmapManager;
+	
 public:
-	void CreateBitmapIfNotExistL();
+	void SetBitmap(CFbsBitmap* aBitmap); // Takes ownership
 	inline TBool IsReady() { return iIsReady && iBitmap != NULL; };
 	inline void SetReady() { iIsReady = ETrue; };
 	
@@ -351,6 +716,7 @@ class TCoordinateEx : public TCoordinate
 	{
 protected:
 	TReal32 iCourse;
+	TReal32 iSpeed; // In metres per second
 public:
 	TCoordinateEx();
 	TCoordinateEx(const TCoordinateEx &aCoordEx);
@@ -360,6 +726,10 @@ public:
 		{ return iCourse; };
 	inline void SetCourse(TReal32 aCourse)
 		{ iCourse = aCourse; };
+	inline TReal32 Speed() const
+		{ return iSpeed; };
+	inline void SetSpeed(TReal32 aSpeed)
+		{ iSpeed = aSpeed; };
 	//operator TCoordinate() const;
 	};
 
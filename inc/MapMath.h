@@ -17,6 +17,10 @@
 
 // Constants
 const TInt KTileSize = 256; // Standard tile height and width in pixels
+// Fixed-point world coordinates are projection coordinates on this zoom,
+// so projection point on any lower zoom is obtained with single shift
+const TZoom KWorldZoom = 22;
+const TInt KWorldSize = KTileSize << KWorldZoom; // 2^30, fits to TInt with spare
 
 
 class TTile;
@@ -37,8 +41,38 @@ public:
 	static TCoordinate ProjectionPointToGeoCoords(const TPoint &aPoint, TZoom aZoom);
 	static TTile ProjectionPointToTile(const TPoint &aPoint, TZoom aZoom);
 	static TPoint TileToProjectionPoint(const TTile &aTile);
+	
+	// Fixed-point projection based on lookup tables (no trigonometry per point)
+	static TPoint GeoCoordsToWorldPoint(const TCoordinate &aCoord);
+	static TCoordinate WorldPointToGeoCoords(const TPoint &aPoint);
+	static inline TPoint WorldPointToProjectionPoint(const TPoint &aPoint, TZoom aZoom);
+	static inline TPoint ProjectionPointToWorldPoint(const TPoint &aPoint, TZoom aZoom)
+		{ return TPoint(aPoint.iX << (KWorldZoom - aZoom), aPoint.iY << (KWorldZoom - aZoom)); };
+	
+	// Batch conversions of arrays with aCount elements
+	static void GeoCoordsToProjectionPoints(const TCoordinate *aCoords, TInt aCount,
+			TZoom aZoom, TPoint *aPoints);
+	static void ProjectionPointsToGeoCoords(const TPoint *aPoints, TInt aCount,
+			TZoom aZoom, TCoordinate *aCoords);
+	
+	// Reference implementations with floating point math (slow but exact),
+	// also used for filling of lookup tables
+	static TTileReal GeoCoordsToTileRealExact(const TCoordinate &aCoord, TZoom aZoom);
+	static TCoordinate TileToGeoCoordsExact(const TTileReal &aTile, TZoom aZoom);
+	
+private:
+	static void InitLookupTables();
 	};
 
+inline TPoint MapMath::WorldPointToProjectionPoint(const TPoint &aPoint, TZoom aZoom)
+	{
+	TInt shift = KWorldZoom - aZoom;
+	if (shift <= 0)
+		return aPoint;
+	TInt half = 1 << (shift - 1); // For rounding
+	return TPoint((aPoint.iX + half) >> shift, (aPoint.iY + half) >> shift);
+	}
+
 class TTile
 	{
 public:
@@ -49,6 +83,12 @@ public:
 	friend TBool operator== (const TTile &aTile1, const TTile &aTile2);
 	friend TBool operator!= (const TTile &aTile1, const TTile &aTile2);
 	
+	// Pack x, y and z to single 64-bit value (unique for all zoom levels up to 26)
+	inline TUint64 Pack() const
+		{ return (TUint64(iZ) << 54) | (TUint64(iX) << 27) | TUint64(iY); };
+	// @return 32-bit hash of tile used for fast lookups in hash tables
+	TUint32 Hash() const;
+	
 	void AsDes(TDes &aDes) const;
 	void AsDes(TDes8 &aDes) const;
 	const TBufC<32> AsDes() const;
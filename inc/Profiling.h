@@ -0,0 +1,59 @@
+/*
+ * Profiling.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef PROFILING_H_
+#define PROFILING_H_
+
+#include <e32base.h>
+#include <e32std.h>
+
+
+// Constants
+const TInt KTimeHistogramBucketsCount = 10;
+
+
+// Measures time intervals using high resolution fast counter
+class TStopwatch
+	{
+public:
+	inline TStopwatch()
+		{ Start(); };
+	inline void Start()
+		{ iStartCount = User::FastCounter(); };
+	// Saturated at KMaxTInt, so never negative
+	TInt ElapsedMicroSeconds() const;
+
+private:
+	TUint32 iStartCount;
+	};
+
+
+// Histogram of time intervals. Bucket N contains values
+// in range [2^(N-1); 2^N) milliseconds, last bucket has no upper bound.
+class TTimeHistogram
+	{
+public:
+	TTimeHistogram();
+	void Add(TInt aMicroSeconds);
+	void Reset();
+	inline TInt Count() const
+		{ return iCount; };
+	// @return Average value in microseconds
+	TInt Average() const;
+	inline TInt Max() const
+		{ return iMax; };
+	// Print counts of all buckets, for example "<1ms:2 <2ms:5 ... >=256ms:0"
+	void AsDes(TDes8 &aDes) const;
+
+private:
+	TFixedArray<TInt, KTimeHistogramBucketsCount> iBuckets;
+	TInt iCount;
+	TInt64 iTotal;
+	TInt iMax;
+	};
+
+#endif /* PROFILING_H_ */
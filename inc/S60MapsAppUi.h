@@ -14,6 +14,8 @@
 #include <aknappui.h>
 #include <f32file.h>
 #include "Positioning.h"
+#include "AreaDownloadJob.h"
+#include "TrackRecorder.h"
 
 // For media keys handling
 #include <remconcoreapitargetobserver.h>
@@ -31,7 +33,8 @@ class CS60MapsAppView;
  * from the handler class
  */
 class CS60MapsAppUi : public CAknAppUi, public MFileManObserver,
-		public MPositionListener, public MRemConCoreApiTargetObserver
+		public MPositionListener, public MRemConCoreApiTargetObserver,
+		public MAreaDownloadJobObserver
 	{
 public:
 	// Constructors and destructor
@@ -113,6 +116,10 @@ public:
 	void MrccatoCommand(TRemConCoreApiOperationId aOperationId,
 			TRemConCoreApiButtonAction aButtonAct);
 	
+	// MAreaDownloadJobObserver
+public:
+	void OnAreaDownloadFinished(TInt aErrCode);
+	
 	// Custom properties and methods
 private:
 	CFileMan* iFileMan;
@@ -121,9 +128,19 @@ private:
 	CRemConInterfaceSelector* iInterfaceSelector;
 	CRemConCoreApiTarget* iCoreTarget;
 	
+	CAreaDownloadJob* iAreaDownloadJob;
+	
+	CTrackRecorder* iTrackRecorder;
+	
 	void ClearTilesCache();
 	
+	void DownloadVisibleAreaL();
+	
 	void ShowMapCacheStatsDialogL();
+	
+	void StartTrackRecordingL();
+	void StopTrackRecordingL();
+	void ExportTrackL();
 	};
 
 #endif // __S60MAPSAPPUI_h__
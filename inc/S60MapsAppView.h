@@ -12,15 +12,23 @@
 
 // INCLUDES
 #include <coecntrl.h>
+#include <fbs.h>
+#include <bitdev.h>
+#include <bitstd.h>
 
 #include <lbsposition.h>
 #include "MapMath.h"
 #include "Map.h"
+#include "TrackLayer.h"
+#include "FeatureLayer.h"
 #include "Defs.h"
 #include <s32strm.h>
+#include "LoggingDefs.h"
+#include "Profiling.h"
 
 // Constants
 const TUint KMapDefaultMoveStep = 20; // In pixels
+const TInt KMaxMapDirtyRects = 16; // Whole map is rendered when dirty region is more complex
 
 // CLASS DECLARATION
 class CS60MapsAppView : public CCoeControl
@@ -125,10 +133,12 @@ private:
 				// more accurate moving to position when zoom changed
 				// ToDo: Any ideas how to make it without additional property? 
 #if DISPLAY_TILE_BORDER_AND_XYZ
-	TFixedArray<CMapLayerBase*, 4> iLayers;
+	TFixedArray<CMapLayerBase*, 6> iLayers;
 #else
-	TFixedArray<CMapLayerBase*, 3> iLayers;
+	TFixedArray<CMapLayerBase*, 5> iLayers;
 #endif
+	CTrackLayer* iTrackLayer; // Not owned, stored in iLayers
+	CFeatureLayer* iFeatureLayer; // Not owned, stored in iLayers
 	
 	TCoordinateEx iUserPosition;
 	TBool iIsUserPositionRecieved;
@@ -148,6 +158,89 @@ private:
 	S60MapsMovement iMovement;
 	CPeriodic* iMovementRepeater;
 	
+	/*
+	 * iRedrawTimer
+	 * is used to coalesce all redraw requests made until
+	 * next frame and to limit frame rate.
+	 */
+	CPeriodic* iRedrawTimer;
+	mutable TStopwatch iLastFrameStopwatch; // Time since last frame drawing
+	static TInt RedrawCallback(TAny* aObject);
+	
+	/*
+	 * Drag-to-pan and kinetic panning (fling).
+	 * Velocity is measured in projection pixels per second.
+	 */
+	TBool iIsDragging;
+	TBool iIsEdgeSwipe; // Gesture started near view edge - not used for dragging
+	TPoint iLastDragPosition;
+	TStopwatch iDragStopwatch; // Time since previous drag event
+	TReal iVelocityX;
+	TReal iVelocityY;
+	CPeriodic* iFlingTimer;
+	TStopwatch iFlingStopwatch; // Time since previous animation step
+	TReal iFlingPositionX; // Not rounded value of iTopLeftPosition while fling
+	TReal iFlingPositionY;
+	void Drag(const TPoint &aPosition);
+	void StartFling();
+	void StopFling();
+	static TInt FlingCallback(TAny* aObject);
+	void ExecuteFlingStep();
+	
+	/*
+	 * Off-screen buffer with rendered map tiles layer. When map is panned,
+	 * still valid part of buffer is scrolled and only newly exposed strips
+	 * are rendered. Other layers are drawn over it directly to window.
+	 * If buffer can`t be created, map layer is drawn directly too.
+	 */
+	CFbsBitmap* iMapBuffer;
+	CFbsBitmapDevice* iMapBufferDevice;
+	CFbsBitGc* iMapBufferGc;
+	mutable TPoint iMapBufferPosition; // Value of iTopLeftPosition for buffer content
+	mutable TZoom iMapBufferZoom;
+	mutable TBool iIsMapBufferValid;
+	// Areas to redraw in projection coordinates
+	mutable TRegionFix<KMaxMapDirtyRects> iMapDirtyRegion;
+	
+	void CreateMapBufferL();
+	void DeleteMapBuffer();
+	void UpdateMapBuffer() const;
+	void DrawMapArea(const TRect &aRect) const; // aRect in screen coordinates
+	
+	/*
+	 * Animated zoom. Snapshot of map buffer made at previous zoom level is
+	 * scaled with fractional factor until animation ends, meanwhile tiles
+	 * of the new zoom level are being loaded.
+	 */
+	CFbsBitmap* iZoomSnapshot;
+	CFbsBitmapDevice* iZoomSnapshotDevice;
+	CFbsBitGc* iZoomSnapshotGc;
+	CPeriodic* iZoomAnimationTimer;
+	TStopwatch iZoomAnimationStopwatch;
+	TZoom iZoomAnimationStartZoom; // Zoom of snapshot
+	TPoint iZoomAnimationCenter; // Point of snapshot shown at the view center
+	TReal iZoomAnimationFromScale;
+	TReal iZoomScale; // Current scale of snapshot
+	void CreateZoomSnapshotL();
+	void StartZoomAnimation(TZoom aOldZoom);
+	static TInt ZoomAnimationCallback(TAny* aObject);
+	void ExecuteZoomAnimationStep();
+	void DrawZoomAnimationFrame() const;
+	
+#if LOGGING_ENABLED
+	mutable TTimeHistogram iFrameTimes; // Time of Draw() execution
+	mutable TTimeHistogram iMapFullRenderTimes; // Time of full map buffer rendering
+	mutable TTimeHistogram iMapScrollRenderTimes; // Time of map buffer update after panning
+	void LogTime(TTimeHistogram &aHistogram, TInt aMicroSeconds, const TDesC8 &aName) const;
+	mutable TInt iFramesCount;
+	TInt iGestureFramesCount; // Value of iFramesCount at panning gesture start
+	TStopwatch iGestureStopwatch;
+	void LogGestureFps() const;
+	mutable TTimeHistogram iInputLatencies; // From key event to the end of next frame
+	TTime iInputEventTime; // Time of the first key event not shown yet
+	mutable TBool iIsInputPending;
+#endif
+	
 	void Move(const TPoint &aPoint, TBool savePos = ETrue); // Used by all another Move methods
 public:
 	void Move(const TCoordinate &aPos);
@@ -168,8 +261,6 @@ private:
 	void MoveDown(	TUint aPixels = KMapDefaultMoveStep);
 	void MoveLeft(	TUint aPixels = KMapDefaultMoveStep);
 	void MoveRight(	TUint aPixels = KMapDefaultMoveStep);
-	/*inline*/ TPoint ProjectionCoordsToScreenCoords(const TPoint &aPoint) const;
-	/*inline*/ TPoint ScreenCoordsToProjectionCoords(const TPoint &aPoint) const;
 	
 	void UpdateUserPosition();
 	
@@ -180,6 +271,8 @@ public:
 	TBool CheckPointVisibility(const TPoint &aPoint) const;
 	TPoint GeoCoordsToScreenCoords(const TCoordinate &aCoord) const;
 	TCoordinate ScreenCoordsToGeoCoords(const TPoint &aPoint) const;
+	/*inline*/ TPoint ProjectionCoordsToScreenCoords(const TPoint &aPoint) const;
+	/*inline*/ TPoint ScreenCoordsToProjectionCoords(const TPoint &aPoint) const;
 	void Bounds(TCoordinate &aTopLeftCoord, TCoordinate &aBottomRightCoord) const;
 	void Bounds(TTile &aTopLeftTile, TTile &aBottomRightTile) const;
 	void Bounds(TTileReal &aTopLeftTile, TTileReal &aBottomRightTile) const;
@@ -189,6 +282,21 @@ public:
 	void ShowUserPosition();
 	void HideUserPosition();
 	void SetFollowUser(TBool anEnabled = ETrue);
+	inline TBool IsFollowUser() const
+		{ return iIsFollowUser; };
+	// Map tiles layer is always the bottom one
+	inline CTiledMapLayer* TiledMapLayer() const
+		{ return static_cast<CTiledMapLayer*>(iLayers[0]); };
+	inline CTrackLayer* TrackLayer() const
+		{ return iTrackLayer; };
+	inline CFeatureLayer* FeatureLayer() const
+		{ return iFeatureLayer; };
+	// Mark part of map (in screen coordinates) to be rendered again
+	// at next drawing
+	void InvalidateMapArea(const TRect &aRect);
+	// Schedule drawing of the view. All requests made before next
+	// frame result in single redraw.
+	void RequestRedraw();
 
 	};
 	
@@ -0,0 +1,102 @@
+/*
+ * SpatialIndex.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef SPATIALINDEX_H_
+#define SPATIALINDEX_H_
+
+#include <e32base.h>
+#include <f32file.h>
+#include <s32strm.h>
+#include <lbsposition.h>
+#include "MapMath.h"
+
+
+// Constants
+const TZoom KSpatialIndexBaseZoom = 16; // Zoom of the smallest (leaf) quadtree cells
+
+
+// Quadtree node. Node on level N corresponds to tile on zoom N.
+class TSpatialIndexNode
+	{
+public:
+	TInt32 iChildren[4]; // Indices of child nodes or -1, order: (x, y) bits
+	TInt32 iFirstItem; // Head of list of items (leaf nodes only) or -1
+	TInt32 iCount; // Count of items in whole subtree
+	};
+
+class TSpatialIndexItem
+	{
+public:
+	TPoint iPosition; // In world coordinates (see MapMath::GeoCoordsToWorldPoint)
+	TUint32 iId;
+	TInt32 iNode; // Leaf node containing this item or -1 for free slot
+	TInt32 iNext; // Next item in the same leaf or next free slot
+	};
+
+
+/* Spatial index of point features (waypoints, POIs, search results, etc.)
+ * based on quadtree keyed by tiles. Leaf nodes are tiles of base zoom.
+ * Query of features in visible range of tiles visits only non-empty nodes,
+ * so it takes time proportional to count of found features (plus nodes
+ * crossing the edges of range).
+ *
+ * Features are addressed by handles, which stay valid until removal.
+ */
+class CSpatialIndex : public CBase
+	{
+// Base methods
+public:
+	~CSpatialIndex();
+	static CSpatialIndex* NewL();
+	static CSpatialIndex* NewLC();
+
+private:
+	CSpatialIndex();
+
+// Custom properties and methods
+private:
+	RArray<TSpatialIndexNode> iNodes; // First one is the root
+	RArray<TSpatialIndexItem> iItems;
+	RPointerArray<HBufC> iNames; // Same indices as in iItems
+	TInt32 iFirstFreeItem;
+	TInt iCount;
+
+	TInt InsertWorldPointL(TUint32 aId, const TPoint &aWorldPoint, const TDesC &aName);
+	TInt AppendNodeL();
+	// Find leaf node for given world point, missing nodes are created
+	TInt LeafNodeL(const TPoint &aWorldPoint);
+	// Add aDelta to counts of all nodes from root to leaf
+	void UpdateCounts(const TPoint &aWorldPoint, TInt aDelta);
+	static void LeafCell(const TPoint &aWorldPoint, TInt &aX, TInt &aY);
+
+public:
+	// @return Handle of inserted feature
+	TInt InsertL(TUint32 aId, const TCoordinate &aCoord, const TDesC &aName);
+	void Remove(TInt aHandle);
+	void Reset();
+	inline TInt Count() const
+		{ return iCount; };
+	// Find features located in range of tiles (inclusive) of any zoom level.
+	// Handles are appended to aHandles, search stops when aMaxCount
+	// features found.
+	void FindL(const TTile &aTopLeft, const TTile &aBottomRight,
+			RArray<TInt> &aHandles, TInt aMaxCount = KMaxTInt) const;
+	inline TUint32 Id(TInt aHandle) const
+		{ return iItems[aHandle].iId; };
+	inline const TPoint& Position(TInt aHandle) const
+		{ return iItems[aHandle].iPosition; };
+	inline const TDesC& Name(TInt aHandle) const
+		{ return *iNames[aHandle]; };
+
+	// Features are stored in quadtree order with delta coded positions
+	void ExternalizeL(RWriteStream &aStream) const;
+	void InternalizeL(RReadStream &aStream);
+	void SaveL(RFs &aFs, const TDesC &aFileName) const;
+	void LoadL(RFs &aFs, const TDesC &aFileName);
+	};
+
+#endif /* SPATIALINDEX_H_ */
@@ -0,0 +1,39 @@
+/*
+ * StreamUtils.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef STREAMUTILS_H_
+#define STREAMUTILS_H_
+
+#include <e32base.h>
+#include <s32strm.h>
+
+
+// Variable length encoding of integers for compact file formats.
+// Each byte holds 7 bits of value, high bit means that more bytes follow.
+// Signed values are zigzag encoded first, so small negative deltas are
+// short too.
+class StreamUtils
+	{
+public:
+	static void WriteVarUintL(RWriteStream &aStream, TUint32 aValue);
+	static TUint32 ReadVarUintL(RReadStream &aStream);
+	static void WriteVarIntL(RWriteStream &aStream, TInt32 aValue);
+	static TInt32 ReadVarIntL(RReadStream &aStream);
+	
+	// @return Count of bytes required for encoding of the value
+	static TInt VarUintSize(TUint32 aValue);
+	static inline TInt VarIntSize(TInt32 aValue)
+		{ return VarUintSize(ZigZag(aValue)); };
+	
+private:
+	static inline TUint32 ZigZag(TInt32 aValue)
+		{ return (TUint32(aValue) << 1) ^ TUint32(aValue >> 31); };
+	static inline TInt32 UnZigZag(TUint32 aValue)
+		{ return TInt32(aValue >> 1) ^ -TInt32(aValue & 1); };
+	};
+
+#endif /* STREAMUTILS_H_ */
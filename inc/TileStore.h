@@ -0,0 +1,202 @@
+/*
+ * TileStore.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef TILESTORE_H_
+#define TILESTORE_H_
+
+#include <e32base.h>
+#include <f32file.h>
+#include "MapMath.h"
+
+
+const TInt KMaxETagLength = 64; // Longer ETags are not saved
+
+
+// HTTP caching information of tile. All times are in seconds since
+// 01.01.1970 UTC, zero means unknown.
+class TTileMetadata
+	{
+public:
+	TTileMetadata();
+	
+	TUint32 iFetchTime; // When tile has been downloaded or revalidated
+	TUint32 iExpiryTime; // From Cache-Control or Expires headers
+	TUint32 iLastModified;
+	TBuf8<KMaxETagLength> iETag;
+	
+	static TUint32 TimeToSeconds(const TTime &aTime);
+	static TTime SecondsToTime(TUint32 aSeconds);
+	// @return Current time in seconds
+	static TUint32 Now();
+	};
+
+
+// Location of tile data inside data file
+class TTileStoreEntry
+	{
+public:
+	TTile iTile;
+	TInt iOffset; // Position of data (after record header and ETag) in data file
+	TInt iLength; // Data size in bytes
+	TInt iNext; // Index of next entry in the same hash bucket or KErrNotFound
+	TUint32 iFetchTime;
+	TUint32 iExpiryTime;
+	TUint32 iLastModified;
+	TInt iETagLength; // ETag is stored just before data
+	};
+
+
+// Space in data file reserved for tile data which is written by parts
+class TTileStoreReservation
+	{
+public:
+	TTile iTile;
+	TInt iOffset; // Position of data in data file
+	TInt iLength; // Reserved size in bytes
+	TInt iWritten; // Count of already written bytes
+	TUint32 iFetchTime;
+	TUint32 iExpiryTime;
+	TUint32 iLastModified;
+	TInt iETagLength;
+	};
+
+
+// Counters of written data
+class TTileStoreStats
+	{
+public:
+	TUint iWrittenTiles;
+	TUint iWrittenBytes; // Including record headers
+	};
+
+
+/* Packed storage of tiles images (PNG, etc...) in single data file.
+ * 
+ * Data file is append-only: each record consists of header with x, y, z,
+ * length and HTTP caching information followed by ETag and original tile
+ * image bytes. Replaced records remain in file as garbage until CompactL()
+ * is called. Data file of previous version (without caching information)
+ * is converted at opening.
+ * 
+ * Image may be written by parts while it is being downloaded: ReserveL()
+ * allocates record of known size, WriteL() puts next part to it and
+ * CommitReservationL() makes record visible. Uncommitted records are
+ * skipped when data file is scanned.
+ * 
+ * Index file contains list of all records sorted by (z, x, y). It is
+ * loaded to memory hash table at startup and rewritten atomically
+ * (via temporary file) by CommitL(). Records appended after last commit
+ * (for example, if program crashed) are restored by scanning tail of data file.
+ */
+class CTileStore : public CBase
+	{
+// Base methods
+public:
+	~CTileStore();
+	static CTileStore* NewL(RFs aFs, const TDesC &aDir);
+	static CTileStore* NewLC(RFs aFs, const TDesC &aDir);
+
+private:
+	CTileStore(RFs aFs);
+	void ConstructL(const TDesC &aDir);
+
+// Custom properties and methods
+private:
+	RFs iFs;
+	TUint32 iVersion; // Format version of opened data file
+	TInt iRecordHeaderSize; // Depends on version
+	RFile iDataFile;
+	TFileName iDataFileName;
+	TFileName iIndexFileName;
+	TInt iDataFileSize;
+	TInt iWastedSize; // Bytes occupied by replaced records
+	TInt iUncommittedCount; // Count of changes which are not saved to index yet
+	TInt iReservationsCount; // Count of not finished reservations
+	TTileStoreStats iStats;
+	
+	RArray<TTileStoreEntry> iEntries;
+	RArray<TInt> iBuckets; // Index of first entry in bucket or KErrNotFound
+	
+	void OpenDataFileL();
+	// @return Size of data file part covered by index
+	TInt LoadIndexL();
+	void SaveIndexL();
+	// Restore records which were written after index had been saved
+	void ScanDataFileL(TInt aStartPos);
+	
+	// Write record header and ETag to the end of data file. Size of data
+	// file is not advanced, caller does it after data has been written.
+	// @return Position of record data
+	TInt AppendRecordHeaderL(const TTile &aTile, TInt aLength, TUint32 aMagic,
+			const TTileMetadata &aMetadata);
+	void OnRecordWrittenL(const TTileStoreEntry &aEntry);
+	// Cut off partially appended record and leave with aError
+	void DiscardAppendedRecordL(TInt aError);
+	// @return Size of whole record including header
+	inline TInt RecordSize(const TTileStoreEntry &aEntry) const
+		{ return iRecordHeaderSize + aEntry.iETagLength + aEntry.iLength; };
+	
+	TInt FindEntry(const TTile &aTile) const;
+	void AddEntryL(const TTileStoreEntry &aEntry);
+	void RebuildBucketsL(TInt aCount);
+	inline TInt BucketIndex(const TTile &aTile) const
+		{ TUint32 h = aTile.Hash(); return (h ^ (h >> 16)) & (iBuckets.Count() - 1); };
+	
+public:
+	inline TBool Contains(const TTile &aTile) const
+		{ return FindEntry(aTile) != KErrNotFound; };
+	// @return Size of tile data in bytes or KErrNotFound
+	TInt DataSize(const TTile &aTile) const;
+	// Read tile data synchronously
+	void ReadL(const TTile &aTile, TDes8 &aData);
+	// Read tile data asynchronously. Maximum length of aData must be
+	// not less than DataSize(aTile).
+	void Read(const TTile &aTile, TDes8 &aData, TRequestStatus &aStatus);
+	void ReadCancel(TRequestStatus &aStatus);
+	// Get caching information of tile. ETag is readed from data file.
+	void GetMetadataL(const TTile &aTile, TTileMetadata &aMetadata);
+	// Merge caching information from response which says that tile is not
+	// modified (304). Fetch time is always replaced, other fields only if
+	// they are present (not zero or empty) in aMetadata, otherwise stored
+	// ones are kept. Missing expiry time is prolonged by stored lifetime.
+	// New ETag replaces stored one only if it has the same length, because
+	// record can`t be resized in place.
+	void UpdateMetadataL(const TTile &aTile, const TTileMetadata &aMetadata);
+	// @return ETrue if tile exists and its expiry time has passed. If
+	//         expiry time is unknown, tile expires aDefaultTtl seconds
+	//         after downloading.
+	TBool IsStale(const TTile &aTile, TUint32 aNow, TUint32 aDefaultTtl) const;
+	// Save tile data. Previous data of this tile (if any) will be replaced.
+	void AppendL(const TTile &aTile, const TDesC8 &aData, const TTileMetadata &aMetadata);
+	// Reserve space for tile data of known size which will be written by parts
+	void ReserveL(const TTile &aTile, TInt aLength, TTileStoreReservation &aReservation,
+			const TTileMetadata &aMetadata);
+	// Write next part of data to reserved space
+	void WriteL(TTileStoreReservation &aReservation, const TDesC8 &aData);
+	// Make written data available for reading. Previous data of this tile
+	// (if any) will be replaced. Leaves with KErrCorrupt if not all reserved
+	// space has been written.
+	void CommitReservationL(const TTileStoreReservation &aReservation);
+	// Reserved space becomes garbage
+	void CancelReservation(const TTileStoreReservation &aReservation);
+	// Save index to disk
+	void CommitL();
+	// Remove garbage from data file. Leaves with KErrInUse if there are
+	// not finished reservations.
+	void CompactL();
+	
+	inline TInt Count() const
+		{ return iEntries.Count(); };
+	inline TInt DataFileSize() const
+		{ return iDataFileSize; };
+	inline TInt WastedSize() const
+		{ return iWastedSize; };
+	inline const TTileStoreStats& Stats() const
+		{ return iStats; };
+	};
+
+#endif /* TILESTORE_H_ */
@@ -0,0 +1,135 @@
+/*
+ * TrackLayer.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef TRACKLAYER_H_
+#define TRACKLAYER_H_
+
+#include <e32base.h>
+#include <gdi.h>
+#include <lbsposition.h>
+#include "Map.h"
+#include "MapMath.h"
+
+
+/* Compact storage of track points as structure of arrays. Coordinates
+ * are kept in fixed-point world space (see MapMath::GeoCoordsToWorldPoint),
+ * so one point takes 8 bytes and projection to any zoom is just a shift.
+ * Track may consist of several segments (for example, separated by loss
+ * of GPS signal), segments are not connected while drawing.
+ */
+class CTrackPointStore : public CBase
+	{
+// Base methods
+public:
+	~CTrackPointStore();
+	static CTrackPointStore* NewL();
+	static CTrackPointStore* NewLC();
+
+private:
+	CTrackPointStore();
+
+// Custom properties and methods
+private:
+	RArray<TInt32> iX;
+	RArray<TInt32> iY;
+	RArray<TInt> iSegmentStarts; // Index of first point of each segment
+	TRect iBounds; // Bounding box of all points in world coordinates
+	TBool iIsNewSegment; // Next appended point starts new segment
+
+public:
+	void AppendL(const TCoordinate &aCoord);
+	void AppendL(const TPoint &aWorldPoint);
+	// Next appended point will not be connected with previous one
+	void StartSegment();
+	void Reset();
+	inline TInt Count() const
+		{ return iX.Count(); };
+	inline TPoint At(TInt aIndex) const
+		{ return TPoint(iX[aIndex], iY[aIndex]); };
+	inline const RArray<TInt>& SegmentStarts() const
+		{ return iSegmentStarts; };
+	inline const TRect& Bounds() const
+		{ return iBounds; };
+	};
+
+
+/* Result of Douglas-Peucker simplification of track for one zoom level.
+ * Kept points are committed once they precede a point exceeding the
+ * tolerance. When new points are appended to the store, only the open
+ * tail starting from the last committed point is processed again, so
+ * the live track is simplified like the whole one.
+ */
+class CTrackSimplification : public CBase
+	{
+// Base methods
+public:
+	CTrackSimplification(TInt aTolerance);
+	~CTrackSimplification();
+
+// Custom properties and methods
+private:
+	TInt iTolerance; // Max deviation in world units
+	RArray<TInt> iIndices; // Indices of kept points in ascending order
+	TInt iCommittedCount; // Count of leading items in iIndices which are final
+	TInt iPointsCount; // Count of store points already processed
+	RArray<TInt> iStack; // Pairs of first/last indices of ranges to process
+
+	// Append aFirst (unless it is the last kept point already) and all
+	// kept points up to aLast inclusive
+	void SimplifyRangeL(const CTrackPointStore &aPoints, TInt aFirst, TInt aLast);
+
+public:
+	// Process points appended since previous call
+	void UpdateL(const CTrackPointStore &aPoints);
+	inline const RArray<TInt>& Indices() const
+		{ return iIndices; };
+	};
+
+
+// Draws recorded or imported tracks as polylines
+class CTrackLayer : public CMapLayerBase
+	{
+// Base methods
+public:
+	~CTrackLayer();
+	static CTrackLayer* NewL(CS60MapsAppView* aMapView);
+	static CTrackLayer* NewLC(CS60MapsAppView* aMapView);
+
+private:
+	CTrackLayer(CS60MapsAppView* aMapView);
+	void ConstructL();
+
+// From CMapLayerBase
+public:
+	void Draw(CBitmapContext &aGc);
+
+// Custom properties and methods
+private:
+	CTrackPointStore* iPoints;
+	// Cache of simplified track for each zoom, created at first drawing
+	TFixedArray<CTrackSimplification*, KWorldZoom + 1> iSimplifications;
+	RArray<TPoint> iRunPoints; // Screen points of currently collected visible run
+	TInt iRunLength;
+#if LOGGING_ENABLED
+	TTimeHistogram iDrawTimes;
+#endif
+
+	void DrawL(CBitmapContext &aGc);
+	CTrackSimplification* SimplificationL(TZoom aZoom);
+	void AppendRunPointL(const TPoint &aPoint);
+	void FlushRun(CBitmapContext &aGc);
+	void InvalidateSimplifications();
+
+public:
+	void AppendPointL(const TCoordinate &aCoord);
+	void StartSegment();
+	void Reset();
+	inline const CTrackPointStore* Points() const
+		{ return iPoints; };
+	};
+
+#endif /* TRACKLAYER_H_ */
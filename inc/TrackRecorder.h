@@ -0,0 +1,109 @@
+/*
+ * TrackRecorder.h
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#ifndef TRACKRECORDER_H_
+#define TRACKRECORDER_H_
+
+#include <e32base.h>
+#include <f32file.h>
+#include <lbsposition.h>
+
+
+// Constants
+const TInt KTrackRingBufferSize = 64; // Max count of fixes kept in RAM
+const TInt KTrackFlushInterval = 30; // In fixes
+const TInt KMaxTrackFixSize = 20; // Encoded size of fix in worst case
+const TInt KMaxTrackBlockSize = KTrackRingBufferSize * KMaxTrackFixSize + 16;
+
+
+class TTrackFix
+	{
+public:
+	TTime iTime;
+	TReal64 iLatitude;
+	TReal64 iLongitude;
+	TReal32 iAltitude; // NaN if unknown
+	TBool iIsSegmentStart; // Not connected with previous fix
+	};
+
+
+/* Writes GPS track to file. Fixes are collected in fixed size ring buffer
+ * and periodically appended to the file as self-contained blocks:
+ * first fix of block is stored as is, next ones as varint encoded deltas
+ * (about 4-6 bytes per fix). File is never rewritten, so in case of crash
+ * all blocks except possibly the last incomplete one remain readable.
+ *
+ * If writing fails, fixes are kept in the buffer until next try, the
+ * oldest ones are dropped when buffer is full.
+ */
+class CTrackRecorder : public CBase
+	{
+// Base methods
+public:
+	~CTrackRecorder();
+	static CTrackRecorder* NewL(RFs aFs);
+	static CTrackRecorder* NewLC(RFs aFs);
+
+private:
+	CTrackRecorder(RFs aFs);
+
+// Custom properties and methods
+private:
+	RFs iFs;
+	RFile iFile;
+	TBool iIsRecording;
+	TFileName iFileName; // Current or last recorded file
+	TFixedArray<TTrackFix, KTrackRingBufferSize> iFixes; // Not yet written fixes
+	TInt iFirstFix; // Index of the oldest fix in ring buffer
+	TInt iFixesCount; // Count of fixes in ring buffer
+	TBool iIsNewSegment; // Next added fix starts new track segment
+	TBuf8<KMaxTrackBlockSize> iBlockBuff;
+	TBuf8<KMaxTrackBlockSize> iPayloadBuff;
+
+	// Statistics
+	TInt iTotalFixesCount;
+	TInt iWrittenFixesCount;
+	TInt iLostFixesCount;
+	TInt iFileSize; // Size of all completely written blocks
+
+	// Write all pending fixes, each segment starts new block
+	void FlushL();
+	// Write aCount oldest pending fixes as one block
+	void WriteBlockL(TInt aCount);
+	void EncodeBlockL(TInt aCount);
+
+public:
+	// Create new file and start recording
+	void StartL(const TDesC &aFileName);
+	// Write all pending fixes and close the file
+	void Stop();
+	inline TBool IsRecording() const
+		{ return iIsRecording; };
+	void AddFixL(const TPosition &aPosition);
+	// Next fix will not be connected with previous one (signal lost, etc.).
+	// Pending fixes are written, segment break is kept even if it fails.
+	void StartSegmentL();
+	inline const TDesC& FileName() const
+		{ return iFileName; };
+
+	inline TInt TotalFixesCount() const
+		{ return iTotalFixesCount; };
+	inline TInt WrittenFixesCount() const
+		{ return iWrittenFixesCount; };
+	inline TInt LostFixesCount() const
+		{ return iLostFixesCount; };
+	inline TInt FileSize() const
+		{ return iFileSize; };
+	// Average size of written fix including headers
+	TReal BytesPerFix() const;
+
+	// Convert track file to GPX with single pass, only one block
+	// is kept in memory at any time
+	static void ExportGpxL(RFs &aFs, const TDesC &aTrackFileName, const TDesC &aGpxFileName);
+	};
+
+#endif /* TRACKRECORDER_H_ */
@@ -0,0 +1,399 @@
+/*
+ * AreaDownloadJob.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "AreaDownloadJob.h"
+#include "TileStore.h"
+#include "Logger.h"
+#include <s32file.h>
+
+
+// Constants
+const TUint32 KStateFileMagic = 0x4A413653; // "S6AJ"
+const TUint32 KStateFileVersion = 1;
+_LIT(KTempFileExtension, ".tmp");
+const TInt KDefaultMaxTilesPerSecond = 2; // Do not overload tile server
+const TInt KMaxSkipsPerStep = 500; // Max count of cached tiles checked at once
+const TInt KStateSaveInterval = 20; // In tiles
+const TInt KMaxConsecutiveFailures = 10; // Stop job if network seems unavailable
+const TInt KDefaultAverageTileSize = 15 * 1024; // Used for estimation when store is empty
+
+
+CAreaDownloadJob::CAreaDownloadJob(CTileBitmapManager* aManager, RFs aFs,
+		MAreaDownloadJobObserver* aObserver) :
+		iManager(aManager),
+		iFs(aFs),
+		iObserver(aObserver)
+	{
+	// No implementation required
+	}
+
+CAreaDownloadJob::~CAreaDownloadJob()
+	{
+	Stop();
+	delete iTimer;
+	}
+
+CAreaDownloadJob* CAreaDownloadJob::NewLC(CTileBitmapManager* aManager, RFs aFs,
+		const TDesC &aStateFileName, MAreaDownloadJobObserver* aObserver)
+	{
+	CAreaDownloadJob* self = new (ELeave) CAreaDownloadJob(aManager, aFs, aObserver);
+	CleanupStack::PushL(self);
+	self->ConstructL(aStateFileName);
+	return self;
+	}
+
+CAreaDownloadJob* CAreaDownloadJob::NewL(CTileBitmapManager* aManager, RFs aFs,
+		const TDesC &aStateFileName, MAreaDownloadJobObserver* aObserver)
+	{
+	CAreaDownloadJob* self = CAreaDownloadJob::NewLC(aManager, aFs, aStateFileName, aObserver);
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CAreaDownloadJob::ConstructL(const TDesC &aStateFileName)
+	{
+	iStateFileName.Copy(aStateFileName);
+	iTimer = CPeriodic::NewL(CActive::EPriorityLow);
+	SetMaxTilesPerSecond(KDefaultMaxTilesPerSecond);
+	}
+
+TInt CAreaDownloadJob::TilesCount(const TCoordinate &aTopLeft, const TCoordinate &aBottomRight,
+		TZoom aMinZoom, TZoom aMaxZoom)
+	{
+	TInt64 count = 0;
+	for (TZoom zoom = aMinZoom; zoom <= aMaxZoom; zoom++)
+		{
+		TTile topLeft, bottomRight;
+		TilesRange(aTopLeft, aBottomRight, zoom, topLeft, bottomRight);
+		count += TInt64(bottomRight.iX - topLeft.iX + 1) * TInt64(bottomRight.iY - topLeft.iY + 1);
+		}
+	return count > KMaxTInt ? KMaxTInt : I64INT(count);
+	}
+
+TInt64 CAreaDownloadJob::EstimatedSize(TInt aTilesCount) const
+	{
+	TInt averageSize = KDefaultAverageTileSize;
+	CTileStore* store = iManager->TileStore();
+	if (store != NULL && store->Count() > 0)
+		averageSize = (store->DataFileSize() - store->WastedSize()) / store->Count();
+	return TInt64(aTilesCount) * averageSize;
+	}
+
+void CAreaDownloadJob::StartL(const TCoordinate &aTopLeft, const TCoordinate &aBottomRight,
+		TZoom aMinZoom, TZoom aMaxZoom)
+	{
+	Discard();
+	
+	iTopLeft = aTopLeft;
+	iBottomRight = aBottomRight;
+	iMinZoom = Min(aMinZoom, aMaxZoom);
+	iMaxZoom = Max(aMinZoom, aMaxZoom);
+	iTilesTotal = TilesCount(iTopLeft, iBottomRight, iMinZoom, iMaxZoom);
+	iTilesDownloaded = iTilesSkipped = iTilesFailed = 0;
+	iIsCompleted = EFalse;
+	TTile bottomRight;
+	TilesRange(iMinZoom, iCurrentTile, bottomRight);
+	SaveStateL();
+	
+	LOG(_L8("Area download started: zoom %d-%d, %d tiles"), iMinZoom, iMaxZoom, iTilesTotal);
+	iIsRunning = ETrue;
+	iStartTime.UniversalTime();
+	iSessionTilesDownloaded = 0;
+	iConsecutiveFailures = 0;
+	ScheduleNext(0);
+	}
+
+TBool CAreaDownloadJob::ResumeL()
+	{
+	if (iIsRunning)
+		return ETrue;
+	
+	TRAPD(r, LoadStateL());
+	if (r == KErrNotFound || r == KErrPathNotFound || r == KErrEof || r == KErrCorrupt)
+		{
+		if (r != KErrNotFound && r != KErrPathNotFound)
+			iFs.Delete(iStateFileName); // Damaged
+		iTilesTotal = 0;
+		return EFalse;
+		}
+	User::LeaveIfError(r);
+	
+	if (iIsCompleted)
+		return EFalse;
+	
+	LOG(_L8("Area download resumed: %d of %d tiles processed"), TilesProcessed(), iTilesTotal);
+	iIsRunning = ETrue;
+	iStartTime.UniversalTime();
+	iSessionTilesDownloaded = 0;
+	iConsecutiveFailures = 0;
+	ScheduleNext(0);
+	return ETrue;
+	}
+
+void CAreaDownloadJob::Stop()
+	{
+	if (!iIsRunning)
+		return;
+	
+	iIsRunning = EFalse;
+	iTimer->Cancel();
+	if (iIsWaitingTile)
+		{
+		iManager->CancelDownloadToStore();
+		iIsWaitingTile = EFalse;
+		}
+	
+	TRAPD(r, SaveStateL());
+	LOG(_L8("Area download stopped at %d of %d tiles (%.2f tiles/s), state saving error: %d"),
+			TilesProcessed(), iTilesTotal, TilesPerSecond(), r);
+	}
+
+void CAreaDownloadJob::Discard()
+	{
+	Stop();
+	iFs.Delete(iStateFileName);
+	iTilesTotal = iTilesDownloaded = iTilesSkipped = iTilesFailed = 0;
+	}
+
+void CAreaDownloadJob::SetMaxTilesPerSecond(TInt aTilesPerSecond)
+	{
+	iMinRequestInterval = 1000000 / Max(1, aTilesPerSecond);
+	}
+
+TReal CAreaDownloadJob::TilesPerSecond() const
+	{
+	TTime now;
+	now.UniversalTime();
+	TInt64 time = now.MicroSecondsFrom(iStartTime).Int64();
+	if (time <= 0)
+		return 0;
+	
+	return iSessionTilesDownloaded * 1000000.0 / I64REAL(time);
+	}
+
+void CAreaDownloadJob::OnTileStoredL(const TTile &aTile, TInt aErrCode)
+	{
+	iIsWaitingTile = EFalse;
+	if (!iIsRunning)
+		return;
+	
+	if (aErrCode == KErrNone)
+		{
+		iTilesDownloaded++;
+		iSessionTilesDownloaded++;
+		iConsecutiveFailures = 0;
+		}
+	else
+		{
+		LOG(_L8("Area download: failed to download tile %S, error: %d"), &aTile.AsDes8(), aErrCode);
+		if (aErrCode == KErrNotReady // Offline mode or store closed
+				|| ++iConsecutiveFailures >= KMaxConsecutiveFailures)
+			{
+			// Current tile will be tried again when job is resumed
+			Finish(aErrCode);
+			return;
+			}
+		iTilesFailed++;
+		}
+	
+	Advance();
+	if (++iUnsavedTilesCount >= KStateSaveInterval)
+		{
+		TRAPD(r, SaveStateL());
+		if (r != KErrNone)
+			LOG(_L8("Failed to save area download state, error: %d"), r);
+		LOG(_L8("Area download: %d of %d tiles (downloaded: %d, skipped: %d, failed: %d), %.2f tiles/s"),
+				TilesProcessed(), iTilesTotal, iTilesDownloaded, iTilesSkipped, iTilesFailed,
+				TilesPerSecond());
+		}
+	
+	// Keep rate limit
+	TTime now;
+	now.UniversalTime();
+	TInt64 elapsed = now.MicroSecondsFrom(iRequestTime).Int64();
+	ScheduleNext(elapsed >= iMinRequestInterval ? 0 : iMinRequestInterval - I64INT(elapsed));
+	}
+
+void CAreaDownloadJob::TilesRange(TZoom aZoom, TTile &aTopLeft, TTile &aBottomRight) const
+	{
+	TilesRange(iTopLeft, iBottomRight, aZoom, aTopLeft, aBottomRight);
+	}
+
+void CAreaDownloadJob::TilesRange(const TCoordinate &aTopLeft, const TCoordinate &aBottomRight,
+		TZoom aZoom, TTile &aTopLeftTile, TTile &aBottomRightTile)
+	{
+	aTopLeftTile = MapMath::GeoCoordsToTile(aTopLeft, aZoom);
+	aBottomRightTile = MapMath::GeoCoordsToTile(aBottomRight, aZoom);
+	
+	// Clamp to map bounds
+	TUint32 maxXY = (1 << aZoom) - 1;
+	aTopLeftTile.iX = Min(aTopLeftTile.iX, maxXY);
+	aTopLeftTile.iY = Min(aTopLeftTile.iY, maxXY);
+	aBottomRightTile.iX = Max(aTopLeftTile.iX, Min(aBottomRightTile.iX, maxXY));
+	aBottomRightTile.iY = Max(aTopLeftTile.iY, Min(aBottomRightTile.iY, maxXY));
+	}
+
+void CAreaDownloadJob::Advance()
+	{
+	TTile topLeft, bottomRight;
+	TilesRange(iCurrentTile.iZ, topLeft, bottomRight);
+	
+	if (++iCurrentTile.iX <= bottomRight.iX)
+		return;
+	
+	iCurrentTile.iX = topLeft.iX;
+	if (++iCurrentTile.iY <= bottomRight.iY)
+		return;
+	
+	if (iCurrentTile.iZ >= iMaxZoom)
+		{
+		iIsCompleted = ETrue;
+		return;
+		}
+	
+	TilesRange(iCurrentTile.iZ + 1, iCurrentTile, bottomRight);
+	}
+
+void CAreaDownloadJob::ScheduleNext(TInt aDelay)
+	{
+	iTimer->Cancel();
+	iTimer->Start(aDelay, aDelay + 1, TCallBack(TimerCallback, this));
+	}
+
+TInt CAreaDownloadJob::TimerCallback(TAny* aSelf)
+	{
+	CAreaDownloadJob* self = static_cast<CAreaDownloadJob*>(aSelf);
+	self->iTimer->Cancel();
+	TRAPD(r, self->ProcessNextL());
+	if (r != KErrNone)
+		self->Finish(r);
+	return 0;
+	}
+
+void CAreaDownloadJob::ProcessNextL()
+	{
+	if (!iIsRunning)
+		return;
+	
+	CTileStore* store = iManager->TileStore();
+	if (store == NULL)
+		User::Leave(KErrNotReady);
+	
+	for (TInt i = 0; i < KMaxSkipsPerStep; i++)
+		{
+		if (iIsCompleted)
+			{
+			Finish(KErrNone);
+			return;
+			}
+		
+		if (store->Contains(iCurrentTile))
+			{
+			// Already cached
+			iTilesSkipped++;
+			iUnsavedTilesCount++;
+			Advance();
+			continue;
+			}
+		
+		iManager->DownloadToStoreL(iCurrentTile, this);
+		iIsWaitingTile = ETrue;
+		iRequestTime.UniversalTime();
+		return;
+		}
+	
+	// Too many cached tiles in a row - give a chance to other active objects
+	ScheduleNext(0);
+	}
+
+void CAreaDownloadJob::Finish(TInt aErrCode)
+	{
+	iIsRunning = EFalse;
+	iTimer->Cancel();
+	if (iIsWaitingTile)
+		{
+		iManager->CancelDownloadToStore();
+		iIsWaitingTile = EFalse;
+		}
+	
+	LOG(_L8("Area download finished with code %d: downloaded %d, skipped %d, failed %d, %.2f tiles/s"),
+			aErrCode, iTilesDownloaded, iTilesSkipped, iTilesFailed, TilesPerSecond());
+	
+	if (iIsCompleted)
+		iFs.Delete(iStateFileName);
+	else
+		TRAP_IGNORE(SaveStateL()); // Allow to resume later
+	
+	iObserver->OnAreaDownloadFinished(aErrCode);
+	}
+
+void CAreaDownloadJob::SaveStateL()
+	{
+	TInt r = iFs.MkDirAll(iStateFileName);
+	if (r != KErrAlreadyExists)
+		User::LeaveIfError(r);
+	
+	// Write to temporary file first, so state file is always consistent
+	TFileName tempFileName(iStateFileName);
+	tempFileName.Append(KTempFileExtension);
+	
+	RFileWriteStream stream;
+	User::LeaveIfError(stream.Replace(iFs, tempFileName, EFileWrite));
+	CleanupClosePushL(stream);
+	
+	stream.WriteUint32L(KStateFileMagic);
+	stream.WriteUint32L(KStateFileVersion);
+	stream.WriteReal64L(iTopLeft.Latitude());
+	stream.WriteReal64L(iTopLeft.Longitude());
+	stream.WriteReal64L(iBottomRight.Latitude());
+	stream.WriteReal64L(iBottomRight.Longitude());
+	stream.WriteUint8L(iMinZoom);
+	stream.WriteUint8L(iMaxZoom);
+	stream.WriteUint8L(iCurrentTile.iZ);
+	stream.WriteUint32L(iCurrentTile.iX);
+	stream.WriteUint32L(iCurrentTile.iY);
+	stream.WriteUint8L(iIsCompleted);
+	stream.WriteInt32L(iTilesTotal);
+	stream.WriteInt32L(iTilesDownloaded);
+	stream.WriteInt32L(iTilesSkipped);
+	stream.WriteInt32L(iTilesFailed);
+	stream.CommitL();
+	CleanupStack::PopAndDestroy(&stream);
+	
+	User::LeaveIfError(iFs.Replace(tempFileName, iStateFileName));
+	iUnsavedTilesCount = 0;
+	}
+
+void CAreaDownloadJob::LoadStateL()
+	{
+	RFileReadStream stream;
+	User::LeaveIfError(stream.Open(iFs, iStateFileName, EFileRead));
+	CleanupClosePushL(stream);
+	
+	if (stream.ReadUint32L() != KStateFileMagic || stream.ReadUint32L() != KStateFileVersion)
+		User::Leave(KErrCorrupt);
+	TReal64 lat = stream.ReadReal64L();
+	TReal64 lon = stream.ReadReal64L();
+	iTopLeft = TCoordinate(lat, lon);
+	lat = stream.ReadReal64L();
+	lon = stream.ReadReal64L();
+	iBottomRight = TCoordinate(lat, lon);
+	iMinZoom = stream.ReadUint8L();
+	iMaxZoom = stream.ReadUint8L();
+	iCurrentTile.iZ = stream.ReadUint8L();
+	iCurrentTile.iX = stream.ReadUint32L();
+	iCurrentTile.iY = stream.ReadUint32L();
+	iIsCompleted = stream.ReadUint8L();
+	iTilesTotal = stream.ReadInt32L();
+	iTilesDownloaded = stream.ReadInt32L();
+	iTilesSkipped = stream.ReadInt32L();
+	iTilesFailed = stream.ReadInt32L();
+	CleanupStack::PopAndDestroy(&stream);
+	
+	if (iMinZoom > iMaxZoom || iCurrentTile.iZ < iMinZoom || iCurrentTile.iZ > iMaxZoom)
+		User::Leave(KErrCorrupt);
+	}
@@ -0,0 +1,103 @@
+/*
+ * BitmapUtils.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "BitmapUtils.h"
+
+
+// Scale rows of pixels with type T. Coordinates of source pixels
+// are calculated in 16.16 fixed point.
+template <class T>
+static void ScaleRows(const TUint8* aSrcBase, TInt aSrcStride,
+		TUint8* aDstBase, TInt aDstStride, const TRect &aDstClippedRect,
+		TUint32 aSrcX0, TUint32 aSrcY0, TUint32 aStepX, TUint32 aStepY)
+	{
+	const TInt width = aDstClippedRect.Width();
+	TInt prevSrcY = -1;
+	const T* prevDstRow = NULL;
+	TUint32 srcYFixed = aSrcY0;
+	for (TInt y = aDstClippedRect.iTl.iY; y < aDstClippedRect.iBr.iY; y++, srcYFixed += aStepY)
+		{
+		T* dstRow = reinterpret_cast<T*>(aDstBase + y * aDstStride) + aDstClippedRect.iTl.iX;
+		TInt srcY = srcYFixed >> 16;
+		if (srcY == prevSrcY)
+			{
+			// Upscaling - the same as previous row
+			Mem::Copy(dstRow, prevDstRow, width * sizeof(T));
+			continue;
+			}
+		
+		const T* srcRow = reinterpret_cast<const T*>(aSrcBase + srcY * aSrcStride);
+		TUint32 srcXFixed = aSrcX0;
+		for (TInt x = 0; x < width; x++, srcXFixed += aStepX)
+			dstRow[x] = srcRow[srcXFixed >> 16];
+		
+		prevSrcY = srcY;
+		prevDstRow = dstRow;
+		}
+	}
+
+TInt BitmapUtils::ScaleNearest(const CFbsBitmap &aSrc, const TRect &aSrcRect,
+		CFbsBitmap &aDst, const TRect &aDstRect)
+	{
+	TDisplayMode mode = aSrc.DisplayMode();
+	if (mode != aDst.DisplayMode())
+		return KErrNotSupported;
+	
+	TInt pixelSize;
+	switch (mode)
+		{
+		case EColor64K:
+			pixelSize = 2;
+			break;
+		case EColor16MU:
+		case EColor16MA:
+			pixelSize = 4;
+			break;
+		default:
+			return KErrNotSupported;
+		}
+	
+	if (aSrcRect.IsEmpty() || aDstRect.IsEmpty())
+		return KErrArgument;
+	
+	TRect srcBounds(aSrc.SizeInPixels());
+	TRect srcRect(aSrcRect);
+	srcRect.Intersection(srcBounds);
+	if (srcRect != aSrcRect)
+		return KErrArgument;
+	
+	TRect clippedRect(aDstRect);
+	TRect dstBounds(aDst.SizeInPixels());
+	if (!clippedRect.Intersects(dstBounds))
+		return KErrNone; // Nothing to draw
+	clippedRect.Intersection(dstBounds);
+	
+	// Step in source per one destination pixel, sampling from pixel centers
+	TUint32 stepX = (TUint32(aSrcRect.Width()) << 16) / aDstRect.Width();
+	TUint32 stepY = (TUint32(aSrcRect.Height()) << 16) / aDstRect.Height();
+	TUint32 srcX0 = (TUint32(aSrcRect.iTl.iX) << 16) + stepX / 2
+			+ (clippedRect.iTl.iX - aDstRect.iTl.iX) * stepX;
+	TUint32 srcY0 = (TUint32(aSrcRect.iTl.iY) << 16) + stepY / 2
+			+ (clippedRect.iTl.iY - aDstRect.iTl.iY) * stepY;
+	
+	TInt srcStride = CFbsBitmap::ScanLineLength(srcBounds.Width(), mode);
+	TInt dstStride = CFbsBitmap::ScanLineLength(dstBounds.Width(), mode);
+	
+	// Note: heap of font and bitmap server is shared, so one lock is enough
+	aSrc.LockHeap();
+	const TUint8* srcBase = reinterpret_cast<const TUint8*>(aSrc.DataAddress());
+	TUint8* dstBase = reinterpret_cast<TUint8*>(aDst.DataAddress());
+	if (pixelSize == 2)
+		ScaleRows<TUint16>(srcBase, srcStride, dstBase, dstStride, clippedRect,
+				srcX0, srcY0, stepX, stepY);
+	else
+		ScaleRows<TUint32>(srcBase, srcStride, dstBase, dstStride, clippedRect,
+				srcX0, srcY0, stepX, stepY);
+	aSrc.UnlockHeap();
+	
+	return KErrNone;
+	}
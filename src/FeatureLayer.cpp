@@ -0,0 +1,161 @@
+/*
+ * FeatureLayer.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "FeatureLayer.h"
+#include "S60MapsAppView.h"
+#include "Logger.h"
+#include <eikenv.h>
+
+
+// Constants
+const TInt KMaxDrawnFeatures = 300; // Limits time of drawing on low zooms
+const TInt KOccupancyCellSize = 8; // In pixels
+const TInt KFeatureMarkRadius = 4;
+const TInt KFeatureLabelGap = 2;
+
+
+CFeatureLayer::CFeatureLayer(CS60MapsAppView* aMapView) :
+		CMapLayerBase(aMapView)
+	{
+	// No implementation required
+	}
+
+CFeatureLayer::~CFeatureLayer()
+	{
+	iFoundFeatures.Close();
+	iOccupiedCells.Close();
+	delete iIndex;
+	}
+
+CFeatureLayer* CFeatureLayer::NewLC(CS60MapsAppView* aMapView)
+	{
+	CFeatureLayer* self = new (ELeave) CFeatureLayer(aMapView);
+	CleanupStack::PushL(self);
+	self->ConstructL();
+	return self;
+	}
+
+CFeatureLayer* CFeatureLayer::NewL(CS60MapsAppView* aMapView)
+	{
+	CFeatureLayer* self = CFeatureLayer::NewLC(aMapView);
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CFeatureLayer::ConstructL()
+	{
+	iIndex = CSpatialIndex::NewL();
+	}
+
+void CFeatureLayer::Draw(CBitmapContext &aGc)
+	{
+	if (!iIndex->Count())
+		return;
+
+	TRAPD(r, DrawL(aGc));
+	if (r != KErrNone)
+		{
+		LOG(_L8("Features drawing failed with code %d"), r);
+		}
+	}
+
+void CFeatureLayer::DrawL(CBitmapContext &aGc)
+	{
+	TTile topLeftTile, bottomRightTile;
+	iMapView->Bounds(topLeftTile, bottomRightTile);
+	iFoundFeatures.Reset();
+	iIndex->FindL(topLeftTile, bottomRightTile, iFoundFeatures, KMaxDrawnFeatures);
+	if (!iFoundFeatures.Count())
+		return;
+
+	TRect screenRect = iMapView->Rect();
+	ResetOccupancyL(screenRect.Size());
+	TZoom zoom = iMapView->GetZoom();
+
+	const CFont* font = CEikonEnv::Static()->AnnotationFont();
+	aGc.UseFont(font);
+	aGc.SetPenStyle(CGraphicsContext::ESolidPen);
+	aGc.SetPenSize(TSize(1, 1));
+	aGc.SetPenColor(KRgbBlack);
+
+	for (TInt i = 0; i < iFoundFeatures.Count(); i++)
+		{
+		TInt handle = iFoundFeatures[i];
+		TPoint point = iMapView->ProjectionCoordsToScreenCoords(
+				MapMath::WorldPointToProjectionPoint(iIndex->Position(handle), zoom));
+		if (!screenRect.Contains(point))
+			continue; // Visible tiles are larger than screen
+
+		TRect markRect(point, TSize(0, 0));
+		markRect.Grow(KFeatureMarkRadius, KFeatureMarkRadius);
+		const TDesC &name = iIndex->Name(handle);
+		TRect labelRect;
+		TRect featureRect = markRect;
+		if (name.Length())
+			{
+			labelRect.SetRect(
+					TPoint(markRect.iBr.iX + KFeatureLabelGap, point.iY - font->HeightInPixels() / 2),
+					TSize(font->TextWidthInPixels(name), font->HeightInPixels()));
+			featureRect.BoundingRect(labelRect);
+			}
+		if (!Occupy(featureRect))
+			continue; // Collision with feature drawn before
+
+		aGc.SetBrushStyle(CGraphicsContext::ESolidBrush);
+		aGc.SetBrushColor(KRgbYellow);
+		aGc.DrawEllipse(markRect);
+		if (name.Length())
+			{
+			aGc.SetBrushStyle(CGraphicsContext::ENullBrush);
+			aGc.DrawText(name, TPoint(labelRect.iTl.iX, labelRect.iTl.iY + font->AscentInPixels()));
+			}
+		}
+
+	aGc.DiscardFont();
+	}
+
+void CFeatureLayer::ResetOccupancyL(const TSize &aScreenSize)
+	{
+	iOccupancyColumns = (aScreenSize.iWidth + KOccupancyCellSize - 1) / KOccupancyCellSize;
+	iOccupancyRows = (aScreenSize.iHeight + KOccupancyCellSize - 1) / KOccupancyCellSize;
+	TInt words = (iOccupancyColumns * iOccupancyRows + 31) / 32;
+	for (TInt i = 0; i < iOccupiedCells.Count() && i < words; i++)
+		iOccupiedCells[i] = 0;
+	while (iOccupiedCells.Count() < words)
+		iOccupiedCells.AppendL(0);
+	}
+
+TBool CFeatureLayer::Occupy(const TRect &aRect)
+	{
+	TRect rect = aRect;
+	rect.Move(-iMapView->Rect().iTl);
+	TInt minColumn = Max(0, rect.iTl.iX / KOccupancyCellSize);
+	TInt minRow = Max(0, rect.iTl.iY / KOccupancyCellSize);
+	TInt maxColumn = Min(iOccupancyColumns - 1, (rect.iBr.iX - 1) / KOccupancyCellSize);
+	TInt maxRow = Min(iOccupancyRows - 1, (rect.iBr.iY - 1) / KOccupancyCellSize);
+
+	TInt row, column;
+	for (row = minRow; row <= maxRow; row++)
+		{
+		for (column = minColumn; column <= maxColumn; column++)
+			{
+			TInt cell = row * iOccupancyColumns + column;
+			if (iOccupiedCells[cell >> 5] & (1 << (cell & 31)))
+				return EFalse;
+			}
+		}
+
+	for (row = minRow; row <= maxRow; row++)
+		{
+		for (column = minColumn; column <= maxColumn; column++)
+			{
+			TInt cell = row * iOccupancyColumns + column;
+			iOccupiedCells[cell >> 5] |= 1 << (cell & 31);
+			}
+		}
+	return ETrue;
+	}
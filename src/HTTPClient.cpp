@@ -11,7 +11,8 @@
 #include "HTTPClient.h"
 
 CHTTPClient::CHTTPClient(MHTTPClientObserver* aObserver) :
-	iObserver(aObserver)
+	iObserver(aObserver),
+	iMaxConnections(KMaxTInt)
 	{
 	// No implementation required
 	}
@@ -19,6 +20,8 @@ CHTTPClient::CHTTPClient(MHTTPClientObserver* aObserver) :
 CHTTPClient::~CHTTPClient()
 	{
 	iSession.Close();
+	iHosts.Close();
+	iActiveTransactions.Close();
 	}
 
 CHTTPClient* CHTTPClient::NewLC(MHTTPClientObserver* aObserver)
@@ -44,7 +47,29 @@ void CHTTPClient::ConstructL()
 
 void CHTTPClient::GetL(const TDesC8 &aUrl)
 	{
-	SendRequestL(/*THTTPMethod::*/EGet, aUrl);
+	__ASSERT_ALWAYS(iObserver != NULL, User::Leave(KErrNotReady));
+	SendRequestL(/*THTTPMethod::*/EGet, aUrl, *iObserver);
+	}
+
+RHTTPTransaction CHTTPClient::GetL(const TDesC8 &aUrl, MHTTPClientObserver &aObserver)
+	{
+	return SendRequestL(/*THTTPMethod::*/EGet, aUrl, aObserver);
+	}
+
+RHTTPTransaction CHTTPClient::GetL(const TDesC8 &aUrl, MHTTPClientObserver &aObserver,
+		const RArray<THTTPRequestHeader> &aHeaders)
+	{
+	return SendRequestL(/*THTTPMethod::*/EGet, aUrl, aObserver, &aHeaders);
+	}
+
+void CHTTPClient::CancelRequest(RHTTPTransaction &aTransaction)
+	{
+	// Response is dropped, so connection can`t be used anymore
+	OnTransactionFinished(aTransaction, EFalse);
+	aTransaction.Cancel();
+	// Transaction must be closed here because MHTTPClientObserver
+	// will not recieve final event for it
+	aTransaction.Close();
 	}
 
 void CHTTPClient::SetHeaderL(RHTTPHeaders aHeaders, TInt aHdrField,
@@ -65,7 +90,110 @@ void CHTTPClient::SetUserAgentL(const TDesC8 &aDes)
 	SetHeaderL(headers, HTTP::EUserAgent, aDes);
 	}
 
-void CHTTPClient::SendRequestL(THTTPMethod aMethod, const TDesC8 &aUrl)
+void CHTTPClient::SetConnectionPropertyL(TInt aProperty, const THTTPHdrVal &aValue)
+	{
+	RHTTPConnectionInfo connInfo = iSession.ConnectionInfo();
+	connInfo.SetPropertyL(iSession.StringPool().StringF(aProperty,
+			RHTTPSession::GetTable()), aValue);
+	}
+
+void CHTTPClient::SetMaxConnectionsL(TInt aMaxConnections)
+	{
+	SetConnectionPropertyL(HTTP::EMaxNumTransportHandlers, THTTPHdrVal(aMaxConnections));
+	iMaxConnections = aMaxConnections;
+	}
+
+void CHTTPClient::SetPipeliningL(TBool aEnable, TInt aMaxPipelinedRequests)
+	{
+	RStringF valStr = iSession.StringPool().StringF(
+			aEnable ? HTTP::EEnablePipelining : HTTP::EDisablePipelining,
+			RHTTPSession::GetTable());
+	SetConnectionPropertyL(HTTP::EHttpPipelining, THTTPHdrVal(valStr));
+	if (aEnable)
+		SetConnectionPropertyL(HTTP::EMaxNumTransactionsToPipeline,
+				THTTPHdrVal(aMaxPipelinedRequests));
+	}
+
+TInt CHTTPClient::OpenConnectionsCount() const
+	{
+	TInt count = 0;
+	for (TInt i = 0; i < iHosts.Count(); i++)
+		count += iHosts[i].iOpenConnections;
+	return count;
+	}
+
+void CHTTPClient::OnTransactionStartedL(const RHTTPTransaction &aTransaction,
+		const TDesC8 &aHost)
+	{
+	TPtrC8 host = aHost.Left(KMaxHostLength);
+	TInt hostIdx;
+	for (hostIdx = 0; hostIdx < iHosts.Count(); hostIdx++)
+		{
+		if (iHosts[hostIdx].iHost == host)
+			break;
+		}
+	if (hostIdx == iHosts.Count())
+		{
+		THostConnections hostConns;
+		hostConns.iHost.Copy(host);
+		hostConns.iActiveRequests = 0;
+		hostConns.iOpenConnections = 0;
+		iHosts.AppendL(hostConns);
+		}
+	
+	TActiveTransaction activeTrans;
+	activeTrans.iTransactionId = aTransaction.Id();
+	activeTrans.iHostIdx = hostIdx;
+	iActiveTransactions.AppendL(activeTrans);
+	
+	THostConnections &hostConns = iHosts[hostIdx];
+	if (hostConns.iActiveRequests >= hostConns.iOpenConnections
+			&& OpenConnectionsCount() < iMaxConnections)
+		{ // All connections to this host are busy
+		hostConns.iOpenConnections++;
+		iStats.iConnectionsOpened++;
+		}
+	hostConns.iActiveRequests++;
+	iStats.iRequestsSent++;
+	}
+
+void CHTTPClient::OnTransactionFinished(const RHTTPTransaction &aTransaction,
+		TBool aIsConnectionKept)
+	{
+	TInt idx;
+	for (idx = 0; idx < iActiveTransactions.Count(); idx++)
+		{
+		if (iActiveTransactions[idx].iTransactionId == aTransaction.Id())
+			break;
+		}
+	if (idx == iActiveTransactions.Count())
+		return; // Unknown or already finished
+	
+	THostConnections &hostConns = iHosts[iActiveTransactions[idx].iHostIdx];
+	iActiveTransactions.Remove(idx);
+	hostConns.iActiveRequests--;
+	if (!aIsConnectionKept && hostConns.iOpenConnections > 0)
+		hostConns.iOpenConnections--;
+	}
+
+void CHTTPClient::FormatDate(const TTime &aTime, TDes8 &aDes)
+	{
+	_LIT8(KDateFmt, "%S, %02d %S %04d %02d:%02d:%02d GMT");
+	const TText8* const KDayNames[] = {_S8("Mon"), _S8("Tue"), _S8("Wed"),
+			_S8("Thu"), _S8("Fri"), _S8("Sat"), _S8("Sun")};
+	const TText8* const KMonthNames[] = {_S8("Jan"), _S8("Feb"), _S8("Mar"),
+			_S8("Apr"), _S8("May"), _S8("Jun"), _S8("Jul"), _S8("Aug"),
+			_S8("Sep"), _S8("Oct"), _S8("Nov"), _S8("Dec")};
+	
+	TDateTime dateTime = aTime.DateTime();
+	TPtrC8 dayName(KDayNames[aTime.DayNoInWeek()]);
+	TPtrC8 monthName(KMonthNames[dateTime.Month()]);
+	aDes.Format(KDateFmt, &dayName, dateTime.Day() + 1, &monthName,
+			dateTime.Year(), dateTime.Hour(), dateTime.Minute(), dateTime.Second());
+	}
+
+RHTTPTransaction CHTTPClient::SendRequestL(THTTPMethod aMethod, const TDesC8 &aUrl,
+		MHTTPClientObserver &aObserver, const RArray<THTTPRequestHeader>* aHeaders)
 	{
 	// Method
 	TInt method;
@@ -94,12 +222,28 @@ void CHTTPClient::SendRequestL(THTTPMethod aMethod, const TDesC8 &aUrl)
 	User::LeaveIfError(r);
 
 	// Create transaction
-	RHTTPTransaction trans = iSession.OpenTransactionL(uri, *iObserver, methodStr);
+	RHTTPTransaction trans = iSession.OpenTransactionL(uri, aObserver, methodStr);
 	CleanupClosePushL(trans);	// Todo: Is it needed?
 	
+	if (aHeaders != NULL)
+		{
+		_LIT8(KFieldSeparator, "\n");
+		RHTTPHeaders reqHeaders = trans.Request().GetHeaderCollection();
+		for (TInt i = 0; i < aHeaders->Count(); i++)
+			{
+			const THTTPRequestHeader &header = (*aHeaders)[i];
+			reqHeaders.SetRawFieldL(iSession.StringPool().StringF(header.iField,
+					RHTTPSession::GetTable()), header.iValue, KFieldSeparator);
+			}
+		}
+	
 	trans.SubmitL();
+	OnTransactionStartedL(trans, uri.Extract(EUriHost));
 	CleanupStack::Pop(&trans); // Not nedeed to destroy (only pop from stack)
 		// beacause Close() will be called in MHFRunL on failed or success event
+	aObserver.iClient = this;
+	
+	return trans;
 	}
 
 void MHTTPClientObserver::MHFRunL(RHTTPTransaction aTransaction, const THTTPEvent &aEvent)
@@ -136,6 +280,19 @@ void MHTTPClientObserver::MHFRunL(RHTTPTransaction aTransaction, const THTTPEven
 			
 		case THTTPEvent::ESucceeded:
 			{
+			if (iClient != NULL)
+				{
+				// Server closes connection after response if it responds
+				// with "Connection: close"
+				RStringPool strPool = aTransaction.Session().StringPool();
+				THTTPHdrVal connVal;
+				TBool isConnectionKept = !(aTransaction.Response().GetHeaderCollection().GetField(
+						strPool.StringF(HTTP::EConnection, RHTTPSession::GetTable()), 0, connVal) == KErrNone
+						&& connVal.Type() == THTTPHdrVal::KStrFVal
+						&& connVal.StrF() == strPool.StringF(HTTP::EClose, RHTTPSession::GetTable()));
+				iClient->OnTransactionFinished(aTransaction, isConnectionKept);
+				}
+			
 			OnHTTPResponse(aTransaction);
 			aTransaction.Close();
 			} 
@@ -143,6 +300,9 @@ void MHTTPClientObserver::MHFRunL(RHTTPTransaction aTransaction, const THTTPEven
 			
 		case THTTPEvent::EFailed:
 			{
+			if (iClient != NULL)
+				iClient->OnTransactionFinished(aTransaction, EFalse);
+			
 			OnHTTPError(iLastError, aTransaction);
 			iLastError = 0; // Reset last error code
 			aTransaction.Close();
@@ -179,6 +339,8 @@ TInt MHTTPClientObserver::MHFRunError(TInt /*aError*/, RHTTPTransaction aTransac
 		const THTTPEvent& /*aEvent*/)
 	{
 	// Cleanup any resources in case MHFRunL() leaves
+	if (iClient != NULL)
+		iClient->OnTransactionFinished(aTransaction, EFalse);
 	aTransaction.Close();
 	
 	return KErrNone;
@@ -16,7 +16,39 @@
 #include "S60Maps.pan"
 #include "S60MapsAppUi.h"
 #include "S60MapsApplication.h"
-#include <bautils.h>
+#include <hal.h>
+
+
+// Constants
+const TInt KTilesLoadingMargin = 1; // Count of tiles around viewport which still need to be loaded
+const TDisplayMode KTileDisplayMode = ENone; // Pixel format of tile bitmaps, ENone means the same as screen
+// Limits of memory used by tile bitmaps. Actual value depends on free RAM.
+const TInt KMinTileBitmapsMemoryBudget = 4 * 1024 * 1024;
+const TInt KMaxTileBitmapsMemoryBudget = 24 * 1024 * 1024;
+const TInt KTileBitmapsFreeRamShare = 4; // Use not more than 1/4 of free RAM
+const TInt KLowFreeRamThreshold = 2 * 1024 * 1024; // Reduce cache when less RAM is free
+const TInt KMaxFallbackZoomDelta = 4; // How many lower zoom levels are checked for fallback tile
+const TZoom KMaxTileZoomLevel = 19; // Children of tiles at this level are not prefetched
+const TInt KDefaultPrefetchRingWidth = 1; // Count of tiles around viewport to load in advance
+const TInt KMaxPrefetchLookAhead = 3; // Max count of extra tiles in direction of movement
+const TInt KPrefetchLookAheadTime = 30; // Prefetch area which will be reached in 30 seconds
+const TReal KMinPrefetchSpeed = 1.0; // Ignore course of user below this speed (m/s)
+const TInt KPrefetchMemoryShare = 4; // Prefetched tiles use not more than 1/4 of memory budget
+const TInt KPrefetchPriorityBase = 1 << 24; // Prefetched tiles are loaded after all visible
+const TInt KMaxHTTPConnections = 4; // For all tile servers together
+const TBool KUseHTTPPipelining = EFalse; // Cancelled requests would break the pipeline
+const TUint32 KDefaultTileTtl = 7 * 24 * 60 * 60; // In seconds, if server didn`t specify expiry time
+const TInt KMaxRevalidationQueueLength = 32; // Older requests are dropped
+const TInt KHTTPNotModifiedStatus = 304;
+// Tile images are decoded and encoded in ICL worker threads (one per
+// codec instance), so key and pointer events are not queued behind them.
+// Use EOptionNone to run codecs in UI thread.
+const CImageDecoder::TOptions KTileDecoderOptions = CImageDecoder::EOptionAlwaysThread;
+const CImageEncoder::TOptions KTileEncoderOptions = CImageEncoder::EOptionAlwaysThread;
+#if LOGGING_ENABLED
+const TInt KBlankFramesLogInterval = 50; // In frames
+const TInt KDownloadLatencyLogInterval = 20; // In tiles
+#endif
 
 CMapLayerBase::CMapLayerBase(/*const*/ CS60MapsAppView* aMapView) :
 		iMapView(aMapView)
@@ -40,7 +72,7 @@ CMapLayerDebugInfo::CMapLayerDebugInfo(/*const*/ CS60MapsAppView* aMapView) :
 	gc.DiscardFont();
 	}*/
 
-void CMapLayerDebugInfo::Draw(CWindowGc &aGc)
+void CMapLayerDebugInfo::Draw(CBitmapContext &aGc)
 	{
 	TBuf<100> buff;
 	TCoordinate center = iMapView->GetCenterCoordinate();
@@ -73,7 +105,8 @@ void MTileBitmapManagerObserver::OnTileLoadingFailed(const TTile &/*aTile*/, TIn
 // CTiledMapLayer
 
 CTiledMapLayer::CTiledMapLayer(CS60MapsAppView* aMapView) :
-	CMapLayerBase(aMapView)
+	CMapLayerBase(aMapView),
+	iPrefetchRingWidth(KDefaultPrefetchRingWidth)
 	{
 	// No implementation required
 	}
@@ -119,19 +152,62 @@ void CTiledMapLayer::ConstructL()
 	if (r != KErrAlreadyExists)
 		User::LeaveIfError(r);
 	
-	iBitmapMgr = CTileBitmapManager::NewL(this, fs, iTileProvider, cacheDir);
+	// Bitmaps in native screen mode take less memory (usually) and
+	// don`t need conversion when drawing
+	TDisplayMode displayMode = KTileDisplayMode;
+	if (displayMode == ENone)
+		displayMode = iMapView->ControlEnv()->ScreenDevice()->DisplayMode();
+	
+	TInt freeRam = 0;
+	HAL::Get(HALData::EMemoryRAMFree, freeRam);
+	TInt memoryBudget = Max(KMinTileBitmapsMemoryBudget,
+			Min(KMaxTileBitmapsMemoryBudget, freeRam / KTileBitmapsFreeRamShare));
+	LOG(_L8("Tile display mode: %d, free RAM: %d, bitmaps memory budget: %d"),
+			displayMode, freeRam, memoryBudget);
+	
+	iBitmapMgr = CTileBitmapManager::NewL(this, fs, iTileProvider, cacheDir, displayMode,
+			memoryBudget);
 	}
 
-void CTiledMapLayer::Draw(CWindowGc &aGc)
+void CTiledMapLayer::Draw(CBitmapContext &aGc)
 	{
-	LOG(_L8("Begin layer drawing"));
+	DrawArea(aGc, iMapView->Rect());
+	}
+
+void CTiledMapLayer::DrawArea(CBitmapContext &aGc, const TRect &aRect)
+	{
+	LOG(_L8("Begin layer drawing (area: %d,%d-%d,%d)"),
+			aRect.iTl.iX, aRect.iTl.iY, aRect.iBr.iX, aRect.iBr.iY);
+	
+#if LOGGING_ENABLED
+	if (iMapView->GetZoom() != iLastDrawnZoom)
+		{
+		iLastDrawnZoom = iMapView->GetZoom();
+		iZoomStopwatch.Start();
+		iIsWaitingMeaningfulFrame = ETrue;
+		}
+#endif
 	
+	TInt emptyTilesCount = 0;
+	TInt blankTilesCount = 0;
 	RArray<TTile> tiles(10);
 	VisibleTiles(tiles);
 	for (TInt idx = 0; idx < tiles.Count(); idx++)
 		{
 		CFbsBitmap* bitmap;
 		TInt err = iBitmapMgr->GetTileBitmap(tiles[idx], bitmap);
+		
+		// Tiles outside of area are already drawn (in back buffer),
+		// but still need to be requested for loading
+		if (!TileScreenRect(tiles[idx]).Intersects(aRect))
+			{
+			if (err == KErrNotFound)
+				iBitmapMgr->AddToLoading(tiles[idx]);
+			if (err != KErrNone)
+				emptyTilesCount++; // Not exactly, but fallback is not checked here
+			continue;
+			}
+		
 		switch (err)
 			{
 			case KErrNone:
@@ -143,17 +219,205 @@ void CTiledMapLayer::Draw(CWindowGc &aGc)
 			case KErrNotFound:
 				{
 				iBitmapMgr->AddToLoading(tiles[idx]);
-				break;
+				// No break
 				}
 				
-			/*default:
-				break;*/
+			default:
+				{
+				if (!DrawFallbackTile(aGc, tiles[idx]))
+					{
+					emptyTilesCount++;
+					blankTilesCount++;
+					}
+				break;
+				}
 			}
 		
 		}
 	
 	tiles.Close();
-	LOG(_L8("End layer drawing"));
+	
+	UpdatePrefetch();
+	
+#if LOGGING_ENABLED
+	iFramesCount++;
+	if (blankTilesCount > 0)
+		iBlankFramesCount++;
+	if (iFramesCount >= KBlankFramesLogInterval)
+		{
+		LOG(_L8("Frames with blank tiles: %d of %d (prefetch ring: %d)"),
+				iBlankFramesCount, iFramesCount, iPrefetchRingWidth);
+		iFramesCount = iBlankFramesCount = 0;
+		}
+#endif
+	
+#if LOGGING_ENABLED
+	if (iIsWaitingMeaningfulFrame && emptyTilesCount == 0)
+		{
+		iIsWaitingMeaningfulFrame = EFalse;
+		LOG(_L8("First frame without empty tiles after zoom change: %d us"),
+				iZoomStopwatch.ElapsedMicroSeconds());
+		}
+#endif
+	LOG(_L8("End layer drawing, empty tiles: %d"), emptyTilesCount);
+	}
+
+void CTiledMapLayer::LoadVisibleTiles()
+	{
+	RArray<TTile> tiles(10);
+	VisibleTiles(tiles);
+	for (TInt idx = 0; idx < tiles.Count(); idx++)
+		{
+		CFbsBitmap* bitmap;
+		if (iBitmapMgr->GetTileBitmap(tiles[idx], bitmap) == KErrNotFound)
+			iBitmapMgr->AddToLoading(tiles[idx]);
+		}
+	tiles.Close();
+	}
+
+void CTiledMapLayer::SetPrefetchRingWidth(TInt aWidth)
+	{
+	iPrefetchRingWidth = Max(0, aWidth);
+	iPrefetchTopLeft = iPrefetchBottomRight = TTile(); // Force update
+	if (iPrefetchRingWidth == 0)
+		iBitmapMgr->CancelPrefetch();
+	}
+
+// Candidate for prefetching, smaller score is more important
+class TPrefetchCandidate
+	{
+public:
+	TTile iTile;
+	TInt iScore;
+	};
+
+static TInt Sign(TInt aValue)
+	{
+	return aValue > 0 ? 1 : (aValue < 0 ? -1 : 0);
+	}
+
+void CTiledMapLayer::UpdatePrefetch()
+	{
+	if (iPrefetchRingWidth == 0)
+		return;
+	
+	TTile topLeft, bottomRight;
+	iMapView->Bounds(topLeft, bottomRight);
+	TInt lookAhead;
+	TPoint direction = MovementDirection(lookAhead);
+	if (topLeft == iPrefetchTopLeft && bottomRight == iPrefetchBottomRight
+			&& direction == iPrefetchDirection)
+		return; // Nothing changed
+	
+	iPrefetchTopLeft = topLeft;
+	iPrefetchBottomRight = bottomRight;
+	iPrefetchDirection = direction;
+	
+	// Ring around viewport, extended in direction of movement
+	TInt maxXY = (1 << topLeft.iZ) - 1;
+	TInt left   = Max(0, TInt(topLeft.iX) - iPrefetchRingWidth - (direction.iX < 0 ? lookAhead : 0));
+	TInt right  = Min(maxXY, TInt(bottomRight.iX) + iPrefetchRingWidth + (direction.iX > 0 ? lookAhead : 0));
+	TInt top    = Max(0, TInt(topLeft.iY) - iPrefetchRingWidth - (direction.iY < 0 ? lookAhead : 0));
+	TInt bottom = Min(maxXY, TInt(bottomRight.iY) + iPrefetchRingWidth + (direction.iY > 0 ? lookAhead : 0));
+	
+	RArray<TPrefetchCandidate> candidates(20, _FOFF(TPrefetchCandidate, iScore));
+	for (TInt y = top; y <= bottom; y++)
+		{
+		for (TInt x = left; x <= right; x++)
+			{
+			// Offset from viewport in tiles
+			TInt dx = x < TInt(topLeft.iX) ? x - TInt(topLeft.iX)
+					: (x > TInt(bottomRight.iX) ? x - TInt(bottomRight.iX) : 0);
+			TInt dy = y < TInt(topLeft.iY) ? y - TInt(topLeft.iY)
+					: (y > TInt(bottomRight.iY) ? y - TInt(bottomRight.iY) : 0);
+			if (dx == 0 && dy == 0)
+				continue; // Visible tile
+			
+			// Nearest tiles go first, tiles ahead are preferred over tiles behind
+			TInt along = direction.iX * Sign(dx) + direction.iY * Sign(dy);
+			TPrefetchCandidate candidate;
+			candidate.iTile.iX = x;
+			candidate.iTile.iY = y;
+			candidate.iTile.iZ = topLeft.iZ;
+			candidate.iScore = Max(Abs(dx), Abs(dy)) * 4 - along * 3;
+			candidates.InsertInSignedKeyOrderAllowRepeats(candidate); // ToDo: Check error code
+			}
+		}
+	
+	RArray<TTile> tiles(20);
+	for (TInt i = 0; i < candidates.Count(); i++)
+		tiles.Append(candidates[i].iTile); // ToDo: Check error code
+	candidates.Close();
+	
+	// Adjacent zoom levels: parents of visible tiles (used as fallback
+	// and at zoom out) and children of central tile (at zoom in)
+	TTile tile;
+	if (topLeft.iZ > 0)
+		{
+		tile.iZ = topLeft.iZ - 1;
+		for (tile.iY = topLeft.iY >> 1; tile.iY <= bottomRight.iY >> 1; tile.iY++)
+			for (tile.iX = topLeft.iX >> 1; tile.iX <= bottomRight.iX >> 1; tile.iX++)
+				tiles.Append(tile); // ToDo: Check error code
+		}
+	if (topLeft.iZ < KMaxTileZoomLevel)
+		{
+		tile.iZ = topLeft.iZ + 1;
+		TUint32 centerX = (topLeft.iX + bottomRight.iX) / 2;
+		TUint32 centerY = (topLeft.iY + bottomRight.iY) / 2;
+		for (TInt i = 0; i < 4; i++)
+			{
+			tile.iX = centerX * 2 + (i & 1);
+			tile.iY = centerY * 2 + (i >> 1);
+			tiles.Append(tile); // ToDo: Check error code
+			}
+		}
+	
+	LOG(_L8("Prefetch %d tiles, direction: %d,%d"), tiles.Count(), direction.iX, direction.iY);
+	iBitmapMgr->SetPrefetchTiles(tiles);
+	tiles.Close();
+	}
+
+TPoint CTiledMapLayer::MovementDirection(TInt &aLookAhead)
+	{
+	TZoom zoom = iMapView->GetZoom();
+	
+	// Direction of panning
+	TPoint center = MapMath::GeoCoordsToProjectionPoint(iMapView->GetCenterCoordinate(), zoom);
+	if (zoom != iLastCenterZoom)
+		iPanDirection = TPoint(0, 0);
+	else if (center != iLastCenter)
+		iPanDirection = TPoint(Sign(center.iX - iLastCenter.iX), Sign(center.iY - iLastCenter.iY));
+	iLastCenter = center;
+	iLastCenterZoom = zoom;
+	
+	// Course of user
+	TCoordinateEx pos;
+	if (iMapView->IsFollowUser() && iMapView->UserPosition(pos) == KErrNone
+			&& !Math::IsNaN(pos.Course()) && !Math::IsNaN(pos.Speed())
+			&& pos.Speed() >= KMinPrefetchSpeed)
+		{
+		TReal course, sinCourse, cosCourse;
+		course = pos.Course() * KDegToRad;
+		Math::Sin(sinCourse, course);
+		Math::Cos(cosCourse, course);
+		// Use diagonal direction only if it is close enough (sin(22.5) = 0.38)
+		const TReal KMinComponent = 0.38;
+		TPoint direction(
+				sinCourse > KMinComponent ? 1 : (sinCourse < -KMinComponent ? -1 : 0),
+				cosCourse > KMinComponent ? -1 : (cosCourse < -KMinComponent ? 1 : 0));
+		
+		// Look ahead for distance which will be passed soon
+		TReal32 tileWidth, tileHeight;
+		MapMath::PixelsToMeters(pos.Latitude(), zoom, KTileSize, tileWidth, tileHeight);
+		aLookAhead = KMaxPrefetchLookAhead;
+		if (tileWidth > 0)
+			aLookAhead = Min(KMaxPrefetchLookAhead,
+					1 + TInt(pos.Speed() * KPrefetchLookAheadTime / tileWidth));
+		return direction;
+		}
+	
+	aLookAhead = iPanDirection != TPoint(0, 0) ? 1 : 0;
+	return iPanDirection;
 	}
 
 void CTiledMapLayer::VisibleTiles(RArray<TTile> &aTiles)
@@ -173,15 +437,16 @@ void CTiledMapLayer::VisibleTiles(RArray<TTile> &aTiles)
 			}
 		}
 	aTiles.Compress();
+	
+	// Do not allow to evict tiles which are currently on screen
+	iBitmapMgr->SetPinnedTiles(aTiles);
+	iBitmapMgr->SetViewport(topLeftTile, bottomRightTile);
 	}
 
-void CTiledMapLayer::DrawTile(CWindowGc &aGc, const TTile &aTile, const CFbsBitmap *aBitmap)
+void CTiledMapLayer::DrawTile(CBitmapContext &aGc, const TTile &aTile, const CFbsBitmap *aBitmap)
 	{
-	TCoordinate coord = MapMath::TileToGeoCoords(aTile, iMapView->GetZoom());
-	TPoint point = iMapView->GeoCoordsToScreenCoords(coord);
-	TRect destRect;
-	destRect.iTl = point;
-	destRect.SetSize(TSize(KTileSize, KTileSize));
+	TRect destRect = TileScreenRect(aTile);
+	TPoint point = destRect.iTl;
 	TRect screenRect = iMapView->Rect();
 	if (!screenRect.Intersects(destRect)) // Check if tile is visible
 		return;
@@ -195,10 +460,131 @@ void CTiledMapLayer::DrawTile(CWindowGc &aGc, const TTile &aTile, const CFbsBitm
 	aGc.DrawBitmap(destRect, aBitmap, srcRect);
 	}
 
-void CTiledMapLayer::OnTileLoaded(const TTile &/*aTile*/, const CFbsBitmap */*aBitmap*/)
+TBool CTiledMapLayer::DrawFallbackTile(CBitmapContext &aGc, const TTile &aTile)
+	{
+	TRect destRect = TileScreenRect(aTile);
+	
+	// Scale up part of the nearest cached parent tile
+	for (TInt delta = 1; delta <= KMaxFallbackZoomDelta && delta <= aTile.iZ; delta++)
+		{
+		TTile parent;
+		parent.iX = aTile.iX >> delta;
+		parent.iY = aTile.iY >> delta;
+		parent.iZ = aTile.iZ - delta;
+		CFbsBitmap* bitmap = iBitmapMgr->PeekTileBitmap(parent);
+		if (bitmap == NULL)
+			continue;
+		
+		TInt size = KTileSize >> delta;
+		TInt mask = (1 << delta) - 1;
+		TRect srcRect(TPoint((aTile.iX & mask) * size, (aTile.iY & mask) * size),
+				TSize(size, size));
+		aGc.DrawBitmap(destRect, bitmap, srcRect);
+		return ETrue;
+		}
+	
+	// Scale down cached child tiles
+	TBool isDrawn = EFalse;
+	const TInt KHalfTileSize = KTileSize / 2;
+	for (TInt i = 0; i < 4; i++)
+		{
+		TTile child;
+		child.iX = aTile.iX * 2 + (i & 1);
+		child.iY = aTile.iY * 2 + (i >> 1);
+		child.iZ = aTile.iZ + 1;
+		CFbsBitmap* bitmap = iBitmapMgr->PeekTileBitmap(child);
+		if (bitmap == NULL)
+			continue;
+		
+		TRect childRect(destRect.iTl + TPoint((i & 1) * KHalfTileSize, (i >> 1) * KHalfTileSize),
+				TSize(KHalfTileSize, KHalfTileSize));
+		aGc.DrawBitmap(childRect, bitmap);
+		isDrawn = ETrue;
+		}
+	
+	return isDrawn;
+	}
+
+TRect CTiledMapLayer::TileScreenRect(const TTile &aTile) const
+	{
+	// Pure integer offset from view position, so neighbour tiles always
+	// join without seams (no rounding in geo coordinates round trip)
+	TPoint point = iMapView->ProjectionCoordsToScreenCoords(
+			MapMath::TileToProjectionPoint(aTile));
+	return TRect(point, TSize(KTileSize, KTileSize));
+	}
+
+TBool CTiledMapLayer::InvalidateFallbackArea(const TTile &aTile)
+	{
+	TZoom zoom = iMapView->GetZoom();
+	TTile topLeft, bottomRight;
+	iMapView->Bounds(topLeft, bottomRight);
+	
+	if (aTile.iZ == zoom + 1)
+		{
+		// Child is drawn to quarter of parent tile
+		TTile parent;
+		parent.iX = aTile.iX >> 1;
+		parent.iY = aTile.iY >> 1;
+		parent.iZ = zoom;
+		if (parent.iX < topLeft.iX || parent.iX > bottomRight.iX
+				|| parent.iY < topLeft.iY || parent.iY > bottomRight.iY
+				|| iBitmapMgr->PeekTileBitmap(parent) != NULL)
+			return EFalse;
+		
+		const TInt KHalfTileSize = KTileSize / 2;
+		TRect rect(TileScreenRect(parent).iTl
+				+ TPoint((aTile.iX & 1) * KHalfTileSize, (aTile.iY & 1) * KHalfTileSize),
+				TSize(KHalfTileSize, KHalfTileSize));
+		iMapView->InvalidateMapArea(rect);
+		return ETrue;
+		}
+	
+	if (aTile.iZ >= zoom || zoom - aTile.iZ > KMaxFallbackZoomDelta)
+		return EFalse; // Never used as fallback
+	
+	// Visible descendants of loaded tile
+	TInt delta = zoom - aTile.iZ;
+	TUint minX = Max(aTile.iX << delta, topLeft.iX);
+	TUint maxX = Min(((aTile.iX + 1) << delta) - 1, bottomRight.iX);
+	TUint minY = Max(aTile.iY << delta, topLeft.iY);
+	TUint maxY = Min(((aTile.iY + 1) << delta) - 1, bottomRight.iY);
+	TBool isInvalidated = EFalse;
+	for (TUint y = minY; y <= maxY && minX <= maxX; y++)
+		{
+		for (TUint x = minX; x <= maxX; x++)
+			{
+			TTile tile;
+			tile.iX = x;
+			tile.iY = y;
+			tile.iZ = zoom;
+			if (iBitmapMgr->PeekTileBitmap(tile) != NULL)
+				continue; // Fallback is not drawn over exact tile
+			iMapView->InvalidateMapArea(TileScreenRect(tile));
+			isInvalidated = ETrue;
+			}
+		}
+	return isInvalidated;
+	}
+
+void CTiledMapLayer::OnTileLoaded(const TTile &aTile, const CFbsBitmap */*aBitmap*/)
 	{
-	//iMapView->DrawDeferred();
-	iMapView->DrawNow();
+	if (aTile.iZ == iMapView->GetZoom())
+		{
+		TRect rect = TileScreenRect(aTile);
+		if (!rect.Intersects(iMapView->Rect()))
+			return; // Tile from loading margin - nothing to redraw
+		iMapView->InvalidateMapArea(rect);
+		}
+	else
+		{
+		// Parents and children prefetched in advance are not shown until
+		// next redraw, otherwise they would cause rendering while panning
+		if (iBitmapMgr->IsPrefetchOnly(aTile) || !InvalidateFallbackArea(aTile))
+			return;
+		}
+	
+	iMapView->RequestRedraw();
 	}
 
 
@@ -211,7 +597,7 @@ CUserPositionLayer::CUserPositionLayer(/*const*/ CS60MapsAppView* aMapView) :
 	
 	}
 
-void CUserPositionLayer::Draw(CWindowGc &aGc)
+void CUserPositionLayer::Draw(CBitmapContext &aGc)
 	{
 	TCoordinateEx pos;
 	TInt r = iMapView->UserPosition(pos);
@@ -232,7 +618,7 @@ void CUserPositionLayer::Draw(CWindowGc &aGc)
 		}
 	}
 
-void CUserPositionLayer::DrawDirectionMarkL(CWindowGc &aGc, const TPoint &aScreenPos, TReal aRotation)
+void CUserPositionLayer::DrawDirectionMarkL(CBitmapContext &aGc, const TPoint &aScreenPos, TReal aRotation)
 	{
 	// Points
 	CArrayFix<TPoint>* points = new CArrayFixFlat<TPoint>(3);
@@ -283,7 +669,7 @@ void CUserPositionLayer::DrawDirectionMarkL(CWindowGc &aGc, const TPoint &aScree
 	CleanupStack::PopAndDestroy(points);
 	}
 
-void CUserPositionLayer::DrawRoundMark(CWindowGc &aGc, const TPoint &aScreenPos)
+void CUserPositionLayer::DrawRoundMark(CBitmapContext &aGc, const TPoint &aScreenPos)
 	{
 	aGc.SetBrushStyle(CGraphicsContext::ESolidBrush);
 	aGc.SetBrushColor(KRgbRed);
@@ -385,7 +771,7 @@ CTileBorderAndXYZLayer::CTileBorderAndXYZLayer(CS60MapsAppView* aMapView) :
 	{
 	}
 	
-void CTileBorderAndXYZLayer::Draw(CWindowGc &aGc)
+void CTileBorderAndXYZLayer::Draw(CBitmapContext &aGc)
 	{
 	RArray<TTile> tiles(10);
 	VisibleTiles(tiles);
@@ -414,11 +800,11 @@ void CTileBorderAndXYZLayer::VisibleTiles(RArray<TTile> &aTiles)
 	aTiles.Compress();
 	}
 
-void CTileBorderAndXYZLayer::DrawTile(CWindowGc &aGc, const TTile &aTile)
+void CTileBorderAndXYZLayer::DrawTile(CBitmapContext &aGc, const TTile &aTile)
 	{
 	// Calculate tile position
-	TCoordinate coord = MapMath::TileToGeoCoords(aTile, iMapView->GetZoom());
-	TPoint point = iMapView->GeoCoordsToScreenCoords(coord);
+	TPoint point = iMapView->ProjectionCoordsToScreenCoords(
+			MapMath::TileToProjectionPoint(aTile));
 	TRect rect(TSize(KTileSize, KTileSize));
 	rect.Move(point);
 	
@@ -443,12 +829,30 @@ void CTileBorderAndXYZLayer::DrawTile(CWindowGc &aGc, const TTile &aTile)
 
 // CTileBitmapManager
 
+// Create empty bitmap suitable for storing tile image.
+// Note: decoders dither image when converting to mode with lower
+// color depth (until EOptionNoDither is set).
+static CFbsBitmap* CreateTileBitmapLC(TDisplayMode aMode)
+	{
+	CFbsBitmap* bitmap = new (ELeave) CFbsBitmap();
+	CleanupStack::PushL(bitmap);
+	TSize size(KTileSize, KTileSize);
+	User::LeaveIfError(bitmap->Create(size, aMode));
+	return bitmap;
+	}
+
+static TBool TileIdentity(const TTile &aTile1, const TTile &aTile2)
+	{
+	return aTile1 == aTile2;
+	}
+
 CTileBitmapManager::CTileBitmapManager(MTileBitmapManagerObserver *aObserver,
-		RFs aFs, TTileProviderBase* aTileProvider, TInt aLimit) :
-		CActive(EPriorityStandard),
+		RFs aFs, TTileProviderBase* aTileProvider, TDisplayMode aDisplayMode, TInt aMemoryBudget) :
 		iObserver(aObserver),
-		iLimit(aLimit),
-		iState(/*TProcessingState::*/EIdle),
+		iMaxMemoryBudget(aMemoryBudget),
+		iMemoryBudget(aMemoryBudget),
+		iDisplayMode(aDisplayMode),
+		iItemsQueue(_FOFF(CTileBitmapManagerItem, iLink)),
 		iFs(aFs),
 		iTileProvider(aTileProvider)
 	{
@@ -457,49 +861,96 @@ CTileBitmapManager::CTileBitmapManager(MTileBitmapManagerObserver *aObserver,
 
 CTileBitmapManager::~CTileBitmapManager()
 	{
+	delete iEnvChangeNotifier;
+	delete iDiskReader;
+	iDiskLoadingQueue.Close();
 	delete iFileMapper;
-	delete iImgDecoder;
+	// Downloaders must be destroyed before http session will be closed
+	iDownloaders.ResetAndDestroy();
+	iDownloaders.Close();
+	delete iTileStore; // Must be closed after reader and downloaders
 	iItemsLoadingQueue.Close();
-	iItems.ResetAndDestroy();
-	iItems.Close();
+	iPinnedTiles.Close();
+	iPrefetchTiles.Close();
+	iRevalidationQueue.Close();
+	
+	TDblQueIter<CTileBitmapManagerItem> iter(iItemsQueue);
+	CTileBitmapManagerItem* item;
+	while ((item = iter++) != NULL)
+		delete item;
+	User::Free(iBuckets);
+	
+	if (iHTTPClient)
+		{
+		const THTTPClientStats &httpStats = iHTTPClient->Stats();
+		LOG(_L8("HTTP: %u requests, ~%u connections opened (estimated %.2f requests per connection)"),
+				httpStats.iRequestsSent, httpStats.iConnectionsOpened,
+				httpStats.RequestsPerConnection());
+		}
 	delete iHTTPClient;
 	}
 
 CTileBitmapManager* CTileBitmapManager::NewLC(MTileBitmapManagerObserver *aObserver,
-		RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir, TInt aLimit)
+		RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir,
+		TDisplayMode aDisplayMode, TInt aMemoryBudget, TInt aParallelDownloads)
 	{
-	CTileBitmapManager* self = new (ELeave) CTileBitmapManager(aObserver, aFs, aTileProvider, aLimit);
+	CTileBitmapManager* self = new (ELeave) CTileBitmapManager(aObserver, aFs, aTileProvider,
+			aDisplayMode, aMemoryBudget);
 	CleanupStack::PushL(self);
-	self->ConstructL(aCacheDir);
+	self->ConstructL(aCacheDir, aParallelDownloads);
 	return self;
 	}
 
 CTileBitmapManager* CTileBitmapManager::NewL(MTileBitmapManagerObserver *aObserver,
-		RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir, TInt aLimit)
+		RFs aFs, TTileProviderBase* aTileProvider, const TDesC &aCacheDir,
+		TDisplayMode aDisplayMode, TInt aMemoryBudget, TInt aParallelDownloads)
 	{
-	CTileBitmapManager* self = CTileBitmapManager::NewLC(aObserver, aFs, aTileProvider, aCacheDir, aLimit);
+	CTileBitmapManager* self = CTileBitmapManager::NewLC(aObserver, aFs, aTileProvider, aCacheDir,
+			aDisplayMode, aMemoryBudget, aParallelDownloads);
 	CleanupStack::Pop(); // self;
 	return self;
 	}
 
-void CTileBitmapManager::ConstructL(const TDesC &aCacheDir)
+void CTileBitmapManager::ConstructL(const TDesC &aCacheDir, TInt aParallelDownloads)
 	{
 #ifdef __WINSCW__
 	// Add some delay for network services have been started on the emulator,
 	// otherwise CEcmtServer: 3 panic will be raised.
 	User::After(10 * KSecond);
 #endif
-	iHTTPClient = CHTTPClient::NewL(this);
+	iHTTPClient = CHTTPClient::NewL();
 	iHTTPClient->SetUserAgentL(_L8("S60Maps")); // ToDo: Move to constant
+	iHTTPClient->SetMaxConnectionsL(KMaxHTTPConnections);
+	iHTTPClient->SetPipeliningL(KUseHTTPPipelining);
+	LOG(_L8("Tile decoding in separate threads: %d"),
+			KTileDecoderOptions & CImageDecoder::EOptionAlwaysThread ? 1 : 0);
 	
-	iItems = RPointerArray<CTileBitmapManagerItem>(iLimit);
-	iItemsLoadingQueue = RArray<TTile>(20); // ToDo: Move 20 to constant
+	for (TInt i = 0; i < aParallelDownloads; i++)
+		{
+		CTileDownloader* downloader = CTileDownloader::NewLC(this, iFs);
+		iDownloaders.AppendL(downloader);
+		CleanupStack::Pop(downloader);
+		}
 	
-	iImgDecoder = CBufferedImageDecoder::NewL(iFs);
+	// Keep hash table load factor not more than 0.5
+	TInt bucketsCount = 16;
+	while (bucketsCount < iMaxMemoryBudget / TileBitmapSize(iDisplayMode) * 2)
+		bucketsCount <<= 1;
+	ResizeBucketsL(bucketsCount);
+	iItemsLoadingQueue = RArray<TTile>(20); // ToDo: Move 20 to constant
 	
 	iFileMapper = CFileTreeMapper::NewL(aCacheDir, 2, 1, ETrue);
 	
-	CActiveScheduler::Add(this);
+	iDiskReader = CTileDiskReader::NewL(this, iFs);
+	
+	iCacheDir.Copy(aCacheDir);
+	TRAPD(r, OpenTileStoreL());
+	if (r != KErrNone)
+		LOG(_L8("Failed to open tile store, error: %d"), r); // Continue without disk cache
+	
+	iEnvChangeNotifier = CEnvironmentChangeNotifier::NewL(CActive::EPriorityLow,
+			TCallBack(EnvironmentChangeCallback, this));
+	iEnvChangeNotifier->Start();
 	}
 
 TInt CTileBitmapManager::GetTileBitmap(const TTile &aTile, CFbsBitmap* &aBitmap)
@@ -508,301 +959,698 @@ TInt CTileBitmapManager::GetTileBitmap(const TTile &aTile, CFbsBitmap* &aBitmap)
 	LOG(_L8("tile=%S, item=%x"), &aTile.AsDes8(), item);
 	
 	if (item == NULL)
+		{
+		iStats.iMisses++;
 		return KErrNotFound;
+		}
 	LOG(_L8("tile=%S, isready=%d, bitmap=%x"), &aTile.AsDes8(), item->IsReady(), item->Bitmap());
 	
+	// Mark as most recently used
+	item->iLink.Deque();
+	iItemsQueue.AddLast(*item);
+	
 	if (!item->IsReady())
 		return KErrNotReady;
 	
+	iStats.iHits++;
 	aBitmap = item->Bitmap();
 	return KErrNone;
 	}
 
-void CTileBitmapManager::AddToLoading(const TTile &aTile)
+CFbsBitmap* CTileBitmapManager::PeekTileBitmap(const TTile &aTile) const
 	{
 	CTileBitmapManagerItem* item = Find(aTile);
+	if (item == NULL || !item->IsReady())
+		return NULL;
 	
-	if (item == NULL)
-		Append(aTile);
+	return item->Bitmap();
 	}
 
-/*TInt*/ void CTileBitmapManager::Append/*L*/(const TTile &aTile)
+void CTileBitmapManager::SetPinnedTiles(const RArray<TTile> &aTiles)
 	{
-	if (iItems.Count() >= iLimit)
+	TInt i;
+	for (i = 0; i < iPinnedTiles.Count(); i++)
 		{
-		// Delete oldest item
-		LOG(_L8("Delete old bitmap of %S from cache"), &iItems[0]->Tile().AsDes8());
-		delete iItems[0];
-		iItems.Remove(0);
+		CTileBitmapManagerItem* item = Find(iPinnedTiles[i]);
+		if (item != NULL)
+			item->iIsPinned = EFalse;
 		}
 	
-	// Add new one
-	CTileBitmapManagerItem* item = CTileBitmapManagerItem::NewL(aTile/*, iObserver*/);
-	iItems.Append(item);
-	
-	if (iState == EIdle)
+	iPinnedTiles.Reset();
+	for (i = 0; i < aTiles.Count(); i++)
 		{
-		// Try to find on disk first
-		if (IsTileFileExists(aTile))
-			{
-			item->CreateBitmapIfNotExistL();
-			LoadBitmapL(aTile, item->Bitmap());
-			item->SetReady();
-			}
-		else
-			// Start download now
-			StartDownloadTileL(aTile);
+		iPinnedTiles.Append(aTiles[i]); // ToDo: Check error code
+		CTileBitmapManagerItem* item = Find(aTiles[i]);
+		if (item != NULL)
+			item->iIsPinned = ETrue;
 		}
-	else
+	}
+
+void CTileBitmapManager::SetViewport(const TTile &aTopLeft, const TTile &aBottomRight)
+	{
+	iViewportTopLeft = aTopLeft;
+	iViewportBottomRight = aBottomRight;
+	CancelIrrelevantLoadings();
+	}
+
+void CTileBitmapManager::SetPrefetchTiles(const RArray<TTile> &aTiles)
+	{
+	iPrefetchTiles.Reset();
+	TInt maxCount = iMemoryBudget / TileBitmapSize(iDisplayMode) / KPrefetchMemoryShare;
+	for (TInt i = 0; i < aTiles.Count() && i < maxCount; i++)
 		{
-		// Add to loading queue
-		// ToDo: Check array is not full
-		iItemsLoadingQueue.Append(aTile);
-		LOG(_L8("Tile %S appended to download queue"), &aTile.AsDes8());
-		LOG(_L8("Total %d tiles in download queue"), iItemsLoadingQueue.Count());
+		if (iPrefetchTiles.Append(aTiles[i]) != KErrNone)
+			break;
 		}
-	LOG(_L8("Now %d items in bitmap cache"), iItems.Count());
+	
+	// Tiles present in both old and new sets continue loading
+	CancelIrrelevantLoadings();
+	
+	for (TInt i = 0; i < iPrefetchTiles.Count(); i++)
+		AddToLoading(iPrefetchTiles[i]);
 	}
 
-CTileBitmapManagerItem* CTileBitmapManager::Find(const TTile &aTile) const
+void CTileBitmapManager::CancelIrrelevantLoadings()
 	{
-	if (!iItems.Count())
-		return NULL;
+	// Drop queued tiles which are not needed anymore
+	DropIrrelevantTiles(iDiskLoadingQueue);
+	DropIrrelevantTiles(iItemsLoadingQueue);
 	
-	for (TInt idx = iItems.Count() - 1; idx >= 0; idx--) // Needed items more often
-											// located at the end of array (newest)
+	// Cancel ongoing downloads of such tiles
+	TBool isAborted = EFalse;
+	for (TInt i = 0; i < iDownloaders.Count(); i++)
 		{
-		if (iItems[idx]->Tile() == aTile)
-			return iItems[idx];
+		CTileDownloader* downloader = iDownloaders[i];
+		if (downloader->IsIdle() || downloader->IsStoreOnly()
+				|| IsTileRelevant(downloader->Tile()))
+			continue;
+		
+		TTile tile = downloader->Tile();
+		downloader->Abort();
+		isAborted = ETrue;
+		CTileBitmapManagerItem* item = Find(tile);
+		if (item != NULL && !item->IsReady())
+			DeleteItem(item);
+		LOG(_L8("Download of tile %S cancelled"), &tile.AsDes8());
 		}
 	
-	return NULL;
+	if (isAborted)
+		TRAP_IGNORE(StartDownloadsL());
 	}
 
-void CTileBitmapManager::StartDownloadTileL(const TTile &aTile)
+void CTileBitmapManager::CloseTileStore()
 	{
-	if (iIsOfflineMode)
-		return;
+	if (!iDiskReader->IsIdle())
+		{
+		// Reader may use store file now
+		TTile tile = iDiskReader->Tile();
+		iDiskReader->Cancel();
+		CTileBitmapManagerItem* item = Find(tile);
+		if (item != NULL && !item->IsReady())
+			DeleteItem(item); // Allow to load it again later
+		}
 	
-	if (iState != /*TProcessingState::*/EIdle)
-		return;
+	for (TInt i = 0; i < iDownloaders.Count(); i++)
+		iDownloaders[i]->DetachTileStore();
 	
-	iState = /*TProcessingState::*/EDownloading;
-	iLoadingTile = aTile;
+	delete iTileStore;
+	iTileStore = NULL;
+	iRevalidationQueue.Reset();
+	TRAP_IGNORE(FailPendingStoreDownloadL(KErrNotReady));
 	
-	TBuf8<100> tileUrl;
-	iTileProvider->TileUrl(tileUrl, aTile);
-	iHTTPClient->GetL(tileUrl);
-	LOG(_L8("Started download tile %S from url %S"), &aTile.AsDes8(), &tileUrl);
+	TRAP_IGNORE(StartDiskLoadingL());
 	}
 
-void CTileBitmapManager::DoCancel()
+void CTileBitmapManager::OpenTileStoreL()
 	{
-	iImgDecoder->Cancel();
+	if (iTileStore != NULL)
+		return;
+	
+	iTileStore = CTileStore::NewL(iFs, iCacheDir);
 	}
 
-void CTileBitmapManager::RunL()
+TBool CTileBitmapManager::IsTileRelevant(const TTile &aTile) const
 	{
-	LOG(_L8("CTileBitmapManager::RunL"));
-	if (iStatus.Int() == KErrNone)
-		{
-		/*CFbsBitmap* bitmap;
-		TInt r = GetTileBitmap(iLoadingTile, bitmap);
-		__ASSERT_DEBUG(r == KErrNone, User::Leave(KErrNotFound));
-		CTileBitmapManagerItem* item = Find(iLoadingTile);
-		__ASSERT_DEBUG(item != NULL, User::Leave(KErrNotFound));*/
-		CTileBitmapManagerItem* item = Find(iLoadingTile);
-		__ASSERT_DEBUG(item != NULL, Panic(ES60MapsTileBitmapManagerItemNotFoundPanic));
-		__ASSERT_DEBUG(item->Bitmap() != NULL, Panic(ES60MapsTileBitmapIsNullPanic));
-		
-		item->SetReady();
-		
-		LOG(_L8("Tile %S downloaded and decoded"), &iLoadingTile.AsDes8());
-		iObserver->OnTileLoaded(iLoadingTile, item->Bitmap());
-		
-		SaveBitmapL(iLoadingTile, item->Bitmap());
-		}
-	else
+	return IsTileNearViewport(aTile) || iPrefetchTiles.Find(aTile,
+			TIdentityRelation<TTile>(TileIdentity)) != KErrNotFound;
+	}
+
+TBool CTileBitmapManager::IsPrefetchOnly(const TTile &aTile) const
+	{
+	return !IsTileNearViewport(aTile) && iPrefetchTiles.Find(aTile,
+			TIdentityRelation<TTile>(TileIdentity)) != KErrNotFound;
+	}
+
+TBool CTileBitmapManager::IsTileNearViewport(const TTile &aTile) const
+	{
+	return aTile.iZ == iViewportTopLeft.iZ
+			&& TInt(aTile.iX) >= TInt(iViewportTopLeft.iX) - KTilesLoadingMargin
+			&& TInt(aTile.iX) <= TInt(iViewportBottomRight.iX) + KTilesLoadingMargin
+			&& TInt(aTile.iY) >= TInt(iViewportTopLeft.iY) - KTilesLoadingMargin
+			&& TInt(aTile.iY) <= TInt(iViewportBottomRight.iY) + KTilesLoadingMargin;
+	}
+
+TInt CTileBitmapManager::LoadingPriority(const TTile &aTile) const
+	{
+	if (!IsTileNearViewport(aTile))
 		{
-		LOG(_L8("Image decoding error: %d"), iStatus.Int());
-		iObserver->OnTileLoadingFailed(iLoadingTile, iStatus.Int());
+		TInt idx = iPrefetchTiles.Find(aTile, TIdentityRelation<TTile>(TileIdentity));
+		if (idx != KErrNotFound)
+			return KPrefetchPriorityBase + idx;
 		}
 	
-	
-	iImgDecoder->Reset();
-	iState = /*TProcessingState::*/EIdle;
-	
-	// Start download next tile in queue
-	if (iItemsLoadingQueue.Count())
+
+	// Squared distance from viewport centre (in half-tiles to avoid fractions)
+	TInt dx = 2 * TInt(aTile.iX) + 1 - TInt(iViewportTopLeft.iX + iViewportBottomRight.iX + 1);
+	TInt dy = 2 * TInt(aTile.iY) + 1 - TInt(iViewportTopLeft.iY + iViewportBottomRight.iY + 1);
+	return dx * dx + dy * dy;
+	}
+
+void CTileBitmapManager::DropIrrelevantTiles(RArray<TTile> &aQueue)
+	{
+	for (TInt i = aQueue.Count() - 1; i >= 0; i--)
 		{
-		TTile tile = iItemsLoadingQueue[0]; 
-		iItemsLoadingQueue.Remove(0);
+		TTile tile = aQueue[i];
+		if (IsTileRelevant(tile))
+			continue;
 		
-		StartDownloadTileL(tile);
+		aQueue.Remove(i);
+		CTileBitmapManagerItem* item = Find(tile);
+		if (item != NULL && !item->IsReady())
+			DeleteItem(item); // Allow to load it again later
+		LOG(_L8("Tile %S dropped from loading queue"), &tile.AsDes8());
 		}
 	}
 
-/*TInt CTileBitmapManager::RunError(TInt aError)
+TInt CTileBitmapManager::NextLoadingIndex(const RArray<TTile> &aQueue) const
 	{
-	return aError;
-	}*/
+	TInt bestIdx = KErrNotFound;
+	TInt bestPriority = KMaxTInt;
+	for (TInt i = 0; i < aQueue.Count(); i++)
+		{
+		TInt priority = LoadingPriority(aQueue[i]);
+		if (priority < bestPriority)
+			{
+			bestPriority = priority;
+			bestIdx = i;
+			}
+		}
+	return bestIdx;
+	}
 
-void CTileBitmapManager::OnHTTPResponseDataChunkRecieved(
-		const RHTTPTransaction aTransaction, const TDesC8 &aDataChunk,
-		TInt anOverallDataSize, TBool anIsLastChunk)
+void CTileBitmapManager::AddToLoading(const TTile &aTile)
 	{
-	LOG(_L8("HTTP chunk recieved"));
-	
-	// Checking that mime-type is PNG
-	// (If any error (for example: 404 Not Found) chunk may contains
-	// HTML/text data instead correct PNG image. In this case, 
-	// we need to skip any processing.)
-	RStringPool strP = aTransaction.Session().StringPool();
-	RHTTPHeaders respHeaders = aTransaction.Response().GetHeaderCollection();
-	RStringF fieldName = strP.StringF(HTTP::EContentType, RHTTPSession::GetTable());
-	THTTPHdrVal fieldVal;
-	TInt r = respHeaders.GetField(fieldName, 0, fieldVal);
-	__ASSERT_DEBUG(r == KErrNone, Panic(ES60MapsNoRequiredHeaderInResponse)); // Unlikely if response don`t contains Content-Type header
-	if (r != KErrNone)
-		return;
+	CTileBitmapManagerItem* item = Find(aTile);
 	
-	_LIT8(KPNGMimeType, "image/png");
-	RStringF pngMimeType = strP.OpenFStringL(KPNGMimeType);
-	if (fieldVal.StrF() != pngMimeType)
+	if (item == NULL)
+		Append(aTile);
+	}
+
+/*TInt*/ void CTileBitmapManager::Append/*L*/(const TTile &aTile)
+	{
+	// Free space for new bitmap
+	TInt expectedSize = TileBitmapSize(iDisplayMode);
+	while (iStats.iBytesHeld + expectedSize > iMemoryBudget)
 		{
-		pngMimeType.Close();
-		return; // Skip other types exept PNG
+		if (!EvictLeastRecentlyUsed(EEvictionForSpace))
+			{
+			// All tiles are visible now, exceed budget temporary
+			LOG(_L8("All cached bitmaps are pinned, memory budget exceeded"));
+			break;
+			}
 		}
-	pngMimeType.Close();
-	
 	
-	// Append data to decoder`s buffer
-	iImgDecoder->AppendDataL(aDataChunk);
+	// Add new one
+	CTileBitmapManagerItem* item = CTileBitmapManagerItem::NewLC(aTile/*, iObserver*/);
+	InsertItemL(item);
+	CleanupStack::Pop(item);
+	item->iIsPinned = iPinnedTiles.Find(aTile,
+			TIdentityRelation<TTile>(TileIdentity)) != KErrNotFound;
+	item->iMemorySize = expectedSize;
+	UpdateBytesHeld(expectedSize);
 	
-	if (!iImgDecoder->ValidDecoder())
-		iImgDecoder->ContinueOpenL();
+	// Try to find on disk first
+	iDiskLoadingQueue.AppendL(aTile);
+	StartDiskLoadingL();
+	LOG(_L8("Now %d items in bitmap cache"), iItemsCount);
+	}
+
+CTileBitmapManagerItem* CTileBitmapManager::Find(const TTile &aTile) const
+	{
+	CTileBitmapManagerItem* item = iBuckets[BucketIndex(aTile)];
+	while (item != NULL && item->iTile != aTile)
+		item = item->iNextInBucket;
 	
-	if (!iImgDecoder->ValidDecoder())
-		return; // Next function will leave if decoder not created
+	return item;
+	}
+
+void CTileBitmapManager::ResizeBucketsL(TInt aCount)
+	{
+	__ASSERT_DEBUG((aCount & (aCount - 1)) == 0, Panic(ES60MapsInvalidHashTableSizePanic));
 	
-	if (!iImgDecoder->IsImageHeaderProcessingComplete())
-		iImgDecoder->ContinueProcessingHeaderL();
+	CTileBitmapManagerItem** buckets = static_cast<CTileBitmapManagerItem**>(
+			User::AllocZL(aCount * sizeof(CTileBitmapManagerItem*)));
+	User::Free(iBuckets);
+	iBuckets = buckets;
+	iBucketsCount = aCount;
 	
-	//iImgDecoder->AppendDataL(aDataChunk);
-	//iImgDecoder->ContinueConvert();
+	// Rehash all existing items
+	TDblQueIter<CTileBitmapManagerItem> iter(iItemsQueue);
+	CTileBitmapManagerItem* item;
+	while ((item = iter++) != NULL)
+		{
+		TInt idx = BucketIndex(item->iTile);
+		item->iNextInBucket = iBuckets[idx];
+		iBuckets[idx] = item;
+		}
 	}
 
-void CTileBitmapManager::OnHTTPResponse(const RHTTPTransaction aTransaction)
+void CTileBitmapManager::InsertItemL(CTileBitmapManagerItem* aItem)
 	{
-	LOG(_L8("HTTP response success"));
+	__ASSERT_DEBUG(Find(aItem->iTile) == NULL, Panic(ES60MapsTileBitmapManagerItemAlreadyExistsPanic));
 	
-	iState = /*TProcessingState::*/EDecoding;
+	if (iItemsCount >= iBucketsCount)
+		ResizeBucketsL(iBucketsCount * 2);
 	
-	// Start convert PNG to CFbsBitmap
-	//CFbsBitmap* bitmap;
-//	TInt r = GetTileBitmap(iLoadingTile, bitmap);
-//	__ASSERT_DEBUG(r != KErrNotFound, User::Leave(KErrNotFound));
-	CTileBitmapManagerItem* item = Find(iLoadingTile);
-	__ASSERT_DEBUG(item != NULL, Panic(ES60MapsTileBitmapManagerItemNotFoundPanic));
-	item->CreateBitmapIfNotExistL();
-	__ASSERT_DEBUG(item->Bitmap() != NULL, Panic(ES60MapsTileBitmapIsNullPanic));
-	
-	//iImgDecoder->ContinueOpenL();
-	LOG(_L8("Tile %S succesfully downloaded, starting decode"), &iLoadingTile.AsDes8());
-	iImgDecoder->Convert(&this->iStatus, /**bitmap*/ *item->Bitmap(), 0);
-	//iImgDecoder->ContinueConvert(&this->iStatus);
-	SetActive();
+	TInt idx = BucketIndex(aItem->iTile);
+	aItem->iNextInBucket = iBuckets[idx];
+	iBuckets[idx] = aItem;
+	iItemsQueue.AddLast(*aItem);
+	iItemsCount++;
 	}
 
-void CTileBitmapManager::OnHTTPError(TInt aError,
-		const RHTTPTransaction aTransaction)
+void CTileBitmapManager::DeleteItem(CTileBitmapManagerItem* aItem)
 	{
-	//LOG(_L8("HTTP error: %d"), aError);
-	LOG(_L8("Failed to download tile %S, error: %d"), &iLoadingTile.AsDes8(), aError);
-	iObserver->OnTileLoadingFailed(iLoadingTile, aError);
+	// Unlink from hash table
+	CTileBitmapManagerItem** link = &iBuckets[BucketIndex(aItem->iTile)];
+	while (*link != aItem)
+		{
+		__ASSERT_DEBUG(*link != NULL, Panic(ES60MapsTileBitmapManagerItemNotFoundPanic));
+		link = &(*link)->iNextInBucket;
+		}
+	*link = aItem->iNextInBucket;
 	
-	iImgDecoder->Reset();
-	iState = /*TProcessingState::*/EIdle;
+	// Unlink from queue
+	aItem->iLink.Deque();
+	iItemsCount--;
+	UpdateBytesHeld(-aItem->iMemorySize);
 	
+	delete aItem;
+	}
+
+TBool CTileBitmapManager::EvictLeastRecentlyUsed(TEvictionReason aReason)
+	{
+	TDblQueIter<CTileBitmapManagerItem> iter(iItemsQueue);
+	CTileBitmapManagerItem* lruItem;
+	while ((lruItem = iter++) != NULL && lruItem->iIsPinned)
+		{}
+	
+	if (lruItem == NULL)
+		return EFalse;
 	
-	if (aError == -3) // ToDo: "magic" number - find constant for it
+	LOG(_L8("Delete old bitmap of %S from cache (reason: %d)"), &lruItem->Tile().AsDes8(), aReason);
+	DeleteItem(lruItem);
+	if (aReason == EEvictionForMemoryPressure)
+		iStats.iPressureEvictions++;
+	else
+		iStats.iEvictions++;
+	LOG(_L8("Bitmap cache stats: hits=%u, misses=%u, evictions=%u, pressure evictions=%u"),
+			iStats.iHits, iStats.iMisses, iStats.iEvictions, iStats.iPressureEvictions);
+	LOG(_L8("Bitmap cache memory: held=%d, peak=%d, budget=%d"),
+			iStats.iBytesHeld, iStats.iBytesPeak, iMemoryBudget);
+	return ETrue;
+	}
+
+void CTileBitmapManager::EvictToBudget(TEvictionReason aReason)
+	{
+	while (iStats.iBytesHeld > iMemoryBudget && EvictLeastRecentlyUsed(aReason))
+		{}
+	}
+
+void CTileBitmapManager::UpdateBytesHeld(TInt aDelta)
+	{
+	iStats.iBytesHeld += aDelta;
+	if (iStats.iBytesHeld > iStats.iBytesPeak)
+		iStats.iBytesPeak = iStats.iBytesHeld;
+	}
+
+TInt CTileBitmapManager::EnvironmentChangeCallback(TAny* aSelf)
+	{
+	CTileBitmapManager* self = static_cast<CTileBitmapManager*>(aSelf);
+	self->HandleEnvironmentChange(self->iEnvChangeNotifier->Change());
+	return EFalse;
+	}
+
+void CTileBitmapManager::HandleEnvironmentChange(TInt aChanges)
+	{
+	// First call after start reports all changes, skip it
+	if (!iIsEnvChangeNotifierStarted)
 		{
-		// If access point not provoded switch to offline mode
+		iIsEnvChangeNotifierStarted = ETrue;
+		return;
+		}
+	
+	if (!(aChanges & (EChangesFreeMemory | EChangesOutOfMemory)))
+		return;
+	
+	TInt freeRam = 0;
+	HAL::Get(HALData::EMemoryRAMFree, freeRam);
+	LOG(_L8("Memory state changed (changes: 0x%x), free RAM: %d"), aChanges, freeRam);
+	
+	if ((aChanges & EChangesOutOfMemory) || freeRam < KLowFreeRamThreshold)
+		{
+		// Release half of cache (not less than visible tiles)
+		iMemoryBudget = Max(iStats.iBytesHeld / 2, TileBitmapSize(iDisplayMode));
+		EvictToBudget(EEvictionForMemoryPressure);
+		LOG(_L8("Bitmap cache memory budget reduced to %d"), iMemoryBudget);
+		}
+	else if (iMemoryBudget < iMaxMemoryBudget && freeRam >= 2 * KLowFreeRamThreshold)
+		{
+		iMemoryBudget = iMaxMemoryBudget;
+		LOG(_L8("Bitmap cache memory budget restored to %d"), iMemoryBudget);
+		}
+	}
+
+TInt CTileBitmapManager::BitmapDataSize(const CFbsBitmap &aBitmap)
+	{
+	TSize size = aBitmap.SizeInPixels();
+	return CFbsBitmap::ScanLineLength(size.iWidth, aBitmap.DisplayMode()) * size.iHeight;
+	}
+
+void CTileBitmapManager::StartDiskLoadingL()
+	{
+	while (iDiskReader->IsIdle() && iDiskLoadingQueue.Count())
+		{
+		TInt idx = NextLoadingIndex(iDiskLoadingQueue);
+		TTile tile = iDiskLoadingQueue[idx];
+		iDiskLoadingQueue.Remove(idx);
 		
-		// FixMe: Access point choosing dialog appears several times in a row
-		// (in my case: 2 in emulator, 5-6 on the phone) and only after that
-		// we can catch cancel in this callback
-		iIsOfflineMode = ETrue;
-		LOG(_L8("Switched to Offline Mode"));
-		iItemsLoadingQueue.Reset(); // Clear queue of loading tiles
+		if (Find(tile) == NULL)
+			continue; // Item has been deleted from cache while waiting in queue
+		
+		// Stale tile is shown anyway, but will be refreshed in background
+		CheckTileFreshness(tile);
+		
+		TFileName fileName;
+		TileFileName(tile, fileName);
+		TRAPD(r, iDiskReader->StartL(tile, iTileStore, fileName));
+		if (r != KErrNone)
+			{
+			// Tile is not cached yet (or file is damaged) - download it
+			iItemsLoadingQueue.AppendL(tile);
+			LOG(_L8("Tile %S appended to download queue"), &tile.AsDes8());
+			LOG(_L8("Total %d tiles in download queue"), iItemsLoadingQueue.Count());
+			StartDownloadsL();
+			}
 		}
-	else
-		{	
-		// Start download next tile in queue
-		if (iItemsLoadingQueue.Count())
+	}
+
+void CTileBitmapManager::StartDownloadsL()
+	{
+	if (iIsOfflineMode)
+		return;
+	
+	for (TInt i = 0; i < iDownloaders.Count() && iItemsLoadingQueue.Count(); i++)
+		{
+		if (!iDownloaders[i]->IsIdle())
+			continue;
+		
+		TInt idx = NextLoadingIndex(iItemsLoadingQueue);
+		TTile tile = iItemsLoadingQueue[idx];
+		iItemsLoadingQueue.Remove(idx);
+		
+		if (Find(tile) == NULL)
+			{
+			// Item has been deleted from cache while waiting in queue
+			i--; // Try next tile with the same downloader
+			continue;
+			}
+		
+		TBuf8<100> tileUrl;
+		iTileProvider->TileUrl(tileUrl, tile);
+		iDownloaders[i]->StartL(tile, iHTTPClient, tileUrl, iTileStore);
+		LOG(_L8("Started download tile %S from url %S"), &tile.AsDes8(), &tileUrl);
+		}
+	
+	// Tiles for store only have the lowest priority
+	if (iIsStoreDownloadPending && iItemsLoadingQueue.Count() == 0)
+		{
+		for (TInt i = 0; i < iDownloaders.Count(); i++)
 			{
-			TTile tile = iItemsLoadingQueue[0]; 
-			iItemsLoadingQueue.Remove(0);
+			if (!iDownloaders[i]->IsIdle())
+				continue;
 			
-			StartDownloadTileL(tile);
+			TBuf8<100> tileUrl;
+			iTileProvider->TileUrl(tileUrl, iStoreDownloadTile);
+			iIsStoreDownloadPending = EFalse;
+			iDownloaders[i]->StartL(iStoreDownloadTile, iHTTPClient, tileUrl, iTileStore, ETrue);
+			LOG(_L8("Started download tile %S to store"), &iStoreDownloadTile.AsDes8());
+			break;
+			}
+		}
+	
+	// Revalidation of stale tiles goes after everything else
+	if (iIsStoreDownloadPending || iItemsLoadingQueue.Count() || iTileStore == NULL)
+		return;
+	for (TInt i = 0; i < iDownloaders.Count() && iRevalidationQueue.Count(); i++)
+		{
+		if (!iDownloaders[i]->IsIdle())
+			continue;
+		
+		TInt idx = NextLoadingIndex(iRevalidationQueue);
+		TTile tile = iRevalidationQueue[idx];
+		iRevalidationQueue.Remove(idx);
+		
+		TTileMetadata metadata;
+		TRAPD(r, iTileStore->GetMetadataL(tile, metadata));
+		if (r != KErrNone)
+			{
+			// Tile has been removed from store or data file is damaged
+			i--; // Try next tile with the same downloader
+			continue;
 			}
+		
+		TBuf8<100> tileUrl;
+		iTileProvider->TileUrl(tileUrl, tile);
+		iDownloaders[i]->StartRevalidationL(tile, iHTTPClient, tileUrl, iTileStore, metadata);
+		LOG(_L8("Started revalidation of tile %S"), &tile.AsDes8());
 		}
 	}
-void CTileBitmapManager::OnHTTPHeadersRecieved(
-		const RHTTPTransaction aTransaction)
+
+void CTileBitmapManager::CheckTileFreshness(const TTile &aTile)
 	{
-	LOG(_L8("HTTP headers recieved"));
+	if (iTileStore == NULL || iIsOfflineMode
+			|| !iTileStore->IsStale(aTile, TTileMetadata::Now(), KDefaultTileTtl))
+		return;
 	
-	iImgDecoder->Reset();
-	_LIT8(KPNGMimeType, "image/png");
-	iImgDecoder->OpenL(KNullDesC8, KPNGMimeType);
+	if (iRevalidationQueue.Find(aTile, TIdentityRelation<TTile>(TileIdentity)) != KErrNotFound)
+		return;
+	for (TInt i = 0; i < iDownloaders.Count(); i++)
+		{
+		if (!iDownloaders[i]->IsIdle() && iDownloaders[i]->IsRevalidation()
+				&& iDownloaders[i]->Tile() == aTile)
+			return;
+		}
+	
+	if (iRevalidationQueue.Count() >= KMaxRevalidationQueueLength)
+		iRevalidationQueue.Remove(0);
+	if (iRevalidationQueue.Append(aTile) == KErrNone)
+		LOG(_L8("Tile %S is stale, added to revalidation"), &aTile.AsDes8());
+	}
+
+void CTileBitmapManager::DownloadToStoreL(const TTile &aTile, MTileStoreDownloadObserver* aObserver)
+	{
+	if (iTileStore == NULL || iIsOfflineMode)
+		User::Leave(KErrNotReady);
+	if (iStoreDownloadObserver != NULL)
+		User::Leave(KErrInUse);
+	
+	iStoreDownloadTile = aTile;
+	iStoreDownloadObserver = aObserver;
+	iIsStoreDownloadPending = ETrue;
+	StartDownloadsL();
 	}
 
-void CTileBitmapManager::SaveBitmapL(const TTile &aTile, /*const*/ CFbsBitmap *aBitmap/*, TBool aRewrite*/)
+void CTileBitmapManager::CancelDownloadToStore()
 	{
-	TFileName tileFileName;
-	TileFileName(aTile, tileFileName);
+	iIsStoreDownloadPending = EFalse;
+	iStoreDownloadObserver = NULL;
+	
+	for (TInt i = 0; i < iDownloaders.Count(); i++)
+		{
+		if (!iDownloaders[i]->IsIdle() && iDownloaders[i]->IsStoreOnly()
+				&& !iDownloaders[i]->IsRevalidation())
+			iDownloaders[i]->Abort();
+		}
+	}
+
+void CTileBitmapManager::OnTileStoredL(const TTile &aTile, TInt aErrCode)
+	{
+	LOG(_L8("Tile %S saved to store, error: %d"), &aTile.AsDes8(), aErrCode);
+	MTileStoreDownloadObserver* observer = iStoreDownloadObserver;
+	iStoreDownloadObserver = NULL;
+	
+	// Downloader is free now
+	StartDownloadsL();
+	
+	if (observer != NULL)
+		observer->OnTileStoredL(aTile, aErrCode);
+	}
+
+void CTileBitmapManager::FailPendingStoreDownloadL(TInt aErrCode)
+	{
+	if (!iIsStoreDownloadPending)
+		return;
+	
+	LOG(_L8("Download of tile %S to store dropped, error: %d"), &iStoreDownloadTile.AsDes8(), aErrCode);
+	iIsStoreDownloadPending = EFalse;
+	MTileStoreDownloadObserver* observer = iStoreDownloadObserver;
+	iStoreDownloadObserver = NULL;
+	if (observer != NULL)
+		observer->OnTileStoredL(iStoreDownloadTile, aErrCode);
+	}
+
+void CTileBitmapManager::OnTileRevalidatedL(const TTile &aTile, TInt aErrCode,
+		TBool aIsModified)
+	{
+	LOG(_L8("Tile %S revalidated, modified: %d, error: %d"), &aTile.AsDes8(),
+			aIsModified, aErrCode);
+	
+	if (aErrCode == KErrNone)
+		{
+		if (aIsModified)
+			{
+			iStats.iRefreshed++;
+			
+			// Replace outdated bitmap in cache by new image from store
+			if (Find(aTile) != NULL)
+				{
+				iDiskLoadingQueue.AppendL(aTile);
+				StartDiskLoadingL();
+				}
+			}
+		else
+			{
+			iStats.iNotModified++;
+			}
+		}
+	
+	// Downloader is free now
+	StartDownloadsL();
+	}
+
+#if LOGGING_ENABLED
+void CTileBitmapManager::LogDownloadLatency(TInt aLatency, TInt aDecodingTail)
+	{
+	iDownloadLatencies.Add(aLatency);
+	iDecodingTailTimes.Add(aDecodingTail);
+	if (iDownloadLatencies.Count() < KDownloadLatencyLogInterval)
+		return;
+	
+	TBuf8<200> buff;
+	iDownloadLatencies.AsDes(buff);
+	LOG(_L8("Tile download latency (%d tiles, avg=%dus, max=%dus): %S"),
+			iDownloadLatencies.Count(), iDownloadLatencies.Average(),
+			iDownloadLatencies.Max(), &buff);
+	iDecodingTailTimes.AsDes(buff);
+	LOG(_L8("Decoding after end of response (avg=%dus, max=%dus): %S"),
+			iDecodingTailTimes.Average(), iDecodingTailTimes.Max(), &buff);
+	iDownloadLatencies.Reset();
+	iDecodingTailTimes.Reset();
+	}
+#endif
+
+void CTileBitmapManager::OnTileDownloadedL(const TTile &aTile, CFbsBitmap* aBitmap)
+	{
+	LOG(_L8("Tile %S downloaded and decoded"), &aTile.AsDes8());
+	
+	// Note: image has been already saved to tile store by downloader
+	// (even if item has been deleted from cache during downloading)
+	SetItemBitmap(aTile, aBitmap);
+	
+	// Start download next tiles in queue
+	StartDownloadsL();
+	}
 
-	// Create subdirs
-	// ToDo: I think it will be better to create all subdirs once when program starts
-	BaflUtils::EnsurePathExistsL(iFs, tileFileName);
+void CTileBitmapManager::OnTileReadedL(const TTile &aTile, CFbsBitmap* aBitmap)
+	{
+	LOG(_L8("Bitmap for %S sucessfully loaded from disk"), &aTile.AsDes8());
+	SetItemBitmap(aTile, aBitmap);
 	
-	RFile file;
-	/*if (aRewrite)
-		{*/
-		User::LeaveIfError(file.Replace(iFs, tileFileName, EFileWrite));
-		CleanupClosePushL(file);
-	/*	}
+	// Start reading next tile in queue
+	StartDiskLoadingL();
+	}
+
+void CTileBitmapManager::OnTileMigratedL(const TTile &aTile, TInt aErrCode)
+	{
+	if (aErrCode == KErrNone)
+		LOG(_L8("Tile %S moved from old cache to tile store"), &aTile.AsDes8());
 	else
+		LOG(_L8("Failed to move tile %S to tile store, error: %d"), &aTile.AsDes8(), aErrCode);
+	
+	// Reader is free now
+	StartDiskLoadingL();
+	}
+
+void CTileBitmapManager::OnTileReadingFailedL(const TTile &aTile, TInt aErrCode)
+	{
+	LOG(_L8("Failed to read bitmap for %S from disk, error: %d"), &aTile.AsDes8(), aErrCode);
+	
+	// Try to download it again
+	if (Find(aTile) != NULL)
 		{
-		TInt r = file.Create(iFs, tileFileName, EFileWrite);
-		CleanupClosePushL(file);
-		if (r != KErrAlreadyExists)
-			User::LeaveIfError(r);
-		}*/
-	User::LeaveIfError(aBitmap->Save(file));	
-	CleanupStack::PopAndDestroy(&file);
-	LOG(_L8("Bitmap for %S sucessfully saved to file \"%S\""), &aTile.AsDes8(), &tileFileName);
+		iItemsLoadingQueue.AppendL(aTile);
+		StartDownloadsL();
+		}
+	
+	StartDiskLoadingL();
 	}
 
-void CTileBitmapManager::LoadBitmapL(const TTile &aTile, CFbsBitmap *aBitmap)
-	{	
-	TFileName tileFileName;
-	TileFileName(aTile, tileFileName);
+TBool CTileBitmapManager::SetItemBitmap(const TTile &aTile, CFbsBitmap* aBitmap)
+	{
+	CTileBitmapManagerItem* item = Find(aTile);
+	if (item == NULL)
+		{
+		delete aBitmap;
+		return EFalse;
+		}
+	
+	item->SetBitmap(aBitmap);
+	item->SetReady();
+	
+	// Replace expected size by actual
+	TInt size = BitmapDataSize(*aBitmap);
+	UpdateBytesHeld(size - item->iMemorySize);
+	item->iMemorySize = size;
 	
-	RFile file;
-	User::LeaveIfError(file.Open(iFs, tileFileName, EFileRead));
-	CleanupClosePushL(file);
-	User::LeaveIfError(aBitmap->Load(file));	
-	CleanupStack::PopAndDestroy(&file);
-	LOG(_L8("Bitmap for %S sucessfully loaded from file \"%S\""), &aTile.AsDes8(), &tileFileName);
+	iObserver->OnTileLoaded(aTile, aBitmap);
+	return ETrue;
 	}
 
-TBool CTileBitmapManager::IsTileFileExists(const TTile &aTile) /*const*/
+void CTileBitmapManager::OnTileDownloadingFailedL(const TTile &aTile, TInt aErrCode)
 	{
-	TFileName tileFileName;
-	TileFileName(aTile, tileFileName);
-	return BaflUtils::FileExists(iFs, tileFileName);
+	LOG(_L8("Failed to download tile %S, error: %d"), &aTile.AsDes8(), aErrCode);
+	iObserver->OnTileLoadingFailed(aTile, aErrCode);
+	
+	if (aErrCode == -3) // ToDo: "magic" number - find constant for it
+		{
+		// If access point not provoded switch to offline mode
+		
+		// FixMe: Access point choosing dialog appears several times in a row
+		// (in my case: 2 in emulator, 5-6 on the phone) and only after that
+		// we can catch cancel in this callback
+		iIsOfflineMode = ETrue;
+		LOG(_L8("Switched to Offline Mode"));
+		iItemsLoadingQueue.Reset(); // Clear queue of loading tiles
+		iRevalidationQueue.Reset();
+		// Downloads are not started anymore
+		FailPendingStoreDownloadL(KErrNotReady);
+		}
+	else
+		{	
+		// Start download next tiles in queue
+		StartDownloadsL();
+		}
 	}
 
 void CTileBitmapManager::TileFileName(const TTile &aTile, TFileName &aFileName) const
@@ -822,6 +1670,717 @@ void CTileBitmapManager::TileFileName(const TTile &aTile, TFileName &aFileName)
 	}
 
 
+// CTileDownloader
+
+_LIT8(KPNGMimeType, "image/png");
+
+// Checking that mime-type is PNG
+// (If any error (for example: 404 Not Found) response may contains
+// HTML/text data instead correct PNG image. In this case, 
+// we need to skip any processing.)
+static TBool IsPNGResponseL(const RHTTPTransaction &aTransaction)
+	{
+	RStringPool strP = aTransaction.Session().StringPool();
+	RHTTPHeaders respHeaders = aTransaction.Response().GetHeaderCollection();
+	RStringF fieldName = strP.StringF(HTTP::EContentType, RHTTPSession::GetTable());
+	THTTPHdrVal fieldVal;
+	TInt r = respHeaders.GetField(fieldName, 0, fieldVal);
+	__ASSERT_DEBUG(r == KErrNone, Panic(ES60MapsNoRequiredHeaderInResponse)); // Unlikely if response don`t contains Content-Type header
+	if (r != KErrNone)
+		return EFalse;
+	
+	RStringF pngMimeType = strP.OpenFStringL(KPNGMimeType);
+	TBool isPNG = fieldVal.StrF() == pngMimeType;
+	pngMimeType.Close();
+	return isPNG;
+	}
+
+// Get caching information from response headers
+static void GetResponseMetadata(const RHTTPTransaction &aTransaction, TTileMetadata &aMetadata)
+	{
+	RStringPool strP = aTransaction.Session().StringPool();
+	RHTTPHeaders respHeaders = aTransaction.Response().GetHeaderCollection();
+	const TStringTable &strTable = RHTTPSession::GetTable();
+	
+	aMetadata = TTileMetadata();
+	aMetadata.iFetchTime = TTileMetadata::Now();
+	
+	TPtrC8 rawVal;
+	if (respHeaders.GetRawField(strP.StringF(HTTP::EETag, strTable), rawVal) == KErrNone
+			&& rawVal.Length() <= KMaxETagLength)
+		aMetadata.iETag.Copy(rawVal);
+	
+	THTTPHdrVal val;
+	if (respHeaders.GetField(strP.StringF(HTTP::ELastModified, strTable), 0, val) == KErrNone
+			&& val.Type() == THTTPHdrVal::KDateVal)
+		aMetadata.iLastModified = TTileMetadata::TimeToSeconds(TTime(val.DateTime()));
+	
+	// Cache-Control: max-age has priority over Expires
+	_LIT8(KMaxAge, "max-age=");
+	if (respHeaders.GetRawField(strP.StringF(HTTP::ECacheControl, strTable), rawVal) == KErrNone)
+		{
+		TInt pos = rawVal.FindF(KMaxAge);
+		if (pos != KErrNotFound)
+			{
+			TLex8 lex(rawVal.Mid(pos + KMaxAge().Length()));
+			TInt maxAge;
+			if (lex.Val(maxAge) == KErrNone && maxAge >= 0)
+				{
+				aMetadata.iExpiryTime = aMetadata.iFetchTime + maxAge;
+				return;
+				}
+			}
+		}
+	
+	if (respHeaders.GetField(strP.StringF(HTTP::EExpires, strTable), 0, val) == KErrNone
+			&& val.Type() == THTTPHdrVal::KDateVal)
+		{
+		TTime expires(val.DateTime());
+		
+		// Count lifetime from server`s time (if known), so difference of
+		// clocks doesn`t matter
+		THTTPHdrVal dateVal;
+		TTimeIntervalSeconds lifetime;
+		if (respHeaders.GetField(strP.StringF(HTTP::EDate, strTable), 0, dateVal) == KErrNone
+				&& dateVal.Type() == THTTPHdrVal::KDateVal
+				&& expires.SecondsFrom(TTime(dateVal.DateTime()), lifetime) == KErrNone)
+			aMetadata.iExpiryTime = aMetadata.iFetchTime + Max(0, lifetime.Int());
+		else
+			aMetadata.iExpiryTime = TTileMetadata::TimeToSeconds(expires);
+		}
+	}
+
+// @return Value of Content-Length header or KErrNotFound
+static TInt ContentLength(const RHTTPTransaction &aTransaction)
+	{
+	RStringPool strP = aTransaction.Session().StringPool();
+	RHTTPHeaders respHeaders = aTransaction.Response().GetHeaderCollection();
+	RStringF fieldName = strP.StringF(HTTP::EContentLength, RHTTPSession::GetTable());
+	THTTPHdrVal fieldVal;
+	if (respHeaders.GetField(fieldName, 0, fieldVal) != KErrNone
+			|| fieldVal.Type() != THTTPHdrVal::KTIntVal)
+		return KErrNotFound;
+	
+	return fieldVal.Int();
+	}
+
+CTileDownloader::CTileDownloader(CTileBitmapManager* aManager) :
+		CActive(EPriorityStandard),
+		iManager(aManager),
+		iState(/*TProcessingState::*/EIdle)
+	{
+	// No implementation required
+	}
+
+CTileDownloader::~CTileDownloader()
+	{
+	Abort();
+	delete iImgDecoder;
+	}
+
+CTileDownloader* CTileDownloader::NewLC(CTileBitmapManager* aManager, RFs aFs)
+	{
+	CTileDownloader* self = new (ELeave) CTileDownloader(aManager);
+	CleanupStack::PushL(self);
+	self->ConstructL(aFs);
+	return self;
+	}
+
+CTileDownloader* CTileDownloader::NewL(CTileBitmapManager* aManager, RFs aFs)
+	{
+	CTileDownloader* self = CTileDownloader::NewLC(aManager, aFs);
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CTileDownloader::ConstructL(RFs aFs)
+	{
+	iImgDecoder = CBufferedImageDecoder::NewL(aFs);
+	CActiveScheduler::Add(this);
+	}
+
+void CTileDownloader::StartL(const TTile &aTile, CHTTPClient* aHTTPClient, const TDesC8 &aUrl,
+		CTileStore* aStore, TBool aStoreOnly)
+	{
+	__ASSERT_DEBUG(iState == /*TProcessingState::*/EIdle, Panic(ES60MapsTileDownloaderIsBusyPanic));
+	
+	iTile = aTile;
+	iHTTPClient = aHTTPClient;
+	iStore = aStore;
+	iIsStoreOnly = aStoreOnly;
+	iIsRevalidation = EFalse;
+	iRequestStopwatch.Start();
+	iTransaction = aHTTPClient->GetL(aUrl, *this);
+	iState = /*TProcessingState::*/EDownloading;
+	}
+
+void CTileDownloader::StartRevalidationL(const TTile &aTile, CHTTPClient* aHTTPClient,
+		const TDesC8 &aUrl, CTileStore* aStore, const TTileMetadata &aCachedMetadata)
+	{
+	__ASSERT_DEBUG(iState == /*TProcessingState::*/EIdle, Panic(ES60MapsTileDownloaderIsBusyPanic));
+	
+	// Validators
+	RArray<THTTPRequestHeader> headers;
+	CleanupClosePushL(headers);
+	if (aCachedMetadata.iETag.Length())
+		headers.AppendL(THTTPRequestHeader(HTTP::EIfNoneMatch, aCachedMetadata.iETag));
+	TBuf8<KHTTPDateLength> lastModified;
+	if (aCachedMetadata.iLastModified)
+		{
+		CHTTPClient::FormatDate(TTileMetadata::SecondsToTime(aCachedMetadata.iLastModified),
+				lastModified);
+		headers.AppendL(THTTPRequestHeader(HTTP::EIfModifiedSince, lastModified));
+		}
+	
+	iTile = aTile;
+	iHTTPClient = aHTTPClient;
+	iStore = aStore;
+	iIsStoreOnly = ETrue;
+	iIsRevalidation = ETrue;
+	iTransaction = aHTTPClient->GetL(aUrl, *this, headers);
+	CleanupStack::PopAndDestroy(&headers);
+	iState = /*TProcessingState::*/EDownloading;
+	}
+
+void CTileDownloader::Abort()
+	{
+	switch (iState)
+		{
+		case /*TProcessingState::*/EDownloading:
+			iHTTPClient->CancelRequest(iTransaction);
+			Cancel(); // Decoding may go ahead of downloading
+			break;
+			
+		case /*TProcessingState::*/EDecoding:
+			Cancel();
+			break;
+			
+		default:
+			break;
+		}
+	
+	Reset();
+	}
+
+void CTileDownloader::Reset()
+	{
+	ResetDecoding();
+	CancelReservation();
+	iStore = NULL;
+	iData.Close();
+	iIsStoreOnly = EFalse;
+	iIsRevalidation = EFalse;
+	iIsNotModified = EFalse;
+	iState = /*TProcessingState::*/EIdle;
+	}
+
+void CTileDownloader::ResetDecoding()
+	{
+	Cancel();
+	iImgDecoder->Reset();
+	delete iBitmap;
+	iBitmap = NULL;
+	iIsDecodingStarted = EFalse;
+	iIsDecodingFinished = EFalse;
+	iHasNewData = EFalse;
+	}
+
+void CTileDownloader::ContinueDecodingL()
+	{
+	if (IsActive() || iIsDecodingFinished || !iImgDecoder->ValidDecoder()
+			|| !iImgDecoder->IsImageHeaderProcessingComplete())
+		return;
+	
+	if (!iIsDecodingStarted)
+		{
+		// Start convert PNG to CFbsBitmap
+		iBitmap = CreateTileBitmapLC(iManager->DisplayMode());
+		CleanupStack::Pop(iBitmap);
+		iImgDecoder->Convert(&iStatus, *iBitmap, 0);
+		iIsDecodingStarted = ETrue;
+		}
+	else
+		iImgDecoder->ContinueConvert(&iStatus);
+	iHasNewData = EFalse;
+	SetActive();
+	}
+
+void CTileDownloader::CancelReservation()
+	{
+	if (!iIsReserved)
+		return;
+	
+	iStore->CancelReservation(iReservation);
+	iIsReserved = EFalse;
+	}
+
+void CTileDownloader::DetachTileStore()
+	{
+	CancelReservation();
+	iStore = NULL;
+	iData.Close();
+	}
+
+void CTileDownloader::SaveToStoreL()
+	{
+	if (iStore == NULL)
+		return;
+	
+	if (iIsReserved)
+		{
+		iStore->CommitReservationL(iReservation);
+		iIsReserved = EFalse;
+		}
+	else if (iData.Length())
+		iStore->AppendL(iTile, iData, iMetadata);
+	}
+
+void CTileDownloader::DoCancel()
+	{
+	iImgDecoder->Cancel();
+	}
+
+void CTileDownloader::RunL()
+	{
+	LOG(_L8("CTileDownloader::RunL"));
+	TTile tile = iTile;
+	TInt status = iStatus.Int();
+	
+	if (!iIsStoreOnly)
+		{
+		if (status == KErrUnderflow)
+			{
+			// Decoder has processed all available data
+			if (iHasNewData)
+				{
+				// Next chunk has arrived while converting
+				TRAP(status, ContinueDecodingL());
+				if (status == KErrNone)
+					return;
+				}
+			else if (iState == /*TProcessingState::*/EDownloading)
+				return; // Wait for next chunk
+			else
+				status = KErrCorrupt; // All data is received, but image is incomplete
+			}
+		else if (iState == /*TProcessingState::*/EDownloading)
+			{
+			// Image is complete (or damaged) before the end of response.
+			// Result is reported when whole response is received.
+			iIsDecodingFinished = ETrue;
+			iDecodingResult = status;
+			return;
+			}
+		}
+	
+	CFbsBitmap* bitmap = iBitmap;
+	iBitmap = NULL; // Ownership will be transferred to manager
+	
+	// Save only successfully decoded images
+	if (status == KErrNone)
+		{
+		TInt r = KErrNone;
+		if (iIsNotModified)
+			{
+			// Stored image is still actual, only prolong it. Store keeps
+			// values of headers which are missing in 304 response.
+			if (iStore != NULL)
+				TRAP(r, iStore->UpdateMetadataL(tile, iMetadata));
+			}
+		else
+			TRAP(r, SaveToStoreL());
+		if (r != KErrNone)
+			LOG(_L8("Failed to save %S to tile store, error: %d"), &tile.AsDes8(), r);
+		
+		if (iIsStoreOnly)
+			status = iStore == NULL ? KErrNotReady : r; // Saving is the only result
+		}
+	TBool isStoreOnly = iIsStoreOnly;
+	TBool isRevalidation = iIsRevalidation;
+	TBool isModified = !iIsNotModified;
+	Reset(); // Downloader may be used again from manager`s callback
+	
+	if (isRevalidation)
+		{
+		delete bitmap; // Normally NULL
+		iManager->OnTileRevalidatedL(tile, status, isModified);
+		return;
+		}
+	
+	if (isStoreOnly)
+		{
+		delete bitmap; // Normally NULL
+		iManager->OnTileStoredL(tile, status);
+		return;
+		}
+	
+	if (status == KErrNone)
+		{
+		__ASSERT_DEBUG(bitmap != NULL, Panic(ES60MapsTileBitmapIsNullPanic));
+#if LOGGING_ENABLED
+		iManager->LogDownloadLatency(iRequestStopwatch.ElapsedMicroSeconds(),
+				iResponseStopwatch.ElapsedMicroSeconds());
+#endif
+		iManager->OnTileDownloadedL(tile, bitmap);
+		}
+	else
+		{
+		LOG(_L8("Image decoding error: %d"), status);
+		delete bitmap;
+		iManager->OnTileDownloadingFailedL(tile, status);
+		}
+	}
+
+void CTileDownloader::OnHTTPResponseDataChunkRecieved(
+		const RHTTPTransaction aTransaction, const TDesC8 &aDataChunk,
+		TInt /*anOverallDataSize*/, TBool /*anIsLastChunk*/)
+	{
+	LOG(_L8("HTTP chunk recieved"));
+	
+	if (!IsPNGResponseL(aTransaction))
+		return; // Skip other types exept PNG
+	
+	// Write original data to tile store
+	if (iIsReserved)
+		{
+		TRAPD(r, iStore->WriteL(iReservation, aDataChunk));
+		if (r != KErrNone)
+			{
+			LOG(_L8("Failed to write %S to tile store, error: %d"), &iTile.AsDes8(), r);
+			DetachTileStore(); // Don`t save this tile
+			}
+		}
+	else if (iStore != NULL)
+		{
+		// Size is unknown - keep data in memory until the end of response
+		if (iData.MaxLength() < iData.Length() + aDataChunk.Length())
+			iData.ReAllocL(Max(iData.Length() + aDataChunk.Length(), 2 * iData.MaxLength()));
+		iData.Append(aDataChunk);
+		}
+	
+	if (iIsStoreOnly)
+		return; // No need to decode
+	
+	// Append data to decoder`s buffer
+	iImgDecoder->AppendDataL(aDataChunk);
+	iHasNewData = ETrue;
+	
+	if (!iImgDecoder->ValidDecoder())
+		iImgDecoder->ContinueOpenL();
+	
+	if (!iImgDecoder->ValidDecoder())
+		return; // Next function will leave if decoder not created
+	
+	if (!iImgDecoder->IsImageHeaderProcessingComplete())
+		iImgDecoder->ContinueProcessingHeaderL();
+	
+	// Decode received part of image while the rest is downloading
+	ContinueDecodingL();
+	}
+
+void CTileDownloader::OnHTTPResponse(const RHTTPTransaction /*aTransaction*/)
+	{
+	LOG(_L8("HTTP response success"));
+	
+	// Transaction will be closed by MHTTPClientObserver
+	iState = /*TProcessingState::*/EDecoding;
+	iResponseStopwatch.Start();
+	
+	if (iIsStoreOnly)
+		{
+		// Nothing to decode, just save in RunL
+		TRequestStatus* status = &iStatus;
+		User::RequestComplete(status, iIsReserved || iData.Length() || iIsNotModified ?
+				KErrNone : KErrCorrupt);
+		SetActive();
+		return;
+		}
+	
+	if (IsActive())
+		return; // Decoding of the last part is in progress, RunL() will finish it
+	
+	if (iIsDecodingFinished || !iImgDecoder->ValidDecoder()
+			|| !iImgDecoder->IsImageHeaderProcessingComplete())
+		{
+		// Image has been decoded before the end of response or
+		// no valid image data has been recieved
+		TRequestStatus* status = &iStatus;
+		User::RequestComplete(status, iIsDecodingFinished ? iDecodingResult : KErrCorrupt);
+		SetActive();
+		return;
+		}
+	
+	LOG(_L8("Tile %S succesfully downloaded, finishing decode"), &iTile.AsDes8());
+	ContinueDecodingL();
+	}
+
+void CTileDownloader::OnHTTPError(TInt aError,
+		const RHTTPTransaction aTransaction)
+	{
+	if (iIsNotModified)
+		{
+		// Not an error for conditional request
+		OnHTTPResponse(aTransaction);
+		return;
+		}
+	
+	// Transaction will be closed by MHTTPClientObserver
+	ReportFailureL(aError);
+	}
+
+TInt CTileDownloader::MHFRunError(TInt aError, RHTTPTransaction aTransaction,
+		const THTTPEvent& aEvent)
+	{
+	// Transaction is closed here, so downloader must be freed as well,
+	// otherwise it stays busy forever
+	MHTTPClientObserver::MHFRunError(aError, aTransaction, aEvent);
+	if (IsIdle())
+		return KErrNone; // Leave from manager`s callback, already reported
+	
+	LOG(_L8("Failed to process response for %S, error: %d"), &iTile.AsDes8(), aError);
+	TRAPD(r, ReportFailureL(aError));
+	if (r != KErrNone)
+		{
+		LOG(_L8("Failed to report downloading error, error: %d"), r);
+		}
+	return KErrNone;
+	}
+
+void CTileDownloader::ReportFailureL(TInt aError)
+	{
+	TTile tile = iTile;
+	TBool isStoreOnly = iIsStoreOnly;
+	TBool isRevalidation = iIsRevalidation;
+	Reset(); // Downloader may be used again from manager`s callback
+	if (isRevalidation)
+		iManager->OnTileRevalidatedL(tile, aError, EFalse);
+	else if (isStoreOnly)
+		iManager->OnTileStoredL(tile, aError);
+	else
+		iManager->OnTileDownloadingFailedL(tile, aError);
+	}
+
+void CTileDownloader::OnHTTPHeadersRecieved(
+		const RHTTPTransaction aTransaction)
+	{
+	LOG(_L8("HTTP headers recieved"));
+	
+	ResetDecoding();
+	iData.Zero();
+	CancelReservation();
+	GetResponseMetadata(aTransaction, iMetadata);
+	
+	iIsNotModified = iIsRevalidation
+			&& aTransaction.Response().StatusCode() == KHTTPNotModifiedStatus;
+	if (iIsNotModified)
+		return; // No body in response
+	
+	iImgDecoder->OpenL(KNullDesC8, KPNGMimeType, KTileDecoderOptions);
+	
+	// Reserve space in tile store to write data as it arrives
+	if (iStore != NULL && IsPNGResponseL(aTransaction))
+		{
+		TInt length = ContentLength(aTransaction);
+		if (length > 0)
+			{
+			TRAPD(r, iStore->ReserveL(iTile, length, iReservation, iMetadata));
+			iIsReserved = r == KErrNone;
+			}
+		}
+	}
+
+
+// CTileDiskReader
+
+CTileDiskReader::CTileDiskReader(CTileBitmapManager* aManager, RFs aFs) :
+		CActive(EPriorityStandard),
+		iManager(aManager),
+		iFs(aFs)
+	{
+	// No implementation required
+	}
+
+CTileDiskReader::~CTileDiskReader()
+	{
+	Cancel();
+	Reset();
+	iData.Close();
+	}
+
+CTileDiskReader* CTileDiskReader::NewLC(CTileBitmapManager* aManager, RFs aFs)
+	{
+	CTileDiskReader* self = new (ELeave) CTileDiskReader(aManager, aFs);
+	CleanupStack::PushL(self);
+	self->ConstructL();
+	return self;
+	}
+
+CTileDiskReader* CTileDiskReader::NewL(CTileBitmapManager* aManager, RFs aFs)
+	{
+	CTileDiskReader* self = CTileDiskReader::NewLC(aManager, aFs);
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CTileDiskReader::ConstructL()
+	{
+	CActiveScheduler::Add(this);
+	}
+
+void CTileDiskReader::StartL(const TTile &aTile, CTileStore* aStore, const TDesC &aFileName)
+	{
+	__ASSERT_DEBUG(IsIdle(), Panic(ES60MapsTileDiskReaderIsBusyPanic));
+	
+	Reset();
+	iTile = aTile;
+	
+	TInt size = aStore != NULL ? aStore->DataSize(aTile) : KErrNotFound;
+	if (size != KErrNotFound)
+		{
+		if (iData.MaxLength() < size)
+			iData.ReAllocL(size);
+		iStore = aStore;
+		iState = EReading;
+		iStore->Read(aTile, iData, iStatus);
+		SetActive();
+		return;
+		}
+	
+	// Fallback to old cache format
+	iDecoder = CImageDecoder::FileNewL(iFs, aFileName, KTileDecoderOptions);
+	iOldFileName.Copy(aFileName);
+	iStore = aStore;
+	StartDecodingL();
+	}
+
+void CTileDiskReader::StartDecodingL()
+	{
+	iBitmap = CreateTileBitmapLC(iManager->DisplayMode());
+	CleanupStack::Pop(iBitmap);
+	
+	iState = EDecoding;
+	iDecoder->Convert(&iStatus, *iBitmap, 0);
+	SetActive();
+	}
+
+void CTileDiskReader::StartMigrationL(const CFbsBitmap &aBitmap)
+	{
+	delete iDecoder;
+	iDecoder = NULL;
+	
+	// Bitmap will be owned by manager, so use duplicate handle
+	iMigratedBitmap = new (ELeave) CFbsBitmap();
+	User::LeaveIfError(iMigratedBitmap->Duplicate(aBitmap.Handle()));
+	iEncoder = CImageEncoder::DataNewL(iEncodedData, KPNGMimeType, KTileEncoderOptions);
+	
+	iState = EMigrating;
+	iEncoder->Convert(&iStatus, *iMigratedBitmap);
+	SetActive();
+	}
+
+void CTileDiskReader::FinishMigrationL()
+	{
+	// Time of old file is the best known time of downloading
+	TTileMetadata metadata;
+	TTime modified;
+	if (iFs.Modified(iOldFileName, modified) == KErrNone)
+		metadata.iFetchTime = TTileMetadata::TimeToSeconds(modified);
+	iStore->AppendL(iTile, *iEncodedData, metadata);
+	User::LeaveIfError(iFs.Delete(iOldFileName));
+	}
+
+void CTileDiskReader::Reset()
+	{
+	delete iDecoder;
+	iDecoder = NULL;
+	delete iBitmap;
+	iBitmap = NULL;
+	iData.Zero();
+	iStore = NULL;
+	
+	delete iEncoder;
+	iEncoder = NULL;
+	delete iEncodedData;
+	iEncodedData = NULL;
+	delete iMigratedBitmap;
+	iMigratedBitmap = NULL;
+	iOldFileName.Zero();
+	}
+
+void CTileDiskReader::DoCancel()
+	{
+	switch (iState)
+		{
+		case EReading:
+			iStore->ReadCancel(iStatus);
+			break;
+			
+		case EDecoding:
+			iDecoder->Cancel();
+			break;
+			
+		case EMigrating:
+			iEncoder->Cancel();
+			break;
+		}
+	}
+
+void CTileDiskReader::RunL()
+	{
+	TInt status = iStatus.Int();
+	TTile tile = iTile;
+	
+	if (iState == EMigrating)
+		{
+		if (status == KErrNone)
+			TRAP(status, FinishMigrationL());
+		Reset();
+		iManager->OnTileMigratedL(tile, status);
+		return;
+		}
+	
+	if (iState == EReading && status == KErrNone)
+		{
+		// Image data has been readed from tile store, decode it now.
+		// Note: decoder uses iData until decoding is finished.
+		TRAP(status, iDecoder = CImageDecoder::DataNewL(iFs, iData, KTileDecoderOptions));
+		if (status == KErrNone)
+			TRAP(status, StartDecodingL());
+		if (status == KErrNone)
+			return;
+		}
+	
+	CFbsBitmap* bitmap = iBitmap;
+	iBitmap = NULL; // Ownership will be transferred to manager
+	
+	if (status == KErrNone && iOldFileName.Length() && iStore != NULL)
+		{
+		// Move tile from old cache to tile store. Reader stays busy
+		// until encoding will be finished.
+		TRAPD(r, StartMigrationL(*bitmap));
+		if (r != KErrNone)
+			{
+			LOG(_L8("Failed to start migration of %S, error: %d"), &tile.AsDes8(), r);
+			Reset();
+			}
+		}
+	else
+		{
+		Reset(); // Reader may be used again from manager`s callback
+		}
+	
+	if (status == KErrNone)
+		{
+		iManager->OnTileReadedL(tile, bitmap);
+		}
+	else
+		{
+		delete bitmap;
+		iManager->OnTileReadingFailedL(tile, status);
+		}
+	}
+
+
 // CTileBitmapManagerItem
 
 CTileBitmapManagerItem::~CTileBitmapManagerItem()
@@ -862,18 +2421,15 @@ void CTileBitmapManagerItem::ConstructL()
 	// Second phase construction is not used at the moment
 	}
 
-void CTileBitmapManagerItem::CreateBitmapIfNotExistL()
+void CTileBitmapManagerItem::SetBitmap(CFbsBitmap* aBitmap)
 	{
-	if (iBitmap != NULL)
+	if (aBitmap == iBitmap)
 		return;
 	
-	iBitmap = new (ELeave) CFbsBitmap();
-	TSize size(KTileSize, KTileSize);
-	TDisplayMode mode = EColor16M;
-	User::LeaveIfError(iBitmap->Create(size, mode));
+	delete iBitmap;
+	iBitmap = aBitmap;
 	}
 
-
 // OsmStandardTileProvider
 
 void TOsmStandardTileProvider::ID(TDes &aDes)
@@ -891,8 +2447,11 @@ void TOsmStandardTileProvider::Title(TDes &aDes)
 void TOsmStandardTileProvider::TileUrl(TDes8 &aUrl, const TTile &aTile)
 	{
 	_LIT8(KUrlFmt, "http://%c.tile.openstreetmap.org/%u/%u/%u.png");
+	// Subdomain depends on tile position only, so the same tile is always
+	// requested from the same server (better for servers cache) and
+	// neighbour tiles are spread evenly between connections
 	TChar chr('a');
-	chr += Math::Random() % 3; // a-c
+	chr += (aTile.iX + aTile.iY) % 3; // a-c
 	aUrl.Format(KUrlFmt, (TUint) chr, (TUint) aTile.iZ, aTile.iX, aTile.iY);
 	}
 
@@ -909,6 +2468,7 @@ TCoordinateEx::TCoordinateEx() /*:
 	iLongitude = KNaN;
 	iAltitude  = KNaN;
 	iCourse    = KNaN;
+	iSpeed     = KNaN;
 	}
 
 TCoordinateEx::TCoordinateEx(const TCoordinateEx &aCoordEx) /*:
@@ -921,6 +2481,7 @@ TCoordinateEx::TCoordinateEx(const TCoordinateEx &aCoordEx) /*:
 	iLongitude = aCoordEx.Longitude();
 	iAltitude  = aCoordEx.Altitude();
 	iCourse    = aCoordEx.Course();
+	iSpeed     = aCoordEx.Speed();
 	}
 
 TCoordinateEx::TCoordinateEx(const TCoordinate &aCoord) /*:
@@ -933,4 +2494,5 @@ TCoordinateEx::TCoordinateEx(const TCoordinate &aCoord) /*:
 	iLongitude = aCoord.Longitude();
 	iAltitude  = aCoord.Altitude();
 	iCourse    = KNaN;
+	iSpeed     = KNaN;
 	}
@@ -13,6 +13,51 @@
 
 // Constants
 const TReal KEquatorLength = 40075016.686; // Equatorial circumference of the Earth in meters
+const TReal KMaxLatitude = 85.0511287798; // Mercator projection limit, world is square
+
+// Lookup tables for fixed-point projection. Each node stores value and slope
+// (derivative multiplied by table step), values between nodes are calculated
+// with cubic Hermite interpolation. Table step 1/8 degree gives error below
+// 0.3 pixel on zoom 19 even near the poles.
+const TInt KLatTableStepsPerDegree = 8;
+const TInt KLatTableHalfSize = 681; // Steps to cover KMaxLatitude
+const TInt KLatTableSize = KLatTableHalfSize * 2 + 1;
+const TInt KLatFractionBits = 24;
+const TInt KWorldYTableBits = 10; // 1024 segments from north to south
+const TInt KWorldYTableSize = (1 << KWorldYTableBits) + 1;
+const TInt KWorldYFractionBits = KWorldZoom + 8 - KWorldYTableBits;
+const TReal KLatitudeUnit = 1e7; // Latitudes in inverse table are stored in 1e-7 degree
+const TInt KInterpolationGuardBits = 8; // Extra precision to avoid accumulation of rounding errors
+
+class TTableNode
+	{
+public:
+	TInt32 iValue;
+	TInt32 iSlope;
+	};
+
+static TTableNode LatToWorldYTable[KLatTableSize];
+static TTableNode WorldYToLatTable[KWorldYTableSize];
+static TBool IsLookupTablesInitialized = EFalse;
+
+// Cubic Hermite interpolation between two table nodes, aT is a fixed-point
+// fraction with aFractionBits bits
+static TInt Interpolate(const TTableNode &aNode0, const TTableNode &aNode1,
+		TInt64 aT, TInt aFractionBits)
+	{
+	TInt64 y0 = aNode0.iValue;
+	TInt64 y1 = aNode1.iValue;
+	TInt64 m0 = aNode0.iSlope;
+	TInt64 m1 = aNode1.iSlope;
+	TInt64 c2 = 3 * (y1 - y0) - 2 * m0 - m1;
+	TInt64 c3 = 2 * (y0 - y1) + m0 + m1;
+	// Horner's scheme keeps all products within 64 bits
+	const TInt g = KInterpolationGuardBits;
+	TInt64 r = (((c3 << g) * aT) >> aFractionBits) + (c2 << g);
+	r = ((r * aT) >> aFractionBits) + (m0 << g);
+	r = ((r * aT) >> aFractionBits) + (y0 << g);
+	return (TInt) ((r + (1 << (g - 1))) >> g);
+	}
 
 
 void MapMath::PixelsToMeters(const TReal64 &aLatitude, TZoom aZoom, TUint aPixels,
@@ -23,8 +68,7 @@ void MapMath::PixelsToMeters(const TReal64 &aLatitude, TZoom aZoom, TUint aPixel
 	//TReal p;
 	//Math::Pow(p, 2, aZoom + 8);
 	//TInt p = 2 ** (aZoom + 8);
-	TReal p;
-	Math::Pow(p, 2, aZoom + 8);
+	TReal p = TUint(1) << (aZoom + 8);
 	aHorizontalDistance =	aPixels * KEquatorLength / p;	
 	aVerticalDistance =		aPixels * KEquatorLength * c / p;
 	}
@@ -50,6 +94,20 @@ TTile MapMath::GeoCoordsToTile(const TCoordinate &aCoord, TZoom aZoom)
 	}
 
 TTileReal MapMath::GeoCoordsToTileReal(const TCoordinate &aCoord, TZoom aZoom)
+	{
+	if (aZoom > KWorldZoom)
+		return GeoCoordsToTileRealExact(aCoord, aZoom);
+	
+	TPoint worldPoint = GeoCoordsToWorldPoint(aCoord);
+	TReal tileSize = KTileSize << (KWorldZoom - aZoom);
+	TTileReal tile;
+	tile.iX = worldPoint.iX / tileSize;
+	tile.iY = worldPoint.iY / tileSize;
+	tile.iZ = aZoom;
+	return tile;
+	}
+
+TTileReal MapMath::GeoCoordsToTileRealExact(const TCoordinate &aCoord, TZoom aZoom)
 	{
 	// https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames#Lon..2Flat._to_tile_numbers_2
 	
@@ -80,6 +138,18 @@ TTileReal MapMath::GeoCoordsToTileReal(const TCoordinate &aCoord, TZoom aZoom)
 	}
 
 TCoordinate MapMath::TileToGeoCoords(const TTileReal &aTile, TZoom aZoom)
+	{
+	if (aZoom > KWorldZoom)
+		return TileToGeoCoordsExact(aTile, aZoom);
+	
+	TReal tileSize = KTileSize << (KWorldZoom - aZoom);
+	TReal x, y;
+	Math::Round(x, aTile.iX * tileSize, 0);
+	Math::Round(y, aTile.iY * tileSize, 0);
+	return WorldPointToGeoCoords(TPoint(x, y));
+	}
+
+TCoordinate MapMath::TileToGeoCoordsExact(const TTileReal &aTile, TZoom aZoom)
 	{
 	/*double tilex2long(int x, int z) 
 	{
@@ -117,6 +187,9 @@ TCoordinate MapMath::TileToGeoCoords(const TTile &aTile, TZoom aZoom)
 
 TPoint MapMath::GeoCoordsToProjectionPoint(const TCoordinate &aCoord, TZoom aZoom)
 	{
+	if (aZoom <= KWorldZoom)
+		return WorldPointToProjectionPoint(GeoCoordsToWorldPoint(aCoord), aZoom);
+	
 	TTileReal tileReal = GeoCoordsToTileReal(aCoord, aZoom);
 	TReal x, y;
 	x = tileReal.iX * KTileSize;
@@ -128,6 +201,9 @@ TPoint MapMath::GeoCoordsToProjectionPoint(const TCoordinate &aCoord, TZoom aZoo
 
 TCoordinate MapMath::ProjectionPointToGeoCoords(const TPoint &aPoint, TZoom aZoom)
 	{
+	if (aZoom <= KWorldZoom)
+		return WorldPointToGeoCoords(ProjectionPointToWorldPoint(aPoint, aZoom));
+	
 	TTileReal tileReal;
 	tileReal.iX = aPoint.iX / TReal(KTileSize);
 	tileReal.iY = aPoint.iY / TReal(KTileSize);
@@ -152,6 +228,89 @@ TPoint MapMath::TileToProjectionPoint(const TTile &aTile)
 	return projectionPoint;
 	}
 
+TPoint MapMath::GeoCoordsToWorldPoint(const TCoordinate &aCoord)
+	{
+	InitLookupTables();
+	
+	TPoint point;
+	point.iX = TInt((aCoord.Longitude() + 180.0) * (KWorldSize / 360.0) + 0.5);
+	
+	TReal lat = Max(-KMaxLatitude, Min(KMaxLatitude, aCoord.Latitude()));
+	TInt64 pos = static_cast<TInt64>((lat + TReal(KLatTableHalfSize) / KLatTableStepsPerDegree)
+			* (KLatTableStepsPerDegree << KLatFractionBits));
+	TInt index = (TInt) (pos >> KLatFractionBits);
+	TInt64 fraction = pos & ((1 << KLatFractionBits) - 1);
+	point.iY = Interpolate(LatToWorldYTable[index], LatToWorldYTable[index + 1],
+			fraction, KLatFractionBits);
+	return point;
+	}
+
+TCoordinate MapMath::WorldPointToGeoCoords(const TPoint &aPoint)
+	{
+	InitLookupTables();
+	
+	TInt y = Max(0, Min(KWorldSize - 1, aPoint.iY));
+	TInt index = y >> KWorldYFractionBits;
+	TInt64 fraction = y & ((1 << KWorldYFractionBits) - 1);
+	TInt lat = Interpolate(WorldYToLatTable[index], WorldYToLatTable[index + 1],
+			fraction, KWorldYFractionBits);
+	
+	TCoordinate coord;
+	coord.SetCoordinate(lat / KLatitudeUnit, aPoint.iX * (360.0 / KWorldSize) - 180.0);
+	return coord;
+	}
+
+void MapMath::GeoCoordsToProjectionPoints(const TCoordinate *aCoords, TInt aCount,
+		TZoom aZoom, TPoint *aPoints)
+	{
+	for (TInt i = 0; i < aCount; i++)
+		aPoints[i] = GeoCoordsToProjectionPoint(aCoords[i], aZoom);
+	}
+
+void MapMath::ProjectionPointsToGeoCoords(const TPoint *aPoints, TInt aCount,
+		TZoom aZoom, TCoordinate *aCoords)
+	{
+	for (TInt i = 0; i < aCount; i++)
+		aCoords[i] = ProjectionPointToGeoCoords(aPoints[i], aZoom);
+	}
+
+void MapMath::InitLookupTables()
+	{
+	if (IsLookupTablesInitialized)
+		return;
+	
+	TReal value, c;
+	
+	// Latitude -> world Y (dY/dLat = -sec(lat) * KWorldSize / 360)
+	for (TInt i = 0; i < KLatTableSize; i++)
+		{
+		TReal lat = TReal(i - KLatTableHalfSize) / KLatTableStepsPerDegree;
+		TTileReal tile = GeoCoordsToTileRealExact(TCoordinate(lat, 0), KWorldZoom);
+		Math::Round(value, tile.iY * KTileSize, 0);
+		Math::Cos(c, lat * KDegToRad);
+		LatToWorldYTable[i].iValue = value;
+		Math::Round(value, -KWorldSize / (360.0 * c * KLatTableStepsPerDegree), 0);
+		LatToWorldYTable[i].iSlope = value;
+		}
+	
+	// World Y -> latitude (dLat/dY = -cos(lat) * 360 / KWorldSize)
+	for (TInt i = 0; i < KWorldYTableSize; i++)
+		{
+		TTileReal tile;
+		tile.iX = 0;
+		tile.iY = TReal(i << KWorldYFractionBits) / KTileSize;
+		tile.iZ = KWorldZoom;
+		TReal lat = TileToGeoCoordsExact(tile, KWorldZoom).Latitude();
+		Math::Round(value, lat * KLatitudeUnit, 0);
+		Math::Cos(c, lat * KDegToRad);
+		WorldYToLatTable[i].iValue = value;
+		Math::Round(value, -c * 360.0 / (1 << KWorldYTableBits) * KLatitudeUnit, 0);
+		WorldYToLatTable[i].iSlope = value;
+		}
+	
+	IsLookupTablesInitialized = ETrue;
+	}
+
 // TTile
 
 TBool operator== (const TTile &aTile1, const TTile &aTile2)
@@ -165,6 +324,14 @@ TBool operator!= (const TTile &aTile1, const TTile &aTile2)
 	return !(aTile1 == aTile2);
 	}
 
+TUint32 TTile::Hash() const
+	{
+	TUint64 packed = Pack();
+	TUint32 folded = I64LOW(packed) ^ I64HIGH(packed);
+	// Multiplicative hashing (Knuth) for better distribution of close tiles
+	return folded * 0x9E3779B9;
+	}
+
 void TTile::AsDes(TDes &aDes) const
 	{
 	_LIT(KFormat, "TTile(x=%d, y=%d, z=%d)");
@@ -0,0 +1,82 @@
+/*
+ * Profiling.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "Profiling.h"
+#include <hal.h>
+
+
+// TStopwatch
+
+TInt TStopwatch::ElapsedMicroSeconds() const
+	{
+	TInt freq;
+	if (HAL::Get(HAL::EFastCounterFrequency, freq) != KErrNone || freq <= 0)
+		return 0;
+	TInt countsUp;
+	if (HAL::Get(HAL::EFastCounterCountsUp, countsUp) != KErrNone)
+		countsUp = ETrue;
+	
+	// Overflow is correct here
+	TUint32 ticks = countsUp ? User::FastCounter() - iStartCount
+			: iStartCount - User::FastCounter();
+	TInt64 microSeconds = TInt64(ticks) * 1000000 / freq;
+	// Result doesn`t fit to TInt after about 35 minutes
+	return microSeconds > KMaxTInt ? KMaxTInt : I64INT(microSeconds);
+	}
+
+
+// TTimeHistogram
+
+TTimeHistogram::TTimeHistogram()
+	{
+	Reset();
+	}
+
+void TTimeHistogram::Add(TInt aMicroSeconds)
+	{
+	TInt idx = 0;
+	TInt ms = aMicroSeconds / 1000;
+	while (ms > 0 && idx < KTimeHistogramBucketsCount - 1)
+		{
+		ms >>= 1;
+		idx++;
+		}
+	
+	iBuckets[idx]++;
+	iCount++;
+	iTotal += aMicroSeconds;
+	if (aMicroSeconds > iMax)
+		iMax = aMicroSeconds;
+	}
+
+void TTimeHistogram::Reset()
+	{
+	for (TInt i = 0; i < KTimeHistogramBucketsCount; i++)
+		iBuckets[i] = 0;
+	iCount = 0;
+	iTotal = 0;
+	iMax = 0;
+	}
+
+TInt TTimeHistogram::Average() const
+	{
+	if (!iCount)
+		return 0;
+	
+	return I64INT(iTotal / iCount);
+	}
+
+void TTimeHistogram::AsDes(TDes8 &aDes) const
+	{
+	_LIT8(KLessFmt, "<%dms:%d ");
+	_LIT8(KLastFmt, ">=%dms:%d");
+	aDes.Zero();
+	for (TInt i = 0; i < KTimeHistogramBucketsCount - 1; i++)
+		aDes.AppendFormat(KLessFmt, 1 << i, iBuckets[i]);
+	aDes.AppendFormat(KLastFmt, 1 << (KTimeHistogramBucketsCount - 2),
+			iBuckets[KTimeHistogramBucketsCount - 1]);
+	}
@@ -30,6 +30,12 @@
 #include "GitInfo.h"
 #endif
 #include "FileUtils.h"
+#include "Logger.h"
+
+
+// CONSTANTS
+const TInt KAreaDownloadZoomLevels = 3; // Count of zoom levels below current to download
+const TZoom KAreaDownloadMaxZoom = 18;
 
 
 // ============================ MEMBER FUNCTIONS ===============================
@@ -55,6 +61,28 @@ void CS60MapsAppUi::ConstructL()
 	iAppView = CS60MapsAppView::NewL(ClientRect(), position, zoom);
 	AddToStackL(iAppView);
 	
+	// Offline area download (continue unfinished job if any)
+	CS60MapsApplication* app = static_cast<CS60MapsApplication *>(Application());
+	TFileName areaDownloadStateFile;
+	app->RelPathToAbsFromDataDir(_L("areadownload.dat"), areaDownloadStateFile);
+	iAreaDownloadJob = CAreaDownloadJob::NewL(iAppView->TiledMapLayer()->BitmapManager(),
+			iEikonEnv->FsSession(), areaDownloadStateFile, this);
+	TRAPD(r, iAreaDownloadJob->ResumeL());
+	if (r != KErrNone)
+		LOG(_L8("Failed to resume area download, error: %d"), r);
+	
+	// Points of interest (file is optional)
+	TFileName featuresFile;
+	app->RelPathToAbsFromDataDir(_L("features.dat"), featuresFile);
+	TRAP(r, iAppView->FeatureLayer()->Index()->LoadL(iEikonEnv->FsSession(), featuresFile));
+	if (r != KErrNone && r != KErrNotFound && r != KErrPathNotFound)
+		{
+		LOG(_L8("Failed to load features, error: %d"), r);
+		}
+	
+	// Track recording (started by user)
+	iTrackRecorder = CTrackRecorder::NewL(iEikonEnv->FsSession());
+	
 	// Position requestor
 	_LIT(KPosRequestorName, "S60 Maps"); // ToDo: Move to global const
 	iPosRequestor = CPositionRequestor::NewL(this, KPosRequestorName);
@@ -97,6 +125,12 @@ CS60MapsAppUi::~CS60MapsAppUi()
 	
 	delete iPosRequestor;
 	
+	// Write the rest of track
+	delete iTrackRecorder;
+	
+	// Must be deleted before view because uses its bitmap manager
+	delete iAreaDownloadJob;
+	
 	if (iAppView)
 		{
 		//if (IsControlOnStack(iAppView))
@@ -163,6 +197,31 @@ void CS60MapsAppUi::HandleCommandL(TInt aCommand)
 				}
 			}
 			break;
+		case EDownloadArea:
+			{
+			DownloadVisibleAreaL();
+			}
+			break;
+		case ECancelAreaDownload:
+			{
+			iAreaDownloadJob->Discard();
+			}
+			break;
+		case EStartTrackRecording:
+			{
+			StartTrackRecordingL();
+			}
+			break;
+		case EStopTrackRecording:
+			{
+			StopTrackRecordingL();
+			}
+			break;
+		case EExportTrack:
+			{
+			ExportTrackL();
+			}
+			break;
 		case EHelp:
 			{
 
@@ -287,14 +346,137 @@ void CS60MapsAppUi::ClearTilesCache()
 	TFileName cacheDir;
 	static_cast<CS60MapsApplication *>(Application())->CacheDir(cacheDir);
 
+	// Tile store files must be closed before deleting
+	CTileBitmapManager* bitmapMgr = iAppView->TiledMapLayer()->BitmapManager();
+	bitmapMgr->CloseTileStore();
+	
 	// ToDo: Show loading/progress bar during operation
 	// ToDo: Do asynchronous
 	iFileMan->RmDir(cacheDir);
 	
+	TRAPD(r, bitmapMgr->OpenTileStoreL());
+	if (r != KErrNone)
+		LOG(_L8("Failed to reopen tile store, error: %d"), r);
+	
 	_LIT(KMsg, "Done!");
 	CEikonEnv::Static()->AlertWin(KMsg);
 	}
 
+void CS60MapsAppUi::DownloadVisibleAreaL()
+	{
+	if (iAreaDownloadJob->IsRunning())
+		{
+		HBufC* msg = iEikonEnv->AllocReadResourceLC(R_AREA_DOWNLOAD_IN_PROGRESS_TEXT);
+		iEikonEnv->AlertWin(*msg);
+		CleanupStack::PopAndDestroy(msg);
+		return;
+		}
+	
+	TCoordinate topLeft, bottomRight;
+	iAppView->Bounds(topLeft, bottomRight);
+	TZoom minZoom = iAppView->GetZoom();
+	TZoom maxZoom = Max(minZoom, Min(minZoom + KAreaDownloadZoomLevels,
+			KAreaDownloadMaxZoom));
+	TInt tilesCount = CAreaDownloadJob::TilesCount(topLeft, bottomRight,
+			minZoom, maxZoom);
+	TBuf<16> sizeBuff;
+	FileUtils::FileSizeToReadableString(
+			iAreaDownloadJob->EstimatedSize(tilesCount), sizeBuff);
+	
+	CAknMessageQueryDialog* dlg = new (ELeave) CAknMessageQueryDialog();
+	dlg->PrepareLC(R_CONFIRM_DOWNLOAD_AREA_DIALOG);
+	HBufC* title = iEikonEnv->AllocReadResourceLC(R_CONFIRM_DOWNLOAD_AREA_DIALOG_TITLE);
+	dlg->QueryHeading()->SetTextL(*title);
+	CleanupStack::PopAndDestroy(title);
+	HBufC* format = iEikonEnv->AllocReadResourceLC(R_CONFIRM_DOWNLOAD_AREA_DIALOG_TEXT);
+	RBuf msg;
+	msg.CreateL(format->Length() + 64);
+	msg.CleanupClosePushL();
+	msg.Format(*format, minZoom, maxZoom, tilesCount, &sizeBuff);
+	dlg->SetMessageTextL(msg);
+	CleanupStack::PopAndDestroy(2, format);
+	TInt res = dlg->RunLD();
+	if (res == 3005 /*Yes*/) // ToDo: Replace by constant name
+		{
+		iAreaDownloadJob->StartL(topLeft, bottomRight, minZoom, maxZoom);
+		}
+	}
+
+void CS60MapsAppUi::StartTrackRecordingL()
+	{
+	if (iTrackRecorder->IsRecording())
+		{
+		HBufC* msg = iEikonEnv->AllocReadResourceLC(R_TRACK_RECORDING_IN_PROGRESS_TEXT);
+		iEikonEnv->AlertWin(*msg);
+		CleanupStack::PopAndDestroy(msg);
+		return;
+		}
+	
+	// File name from current time, for example "tracks\20261017-153000.trk"
+	_LIT(KTracksDir, "tracks\\");
+	_LIT(KTrackFileNameFormat, "%F%Y%M%D-%H%T%S");
+	_LIT(KTrackFileExtension, ".trk");
+	TTime now;
+	now.HomeTime();
+	TBuf<32> name;
+	now.FormatL(name, KTrackFileNameFormat);
+	TFileName relPath(KTracksDir);
+	relPath.Append(name);
+	relPath.Append(KTrackFileExtension);
+	TFileName fileName;
+	static_cast<CS60MapsApplication *>(Application())->RelPathToAbsFromDataDir(relPath, fileName);
+	
+	iTrackRecorder->StartL(fileName);
+	iAppView->TrackLayer()->Reset();
+	}
+
+void CS60MapsAppUi::StopTrackRecordingL()
+	{
+	if (!iTrackRecorder->IsRecording())
+		return;
+	
+	iTrackRecorder->Stop();
+	
+	TBuf<16> bytesPerFix;
+	TRealFormat realFormat(KDefaultRealWidth, 2);
+	bytesPerFix.Num(iTrackRecorder->BytesPerFix(), realFormat);
+	HBufC* format = iEikonEnv->AllocReadResourceLC(R_TRACK_RECORDING_STOPPED_TEXT);
+	RBuf msg;
+	msg.CreateL(format->Length() + 64);
+	msg.CleanupClosePushL();
+	msg.Format(*format, iTrackRecorder->WrittenFixesCount(), iTrackRecorder->FileSize(),
+			&bytesPerFix);
+	iEikonEnv->AlertWin(msg);
+	CleanupStack::PopAndDestroy(2, format);
+	}
+
+void CS60MapsAppUi::ExportTrackL()
+	{
+	const TDesC &trackFileName = iTrackRecorder->FileName();
+	if (!trackFileName.Length())
+		{
+		HBufC* msg = iEikonEnv->AllocReadResourceLC(R_NO_TRACK_TEXT);
+		iEikonEnv->AlertWin(*msg);
+		CleanupStack::PopAndDestroy(msg);
+		return;
+		}
+	
+	// Same name with another extension
+	_LIT(KGpxFileExtension, ".gpx");
+	TParse parse;
+	User::LeaveIfError(parse.Set(KGpxFileExtension, &trackFileName, NULL));
+	TFileName gpxFileName(parse.FullName());
+	CTrackRecorder::ExportGpxL(iEikonEnv->FsSession(), trackFileName, gpxFileName);
+	
+	HBufC* format = iEikonEnv->AllocReadResourceLC(R_TRACK_EXPORTED_TEXT);
+	RBuf msg;
+	msg.CreateL(format->Length() + gpxFileName.Length());
+	msg.CleanupClosePushL();
+	msg.Format(*format, &gpxFileName);
+	iEikonEnv->AlertWin(msg);
+	CleanupStack::PopAndDestroy(2, format);
+	}
+
 void CS60MapsAppUi::OnPositionUpdated()
 	{
 	const TPositionInfo* posInfo = iPosRequestor->LastKnownPositionInfo();
@@ -310,7 +492,19 @@ void CS60MapsAppUi::OnPositionUpdated()
 		courseInfo->GetCourse(course);
 		
 		coord.SetCourse(course.Heading());
+		coord.SetSpeed(course.Speed());
 		}
+	
+	if (iTrackRecorder->IsRecording())
+		{
+		TRAPD(r, iTrackRecorder->AddFixL(pos));
+		if (r != KErrNone)
+			{
+			LOG(_L8("Failed to write track, error: %d"), r);
+			}
+		TRAP_IGNORE(iAppView->TrackLayer()->AppendPointL(coord));
+		}
+	
 	iAppView->SetUserPosition(coord);
 	}
 
@@ -327,6 +521,13 @@ void CS60MapsAppUi::OnPositionRestored()
 void CS60MapsAppUi::OnPositionLost()
 	{
 	iAppView->HideUserPosition();
+	
+	// Do not connect points before and after signal loss
+	if (iTrackRecorder->IsRecording())
+		{
+		TRAP_IGNORE(iTrackRecorder->StartSegmentL());
+		iAppView->TrackLayer()->StartSegment();
+		}
 	}
 
 void CS60MapsAppUi::OnPositionError(TInt /*aErrCode*/)
@@ -369,6 +570,35 @@ void CS60MapsAppUi::MrccatoCommand(TRemConCoreApiOperationId aOperationId,
 		}
 	}
 
+void CS60MapsAppUi::OnAreaDownloadFinished(TInt aErrCode)
+	{
+	LOG(_L8("Area download finished with code %d"), aErrCode);
+	
+	HBufC* msg = NULL;
+	if (aErrCode == KErrNone)
+		{
+		msg = iEikonEnv->AllocReadResource(R_AREA_DOWNLOAD_COMPLETED_TEXT);
+		}
+	else
+		{
+		msg = iEikonEnv->AllocReadResource(R_AREA_DOWNLOAD_STOPPED_TEXT);
+		if (msg != NULL)
+			{
+			HBufC* formattedMsg = HBufC::New(msg->Length() + 16);
+			if (formattedMsg != NULL)
+				formattedMsg->Des().Format(*msg, aErrCode);
+			delete msg;
+			msg = formattedMsg;
+			}
+		}
+	
+	if (msg != NULL)
+		{
+		iEikonEnv->AlertWin(*msg);
+		delete msg;
+		}
+	}
+
 void CS60MapsAppUi::ShowMapCacheStatsDialogL()
 	{
 	CS60MapsApplication* app = static_cast<CS60MapsApplication *>(Application());
@@ -426,6 +656,35 @@ void CS60MapsAppUi::ShowMapCacheStatsDialogL()
 	FileUtils::FileSizeToReadableString(bytesTotal, totalSizeBuff);
 	msg.AppendFormat(_L("Total: %d files, %S"), filesTotal, &totalSizeBuff);
 	
+	// Bitmaps in memory
+	CTileBitmapManager* bitmapMgr = iAppView->TiledMapLayer()->BitmapManager();
+	const TTileBitmapManagerStats &bitmapStats = bitmapMgr->Stats();
+	TBuf<16> memoryHeldBuff, memoryPeakBuff, memoryBudgetBuff;
+	FileUtils::FileSizeToReadableString(bitmapStats.iBytesHeld, memoryHeldBuff);
+	FileUtils::FileSizeToReadableString(bitmapStats.iBytesPeak, memoryPeakBuff);
+	FileUtils::FileSizeToReadableString(bitmapMgr->MemoryBudget(), memoryBudgetBuff);
+	msg.AppendFormat(_L("\nIn memory: %d tiles, %S of %S (peak %S)"), bitmapMgr->Count(),
+			&memoryHeldBuff, &memoryBudgetBuff, &memoryPeakBuff);
+	msg.AppendFormat(_L("\nStale tiles: %u not modified, %u refreshed"),
+			bitmapStats.iNotModified, bitmapStats.iRefreshed);
+	
+	// Network
+	const THTTPClientStats &httpStats = bitmapMgr->HTTPStats();
+	msg.AppendFormat(_L("\nHTTP: %u requests, ~%u connections (estimated %.1f requests per connection)"),
+			httpStats.iRequestsSent, httpStats.iConnectionsOpened,
+			httpStats.RequestsPerConnection());
+	
+	// Offline area download
+	if (iAreaDownloadJob->TilesTotal() > 0)
+		{
+		msg.AppendFormat(_L("\nArea download: %d of %d tiles (%d new, %d failed)"),
+				iAreaDownloadJob->TilesProcessed(), iAreaDownloadJob->TilesTotal(),
+				iAreaDownloadJob->TilesDownloaded(), iAreaDownloadJob->TilesFailed());
+		if (iAreaDownloadJob->IsRunning())
+			msg.AppendFormat(_L(", %.1f tiles/s"), iAreaDownloadJob->TilesPerSecond());
+		else if (!iAreaDownloadJob->IsCompleted())
+			msg.Append(_L(", paused"));
+		}
 	
 	
 	// Show information
@@ -13,12 +13,35 @@
 #include <e32math.h>
 #include "Defs.h"
 #include <aknappui.h> 
+#include "Logger.h"
+#include "S60Maps.pan"
+#include "BitmapUtils.h"
 
 // Constants
 const TZoom KMinZoomLevel = /*0*/ 1;
 const TZoom KMaxZoomLevel = 19;	// Note: 19 for default osm layer.
 								// Other layers often have max 18 level.
 const TInt KMovementRepeaterInterval = 200000;
+const TInt KMinFrameInterval = 1000000 / 60; // Do not redraw more often than display refresh
+const TInt KFlingFrameInterval = 1000000 / 30;
+const TReal KFlingDecelerationTime = 0.35; // Time constant of exponential speed decay, in seconds
+const TReal KMinFlingSpeed = 50; // Pixels per second
+const TInt KMaxFlingStartDelay = 100000; // No fling if finger was stopped longer before release
+const TInt KEdgeSwipeZoneRatio = 8; // Gestures started at 1/8 of view near the edges are swipes
+const TInt KZoomAnimationDuration = 250000;
+#if LOGGING_ENABLED
+const TInt KFrameTimesLogInterval = 50; // In frames
+const TInt KMaxInputLatency = 10000000; // Larger values are treated as clock errors
+#endif
+
+// ============================ LOCAL FUNCTIONS ================================
+
+static TInt RoundToInt(TReal aValue)
+	{
+	TReal res;
+	Math::Round(res, aValue, 0);
+	return (TInt) res;
+	}
 
 // ============================ MEMBER FUNCTIONS ===============================
 
@@ -60,16 +83,29 @@ void CS60MapsAppView::ConstructL(const TRect& aRect, const TCoordinate &aInitial
 	iLayers[0] = CTiledMapLayer::NewL(this); 
 #if DISPLAY_TILE_BORDER_AND_XYZ
 	iLayers[1] = new (ELeave) CTileBorderAndXYZLayer(this);
-	iLayers[2] = new (ELeave) CUserPositionLayer(this);
-	iLayers[3] = new (ELeave) CMapLayerDebugInfo(this);
+	iLayers[2] = iTrackLayer = CTrackLayer::NewL(this);
+	iLayers[3] = iFeatureLayer = CFeatureLayer::NewL(this);
+	iLayers[4] = new (ELeave) CUserPositionLayer(this);
+	iLayers[5] = new (ELeave) CMapLayerDebugInfo(this);
 #else
-	iLayers[1] = new (ELeave) CUserPositionLayer(this);
-	iLayers[2] = new (ELeave) CMapLayerDebugInfo(this);
+	iLayers[1] = iTrackLayer = CTrackLayer::NewL(this);
+	iLayers[2] = iFeatureLayer = CFeatureLayer::NewL(this);
+	iLayers[3] = new (ELeave) CUserPositionLayer(this);
+	iLayers[4] = new (ELeave) CMapLayerDebugInfo(this);
 #endif
 
 	// Periodic timer for repeating the movement at holding (touch interface)
 	iMovementRepeater = CPeriodic::NewL(0); // neutral priority
 	
+	// Timer for deferred redrawing
+	iRedrawTimer = CPeriodic::NewL(CActive::EPriorityStandard);
+	
+	// Timer for kinetic panning animation
+	iFlingTimer = CPeriodic::NewL(CActive::EPriorityStandard);
+	
+	// Timer for zoom animation
+	iZoomAnimationTimer = CPeriodic::NewL(CActive::EPriorityStandard);
+	
 	// Create a window for this application view
 	CreateWindowL();
 
@@ -104,10 +140,27 @@ CS60MapsAppView::~CS60MapsAppView()
 	{
 	// Destroy all layers
 	iLayers.DeleteAll();
+	
+	if (iZoomAnimationTimer)
+		iZoomAnimationTimer->Cancel();
+	delete iZoomAnimationTimer;
+	iZoomAnimationTimer = NULL;
+	
+	DeleteMapBuffer();
 
 	iMovementRepeater->Cancel();
 	delete iMovementRepeater;
 	iMovementRepeater = NULL;
+	
+	if (iRedrawTimer)
+		iRedrawTimer->Cancel();
+	delete iRedrawTimer;
+	iRedrawTimer = NULL;
+	
+	if (iFlingTimer)
+		iFlingTimer->Cancel();
+	delete iFlingTimer;
+	iFlingTimer = NULL;
 	}
 
 void CS60MapsAppView::ExternalizeL(RWriteStream &aStream) const
@@ -136,24 +189,327 @@ void CS60MapsAppView::InternalizeL(RReadStream &aStream)
 //
 void CS60MapsAppView::Draw(const TRect& /*aRect*/) const
 	{
+#if LOGGING_ENABLED
+	TStopwatch stopwatch;
+	iFramesCount++;
+#endif
+	iLastFrameStopwatch.Start();
+	
 	// Get the standard graphics context
 	CWindowGc& gc = SystemGc();
 
 	// Gets the control's extent
 	TRect drawRect(Rect());
 
-	// Clears the screen
-	gc.Clear(drawRect);
+	TInt i = 0;
+	if (iMapBuffer)
+		{
+		// Map layer is taken from back buffer
+		if (iZoomAnimationTimer->IsActive())
+			DrawZoomAnimationFrame();
+		else
+			UpdateMapBuffer();
+		gc.BitBlt(drawRect.iTl, iMapBuffer);
+		i = 1;
+		}
+	else
+		{
+		// Clears the screen
+		gc.Clear(drawRect);
+		}
 	
 	// Draw layers
-	TInt i;
-	for (i = 0; i < iLayers.Count(); i++)
+	for (; i < iLayers.Count(); i++)
 		{
 		//Window().BeginRedraw();
 		gc.Reset();
 		iLayers[i]->Draw(gc);
 		//Window().EndRedraw();
 		}
+	
+#if LOGGING_ENABLED
+	_LIT8(KFrameTimesName, "Frame times");
+	LogTime(iFrameTimes, stopwatch.ElapsedMicroSeconds(), KFrameTimesName);
+	
+	if (iIsInputPending)
+		{
+		// Window server stamps events by universal time
+		TTime now;
+		now.UniversalTime();
+		TInt64 latency = now.MicroSecondsFrom(iInputEventTime).Int64();
+		iIsInputPending = EFalse;
+		if (latency >= 0 && latency <= KMaxInputLatency)
+			{
+			_LIT8(KInputLatenciesName, "Key-to-frame latency");
+			LogTime(iInputLatencies, I64INT(latency), KInputLatenciesName);
+			}
+		}
+#endif
+	}
+
+#if LOGGING_ENABLED
+void CS60MapsAppView::LogTime(TTimeHistogram &aHistogram, TInt aMicroSeconds,
+		const TDesC8 &aName) const
+	{
+	aHistogram.Add(aMicroSeconds);
+	if (aHistogram.Count() < KFrameTimesLogInterval)
+		return;
+	
+	TBuf8<200> buff;
+	aHistogram.AsDes(buff);
+	LOG(_L8("%S (%d frames, avg=%dus, max=%dus): %S"),
+			&aName, aHistogram.Count(), aHistogram.Average(), aHistogram.Max(), &buff);
+	aHistogram.Reset();
+	}
+#endif
+
+void CS60MapsAppView::CreateMapBufferL()
+	{
+	DeleteMapBuffer();
+	
+	if (Size().iWidth <= 0 || Size().iHeight <= 0)
+		return;
+	
+	iMapBuffer = new (ELeave) CFbsBitmap;
+	User::LeaveIfError(iMapBuffer->Create(Size(), iCoeEnv->ScreenDevice()->DisplayMode()));
+	iMapBufferDevice = CFbsBitmapDevice::NewL(iMapBuffer);
+	User::LeaveIfError(iMapBufferDevice->CreateContext(iMapBufferGc));
+	iIsMapBufferValid = EFalse;
+	}
+
+void CS60MapsAppView::DeleteMapBuffer()
+	{
+	if (iZoomAnimationTimer)
+		iZoomAnimationTimer->Cancel();
+	delete iZoomSnapshotGc;
+	iZoomSnapshotGc = NULL;
+	delete iZoomSnapshotDevice;
+	iZoomSnapshotDevice = NULL;
+	delete iZoomSnapshot;
+	iZoomSnapshot = NULL;
+	
+	delete iMapBufferGc;
+	iMapBufferGc = NULL;
+	delete iMapBufferDevice;
+	iMapBufferDevice = NULL;
+	delete iMapBuffer;
+	iMapBuffer = NULL;
+	iIsMapBufferValid = EFalse;
+	}
+
+void CS60MapsAppView::UpdateMapBuffer() const
+	{
+	__ASSERT_DEBUG(iMapBuffer != NULL, Panic(ES60MapsMapBufferNotCreatedPanic));
+	
+#if LOGGING_ENABLED
+	TStopwatch stopwatch;
+#endif
+	
+	TRect rect(Rect());
+	// Where old content of buffer should be moved to
+	TPoint offset = iMapBufferPosition - iTopLeftPosition;
+	
+	if (!iIsMapBufferValid || iMapBufferZoom != iZoom
+			|| Abs(offset.iX) >= rect.Width() || Abs(offset.iY) >= rect.Height())
+		{
+		// Nothing can be reused - render whole map
+		DrawMapArea(rect);
+		iIsMapBufferValid = ETrue;
+		iMapBufferPosition = iTopLeftPosition;
+		iMapBufferZoom = iZoom;
+		iMapDirtyRegion.Clear();
+		
+#if LOGGING_ENABLED
+		_LIT8(KMapFullRenderTimesName, "Map full render times");
+		LogTime(iMapFullRenderTimes, stopwatch.ElapsedMicroSeconds(), KMapFullRenderTimesName);
+#endif
+		return;
+		}
+	
+	if (offset != TPoint(0, 0))
+		{
+		// Scroll still valid part of map
+		iMapBufferGc->Reset();
+		iMapBufferGc->CopyRect(offset, rect);
+		
+		// And render only newly exposed strips
+		if (offset.iX > 0)
+			DrawMapArea(TRect(rect.iTl.iX, rect.iTl.iY, rect.iTl.iX + offset.iX, rect.iBr.iY));
+		else if (offset.iX < 0)
+			DrawMapArea(TRect(rect.iBr.iX + offset.iX, rect.iTl.iY, rect.iBr.iX, rect.iBr.iY));
+		
+		if (offset.iY > 0)
+			DrawMapArea(TRect(rect.iTl.iX, rect.iTl.iY, rect.iBr.iX, rect.iTl.iY + offset.iY));
+		else if (offset.iY < 0)
+			DrawMapArea(TRect(rect.iTl.iX, rect.iBr.iY + offset.iY, rect.iBr.iX, rect.iBr.iY));
+		
+		iMapBufferPosition = iTopLeftPosition;
+		
+#if LOGGING_ENABLED
+		_LIT8(KMapScrollRenderTimesName, "Map scroll render times");
+		LogTime(iMapScrollRenderTimes, stopwatch.ElapsedMicroSeconds(), KMapScrollRenderTimesName);
+#endif
+		}
+	
+	// Render parts of map changed since last drawing (i.e. loaded tiles)
+	for (TInt i = 0; i < iMapDirtyRegion.Count(); i++)
+		{
+		TRect dirtyRect = iMapDirtyRegion[i];
+		dirtyRect.Move(-iTopLeftPosition);
+		if (dirtyRect.Intersects(rect))
+			{
+			dirtyRect.Intersection(rect);
+			DrawMapArea(dirtyRect);
+			}
+		}
+	iMapDirtyRegion.Clear();
+	}
+
+void CS60MapsAppView::DrawMapArea(const TRect &aRect) const
+	{
+	iMapBufferGc->Reset();
+	iMapBufferGc->SetClippingRect(aRect);
+	iMapBufferGc->Clear(aRect);
+	TiledMapLayer()->DrawArea(*iMapBufferGc, aRect);
+	}
+
+void CS60MapsAppView::RequestRedraw()
+	{
+	if (iRedrawTimer->IsActive())
+		return; // Already scheduled
+	
+	TInt elapsed = iLastFrameStopwatch.ElapsedMicroSeconds();
+	TInt delay = KMinFrameInterval - Min(Max(elapsed, 0), KMinFrameInterval);
+	iRedrawTimer->Start(delay, KMinFrameInterval, TCallBack(RedrawCallback, this));
+	}
+
+TInt CS60MapsAppView::RedrawCallback(TAny* aObject)
+	{
+	CS60MapsAppView* self = static_cast<CS60MapsAppView*>(aObject);
+	self->iRedrawTimer->Cancel();
+	self->DrawNow();
+	return 0;
+	}
+
+void CS60MapsAppView::CreateZoomSnapshotL()
+	{
+	if (iZoomSnapshot)
+		return; // Already created
+	
+	iZoomSnapshot = new (ELeave) CFbsBitmap;
+	User::LeaveIfError(iZoomSnapshot->Create(iMapBuffer->SizeInPixels(),
+			iMapBuffer->DisplayMode()));
+	iZoomSnapshotDevice = CFbsBitmapDevice::NewL(iZoomSnapshot);
+	User::LeaveIfError(iZoomSnapshotDevice->CreateContext(iZoomSnapshotGc));
+	}
+
+void CS60MapsAppView::StartZoomAnimation(TZoom aOldZoom)
+	{
+	if (!iMapBuffer)
+		return;
+	
+	if (iZoomAnimationTimer->IsActive())
+		{
+		// Zoom changed again during animation - continue from current scale
+		iZoomAnimationTimer->Cancel();
+		}
+	else
+		{
+		if (!iIsMapBufferValid || iMapBufferZoom != aOldZoom)
+			return; // Nothing to animate
+		
+		TRAPD(r, CreateZoomSnapshotL());
+		if (r != KErrNone)
+			{
+			LOG(_L8("Failed to create zoom snapshot, err=%d"), r);
+			delete iZoomSnapshotGc;
+			iZoomSnapshotGc = NULL;
+			delete iZoomSnapshotDevice;
+			iZoomSnapshotDevice = NULL;
+			delete iZoomSnapshot;
+			iZoomSnapshot = NULL;
+			return;
+			}
+		
+		iZoomSnapshotGc->BitBlt(TPoint(0, 0), iMapBuffer);
+		iZoomAnimationStartZoom = aOldZoom;
+		TPoint center = MapMath::GeoCoordsToProjectionPoint(iCenterPosition, aOldZoom);
+		iZoomAnimationCenter = center - iMapBufferPosition;
+		iZoomScale = 1;
+		}
+	
+	// Start loading of final zoom tiles while animating
+	TiledMapLayer()->LoadVisibleTiles();
+	
+	iZoomAnimationFromScale = iZoomScale;
+	iZoomAnimationStopwatch.Start();
+	iZoomAnimationTimer->Start(0, KMinFrameInterval, TCallBack(ZoomAnimationCallback, this));
+	}
+
+TInt CS60MapsAppView::ZoomAnimationCallback(TAny* aObject)
+	{
+	static_cast<CS60MapsAppView*>(aObject)->ExecuteZoomAnimationStep();
+	return 1;
+	}
+
+void CS60MapsAppView::ExecuteZoomAnimationStep()
+	{
+	TReal progress = TReal(iZoomAnimationStopwatch.ElapsedMicroSeconds()) / KZoomAnimationDuration;
+	if (progress >= 1)
+		{
+		// Finished - show real map at the new zoom
+		iZoomAnimationTimer->Cancel();
+		iIsMapBufferValid = EFalse;
+		RequestRedraw();
+		return;
+		}
+	
+	progress = 1 - (1 - progress) * (1 - progress); // Ease out
+	TReal targetScale, ratio;
+	Math::Pow(targetScale, 2, iZoom - iZoomAnimationStartZoom);
+	// Interpolate in logarithmic scale to make speed of zooming uniform
+	Math::Pow(ratio, targetScale / iZoomAnimationFromScale, progress);
+	iZoomScale = iZoomAnimationFromScale * ratio;
+	RequestRedraw();
+	}
+
+void CS60MapsAppView::DrawZoomAnimationFrame() const
+	{
+	__ASSERT_DEBUG(iZoomSnapshot != NULL, Panic(ES60MapsMapBufferNotCreatedPanic));
+	
+	TRect rect(Rect());
+	TSize size = iZoomSnapshot->SizeInPixels();
+	// Snapshot rect scaled around the view center
+	TRect destRect;
+	destRect.iTl = rect.Center() - TPoint(RoundToInt(iZoomAnimationCenter.iX * iZoomScale),
+			RoundToInt(iZoomAnimationCenter.iY * iZoomScale));
+	destRect.SetSize(TSize(RoundToInt(size.iWidth * iZoomScale),
+			RoundToInt(size.iHeight * iZoomScale)));
+	
+	iMapBufferGc->Reset();
+	if (destRect.iTl.iX > rect.iTl.iX || destRect.iTl.iY > rect.iTl.iY
+			|| destRect.iBr.iX < rect.iBr.iX || destRect.iBr.iY < rect.iBr.iY)
+		iMapBufferGc->Clear(); // Not all area is covered
+	
+	TInt r = BitmapUtils::ScaleNearest(*iZoomSnapshot, TRect(size), *iMapBuffer, destRect);
+	if (r == KErrNotSupported)
+		iMapBufferGc->DrawBitmap(destRect, iZoomSnapshot); // Slower
+	
+	// Buffer content is not a real map now
+	iIsMapBufferValid = EFalse;
+	}
+
+void CS60MapsAppView::InvalidateMapArea(const TRect &aRect)
+	{
+	TRect rect = aRect;
+	rect.Move(iTopLeftPosition); // Convert to projection coordinates
+	iMapDirtyRegion.AddRect(rect);
+	if (iMapDirtyRegion.CheckError())
+		{
+		// Too many separate areas, render whole visible map instead
+		iMapDirtyRegion.Clear();
+		iMapDirtyRegion.AddRect(TRect(iTopLeftPosition, Rect().Size()));
+		}
 	}
 
 // -----------------------------------------------------------------------------
@@ -163,7 +519,14 @@ void CS60MapsAppView::Draw(const TRect& /*aRect*/) const
 //
 void CS60MapsAppView::SizeChanged()
 	{
-	DrawNow();
+	TRAPD(r, CreateMapBufferL());
+	if (r != KErrNone)
+		{
+		// Not fatal - map will be drawn without buffer
+		DeleteMapBuffer();
+		LOG(_L8("Failed to create map buffer, err=%d"), r);
+		}
+	RequestRedraw();
 	}
 
 // -----------------------------------------------------------------------------
@@ -181,9 +544,21 @@ void CS60MapsAppView::HandlePointerEventL(const TPointerEvent& aPointerEvent)
 	if (aPointerEvent.iType == TPointerEvent::EButton1Down)
 		{
 		iMovementRepeater->Cancel();
+		StopFling();
 		iPointerDownPosition = aPointerEvent.iPosition;
+		iLastDragPosition = aPointerEvent.iPosition;
+		iIsDragging = EFalse;
+		iVelocityX = iVelocityY = 0;
+		iDragStopwatch.Start();
 		// Request drag events
 		Window().PointerFilter(EPointerFilterDrag, 0);
+		
+		// Gestures started near the edges are swipes (zoom and softkeys),
+		// from all other places map is dragged
+		TRect dragRect(Rect());
+		dragRect.Shrink(Size().iWidth / KEdgeSwipeZoneRatio,
+				Size().iHeight / KEdgeSwipeZoneRatio);
+		iIsEdgeSwipe = !dragRect.Contains(aPointerEvent.iPosition);
 
 		/*
 		 * +---------------------+ 
@@ -247,7 +622,19 @@ void CS60MapsAppView::HandlePointerEventL(const TPointerEvent& aPointerEvent)
 			{
 			iMovementRepeater->Cancel();
 			iMovement = EMoveNone;
+			if (!iIsEdgeSwipe && !iIsDragging)
+				{
+				iIsDragging = ETrue;
+				SetFollowUser(EFalse);
+#if LOGGING_ENABLED
+				iGestureFramesCount = iFramesCount;
+				iGestureStopwatch.Start();
+#endif
+				}
 			}
+		
+		if (iIsDragging)
+			Drag(aPointerEvent.iPosition);
 		}
 	else if (aPointerEvent.iType == TPointerEvent::EButton1Up)
 		{
@@ -256,7 +643,25 @@ void CS60MapsAppView::HandlePointerEventL(const TPointerEvent& aPointerEvent)
 		Window().PointerFilter(EPointerFilterDrag, EPointerFilterDrag);
 
 		TPoint posDelta = aPointerEvent.iPosition - iPointerDownPosition;
-		if (Abs(posDelta.iX) > KSwipingThreshold)
+		if (iIsDragging)
+			{
+			iIsDragging = EFalse;
+			// Continue movement by inertia if finger was not stopped
+			TBool isFling = iDragStopwatch.ElapsedMicroSeconds() < KMaxFlingStartDelay;
+			Drag(aPointerEvent.iPosition);
+			if (isFling)
+				StartFling();
+#if LOGGING_ENABLED
+			else
+				LogGestureFps();
+#endif
+			}
+		else if (!iIsEdgeSwipe)
+			{
+			// touching
+			ExecuteMovement();
+			}
+		else if (Abs(posDelta.iX) > KSwipingThreshold)
 			{
 			// swiping left/right -> zoom out/in
 			if (posDelta.iX < 0)
@@ -291,11 +696,113 @@ void CS60MapsAppView::HandlePointerEventL(const TPointerEvent& aPointerEvent)
 	CCoeControl::HandlePointerEventL(aPointerEvent);
 	}
 
+void CS60MapsAppView::Drag(const TPoint &aPosition)
+	{
+	TPoint step = aPosition - iLastDragPosition;
+	iLastDragPosition = aPosition;
+	
+	// Estimate speed for fling, smoothed to ignore jitter of touch events
+	TInt time = iDragStopwatch.ElapsedMicroSeconds();
+	iDragStopwatch.Start();
+	if (time > 0)
+		{
+		const TReal KSmoothing = 0.5;
+		iVelocityX = iVelocityX * (1 - KSmoothing) - step.iX * 1000000.0 / time * KSmoothing;
+		iVelocityY = iVelocityY * (1 - KSmoothing) - step.iY * 1000000.0 / time * KSmoothing;
+		}
+	
+	// Map follows the finger
+	if (step != TPoint(0, 0))
+		Move(iTopLeftPosition - step);
+	}
+
+void CS60MapsAppView::StartFling()
+	{
+	if (iVelocityX * iVelocityX + iVelocityY * iVelocityY < KMinFlingSpeed * KMinFlingSpeed)
+		{
+#if LOGGING_ENABLED
+		LogGestureFps();
+#endif
+		return;
+		}
+	
+	iFlingPositionX = iTopLeftPosition.iX;
+	iFlingPositionY = iTopLeftPosition.iY;
+	iFlingStopwatch.Start();
+	iFlingTimer->Start(KFlingFrameInterval, KFlingFrameInterval,
+			TCallBack(FlingCallback, this));
+	}
+
+void CS60MapsAppView::StopFling()
+	{
+	if (!iFlingTimer->IsActive())
+		return;
+	
+	iFlingTimer->Cancel();
+#if LOGGING_ENABLED
+	LogGestureFps();
+#endif
+	}
+
+TInt CS60MapsAppView::FlingCallback(TAny* aObject)
+	{
+	static_cast<CS60MapsAppView*>(aObject)->ExecuteFlingStep();
+	return 1;
+	}
+
+void CS60MapsAppView::ExecuteFlingStep()
+	{
+	// Position is calculated from real elapsed time (not from timer
+	// interval), so delayed ticks do not slow down the movement
+	TReal time = iFlingStopwatch.ElapsedMicroSeconds() / 1000000.0;
+	iFlingStopwatch.Start();
+	TReal decay;
+	Math::Exp(decay, -time / KFlingDecelerationTime);
+	
+	// Distance passed with exponentially decreasing speed
+	iFlingPositionX += iVelocityX * KFlingDecelerationTime * (1 - decay);
+	iFlingPositionY += iVelocityY * KFlingDecelerationTime * (1 - decay);
+	iVelocityX *= decay;
+	iVelocityY *= decay;
+	
+	TPoint point(RoundToInt(iFlingPositionX), RoundToInt(iFlingPositionY));
+	Move(point);
+	
+	// Stop when speed is too low or map border reached
+	if (iTopLeftPosition != point
+			|| iVelocityX * iVelocityX + iVelocityY * iVelocityY < KMinFlingSpeed * KMinFlingSpeed)
+		StopFling();
+	}
+
+#if LOGGING_ENABLED
+void CS60MapsAppView::LogGestureFps() const
+	{
+	TInt time = iGestureStopwatch.ElapsedMicroSeconds();
+	TInt frames = iFramesCount - iGestureFramesCount;
+	if (time <= 0)
+		return;
+	
+	LOG(_L8("Panning gesture: %d frames in %d us (%d fps)"),
+			frames, time, I64INT(TInt64(frames) * 1000000 / time));
+	}
+#endif
+
 TKeyResponse CS60MapsAppView::OfferKeyEventL(const TKeyEvent &aKeyEvent,
 		TEventCode aType)
 	{
+#if LOGGING_ENABLED
+	if (aType == EEventKey && !iIsInputPending)
+		{
+		// Includes time while event was waiting in queue
+		iInputEventTime = iCoeEnv->LastEvent().Time();
+		iIsInputPending = ETrue;
+		}
+#endif
+	
 	if (aType == EEventKey /*EEventKeyDown*/)
 		{
+		StopFling();
+		
 		switch (aKeyEvent.iScanCode)
 			{
 			case /*EKeyUpArrow*/ EStdKeyUpArrow:
@@ -365,9 +872,7 @@ void CS60MapsAppView::Move(const TPoint &aPoint, TBool aSavePos)
 			iCenterPosition = MapMath::ProjectionPointToGeoCoords(center, iZoom); // Store new position
 			}
 		
-		TReal tmp;
-		Math::Pow(tmp, 2, iZoom);
-		TInt maxXY = KTileSize * (int) tmp - 1;
+		TInt maxXY = (KTileSize << iZoom) - 1;
 		//TRect mapRect;
 		//mapRect.SetSize(TSize(maxXY, maxXY));
 		
@@ -388,7 +893,7 @@ void CS60MapsAppView::Move(const TPoint &aPoint, TBool aSavePos)
 			iTopLeftPosition.iX = maxXY - viewRect.Width() + 1;
 		
 		
-		DrawNow();
+		RequestRedraw();
 		}
 	}
 
@@ -404,7 +909,7 @@ void CS60MapsAppView::Move(const TCoordinate &aPos)
 
 void CS60MapsAppView::Move(const TCoordinate &aPos, TZoom aZoom)
 	{
-	// FixMe: Redrawing called twice
+	// Both calls only request redrawing, so frame is drawn once
 	Move(aPos);
 	SetZoom(aZoom);
 	}
@@ -427,9 +932,10 @@ void CS60MapsAppView::SetZoom(TZoom aZoom)
 		{
 		if (iZoom != aZoom)
 			{
+			StopFling(); // Speed is no more valid for another zoom
 			iZoom = aZoom;
 			Move(iCenterPosition);
-			DrawNow();
+			RequestRedraw(); // Position may be unchanged
 			}
 		}
 	}
@@ -437,13 +943,21 @@ void CS60MapsAppView::SetZoom(TZoom aZoom)
 void CS60MapsAppView::ZoomIn()
 	{
 	if (iZoom < KMaxZoomLevel)
+		{
+		TZoom oldZoom = iZoom;
 		SetZoom(iZoom + 1);
+		StartZoomAnimation(oldZoom);
+		}
 	}
 
 void CS60MapsAppView::ZoomOut()
 	{
 	if (iZoom > KMinZoomLevel)
+		{
+		TZoom oldZoom = iZoom;
 		SetZoom(iZoom - 1);
+		StartZoomAnimation(oldZoom);
+		}
 	}
 
 void CS60MapsAppView::MoveUp(TUint aPixels)
@@ -550,7 +1064,7 @@ void CS60MapsAppView::UpdateUserPosition()
 	if (iIsFollowUser)
 		Move(iUserPosition);
 	else
-		DrawNow();
+		RequestRedraw();
 	}
 
 void CS60MapsAppView::SetUserPosition(const TCoordinateEx& aPos)
@@ -0,0 +1,369 @@
+/*
+ * SpatialIndex.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "SpatialIndex.h"
+#include "StreamUtils.h"
+#include "S60Maps.pan"
+#include <s32file.h>
+
+
+// Constants
+const TUint32 KSpatialIndexFileMagic = 0x49533653; // "S6SI"
+const TUint32 KSpatialIndexFileVersion = 1;
+_LIT(KTempFileExtension, ".tmp");
+const TInt KMaxFeatureNameLength = 256;
+const TInt KItemsGranularity = 256;
+const TInt KLeafCellShift = KWorldZoom + 8 - KSpatialIndexBaseZoom; // World units -> leaf cells
+
+
+// Reference to node with its position used while traversing the tree
+class TSpatialIndexNodeRef
+	{
+public:
+	TInt32 iNode;
+	TInt iLevel;
+	TInt iX;
+	TInt iY;
+	TBool iIsInside; // Whole node is inside of search range
+	};
+
+
+CSpatialIndex::CSpatialIndex() :
+		iNodes(KItemsGranularity),
+		iItems(KItemsGranularity),
+		iNames(KItemsGranularity),
+		iFirstFreeItem(-1)
+	{
+	// No implementation required
+	}
+
+CSpatialIndex::~CSpatialIndex()
+	{
+	iNodes.Close();
+	iItems.Close();
+	iNames.ResetAndDestroy();
+	}
+
+CSpatialIndex* CSpatialIndex::NewLC()
+	{
+	CSpatialIndex* self = new (ELeave) CSpatialIndex();
+	CleanupStack::PushL(self);
+	return self;
+	}
+
+CSpatialIndex* CSpatialIndex::NewL()
+	{
+	CSpatialIndex* self = CSpatialIndex::NewLC();
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+TInt CSpatialIndex::InsertL(TUint32 aId, const TCoordinate &aCoord, const TDesC &aName)
+	{
+	return InsertWorldPointL(aId, MapMath::GeoCoordsToWorldPoint(aCoord), aName);
+	}
+
+TInt CSpatialIndex::InsertWorldPointL(TUint32 aId, const TPoint &aWorldPoint, const TDesC &aName)
+	{
+	// Allocate everything first, so failure does not leave index inconsistent
+	HBufC* name = aName.AllocLC();
+	TInt leaf = LeafNodeL(aWorldPoint);
+	TInt handle;
+	if (iFirstFreeItem >= 0)
+		{
+		handle = iFirstFreeItem;
+		iFirstFreeItem = iItems[handle].iNext;
+		}
+	else
+		{
+		TSpatialIndexItem newItem;
+		newItem.iNode = -1;
+		newItem.iNext = -1;
+		iItems.AppendL(newItem);
+		TInt r = iNames.Append(NULL);
+		if (r != KErrNone)
+			{
+			iItems.Remove(iItems.Count() - 1);
+			User::Leave(r);
+			}
+		handle = iItems.Count() - 1;
+		}
+	CleanupStack::Pop(name);
+	
+	iNames[handle] = name;
+	TSpatialIndexItem &item = iItems[handle];
+	item.iPosition = aWorldPoint;
+	item.iId = aId;
+	item.iNode = leaf;
+	item.iNext = iNodes[leaf].iFirstItem;
+	iNodes[leaf].iFirstItem = handle;
+	UpdateCounts(aWorldPoint, 1);
+	iCount++;
+	return handle;
+	}
+
+void CSpatialIndex::Remove(TInt aHandle)
+	{
+	__ASSERT_DEBUG(aHandle >= 0 && aHandle < iItems.Count() && iItems[aHandle].iNode >= 0,
+			Panic(ES60MapsSpatialIndexInvalidHandlePanic));
+	
+	// Unlink from leaf node
+	TSpatialIndexItem &item = iItems[aHandle];
+	TInt32* link = &iNodes[item.iNode].iFirstItem;
+	while (*link != aHandle)
+		link = &iItems[*link].iNext;
+	*link = item.iNext;
+	UpdateCounts(item.iPosition, -1);
+	
+	// Empty nodes are kept and will be reused by next insertions
+	delete iNames[aHandle];
+	iNames[aHandle] = NULL;
+	item.iNode = -1;
+	item.iNext = iFirstFreeItem;
+	iFirstFreeItem = aHandle;
+	iCount--;
+	}
+
+void CSpatialIndex::Reset()
+	{
+	iNodes.Reset();
+	iItems.Reset();
+	iNames.ResetAndDestroy();
+	iFirstFreeItem = -1;
+	iCount = 0;
+	}
+
+void CSpatialIndex::FindL(const TTile &aTopLeft, const TTile &aBottomRight,
+		RArray<TInt> &aHandles, TInt aMaxCount) const
+	{
+	if (!iCount)
+		return;
+	
+	TInt zoom = aTopLeft.iZ;
+	TInt minX = aTopLeft.iX;
+	TInt minY = aTopLeft.iY;
+	TInt maxX = aBottomRight.iX;
+	TInt maxY = aBottomRight.iY;
+	TInt itemShift = KWorldZoom + 8 - zoom; // World units -> tiles of search zoom
+	
+	RArray<TSpatialIndexNodeRef> stack;
+	CleanupClosePushL(stack);
+	TSpatialIndexNodeRef root = {0, 0, 0, 0, EFalse};
+	stack.AppendL(root);
+	TInt found = 0;
+	while (stack.Count() && found < aMaxCount)
+		{
+		TSpatialIndexNodeRef ref = stack[stack.Count() - 1];
+		stack.Remove(stack.Count() - 1);
+		const TSpatialIndexNode &node = iNodes[ref.iNode];
+		if (!node.iCount)
+			continue;
+		
+		TBool isInside = ref.iIsInside;
+		if (!isInside)
+			{
+			// Range of tiles on search zoom covered by node
+			TInt nodeMinX, nodeMinY, nodeMaxX, nodeMaxY;
+			if (ref.iLevel <= zoom)
+				{
+				TInt shift = zoom - ref.iLevel;
+				nodeMinX = ref.iX << shift;
+				nodeMinY = ref.iY << shift;
+				nodeMaxX = ((ref.iX + 1) << shift) - 1;
+				nodeMaxY = ((ref.iY + 1) << shift) - 1;
+				}
+			else
+				{
+				TInt shift = ref.iLevel - zoom;
+				nodeMinX = nodeMaxX = ref.iX >> shift;
+				nodeMinY = nodeMaxY = ref.iY >> shift;
+				}
+			
+			if (nodeMaxX < minX || nodeMinX > maxX || nodeMaxY < minY || nodeMinY > maxY)
+				continue;
+			isInside = nodeMinX >= minX && nodeMaxX <= maxX
+					&& nodeMinY >= minY && nodeMaxY <= maxY;
+			}
+		
+		if (ref.iLevel == KSpatialIndexBaseZoom)
+			{
+			for (TInt32 idx = node.iFirstItem; idx >= 0 && found < aMaxCount;
+					idx = iItems[idx].iNext)
+				{
+				if (!isInside)
+					{ // Leaf is larger than tile of search zoom, check each item
+					const TPoint &pos = iItems[idx].iPosition;
+					TInt x = pos.iX >> itemShift;
+					TInt y = pos.iY >> itemShift;
+					if (x < minX || x > maxX || y < minY || y > maxY)
+						continue;
+					}
+				aHandles.AppendL(idx);
+				found++;
+				}
+			}
+		else
+			{
+			for (TInt i = 0; i < 4; i++)
+				{
+				if (node.iChildren[i] < 0)
+					continue;
+				TSpatialIndexNodeRef child = {node.iChildren[i], ref.iLevel + 1,
+						(ref.iX << 1) | (i & 1), (ref.iY << 1) | (i >> 1), isInside};
+				stack.AppendL(child);
+				}
+			}
+		}
+	CleanupStack::PopAndDestroy(&stack);
+	}
+
+TInt CSpatialIndex::AppendNodeL()
+	{
+	TSpatialIndexNode node;
+	for (TInt i = 0; i < 4; i++)
+		node.iChildren[i] = -1;
+	node.iFirstItem = -1;
+	node.iCount = 0;
+	iNodes.AppendL(node);
+	return iNodes.Count() - 1;
+	}
+
+void CSpatialIndex::LeafCell(const TPoint &aWorldPoint, TInt &aX, TInt &aY)
+	{
+	aX = Max(0, Min(KWorldSize - 1, aWorldPoint.iX)) >> KLeafCellShift;
+	aY = Max(0, Min(KWorldSize - 1, aWorldPoint.iY)) >> KLeafCellShift;
+	}
+
+TInt CSpatialIndex::LeafNodeL(const TPoint &aWorldPoint)
+	{
+	if (!iNodes.Count())
+		AppendNodeL(); // Root
+	
+	TInt x, y;
+	LeafCell(aWorldPoint, x, y);
+	TInt node = 0;
+	for (TInt bit = KSpatialIndexBaseZoom - 1; bit >= 0; bit--)
+		{
+		TInt child = ((x >> bit) & 1) | (((y >> bit) & 1) << 1);
+		if (iNodes[node].iChildren[child] < 0)
+			{
+			TInt newNode = AppendNodeL(); // Note: May reallocate iNodes
+			iNodes[node].iChildren[child] = newNode;
+			}
+		node = iNodes[node].iChildren[child];
+		}
+	return node;
+	}
+
+void CSpatialIndex::UpdateCounts(const TPoint &aWorldPoint, TInt aDelta)
+	{
+	TInt x, y;
+	LeafCell(aWorldPoint, x, y);
+	TInt node = 0;
+	iNodes[node].iCount += aDelta;
+	for (TInt bit = KSpatialIndexBaseZoom - 1; bit >= 0; bit--)
+		{
+		TInt child = ((x >> bit) & 1) | (((y >> bit) & 1) << 1);
+		node = iNodes[node].iChildren[child];
+		iNodes[node].iCount += aDelta;
+		}
+	}
+
+void CSpatialIndex::ExternalizeL(RWriteStream &aStream) const
+	{
+	StreamUtils::WriteVarUintL(aStream, iCount);
+	if (!iCount)
+		return;
+	
+	// Depth-first traversal gives quadtree (Morton) order of leaves,
+	// so neighbour features are close and position deltas are short
+	RArray<TInt> stack;
+	CleanupClosePushL(stack);
+	stack.AppendL(0);
+	TPoint prevPosition(0, 0);
+	while (stack.Count())
+		{
+		const TSpatialIndexNode &node = iNodes[stack[stack.Count() - 1]];
+		stack.Remove(stack.Count() - 1);
+		if (!node.iCount)
+			continue;
+		
+		for (TInt32 idx = node.iFirstItem; idx >= 0; idx = iItems[idx].iNext)
+			{
+			const TSpatialIndexItem &item = iItems[idx];
+			StreamUtils::WriteVarUintL(aStream, item.iId);
+			StreamUtils::WriteVarIntL(aStream, item.iPosition.iX - prevPosition.iX);
+			StreamUtils::WriteVarIntL(aStream, item.iPosition.iY - prevPosition.iY);
+			aStream << *iNames[idx];
+			prevPosition = item.iPosition;
+			}
+		
+		for (TInt i = 3; i >= 0; i--) // Reverse order to pop the first child first
+			{
+			if (node.iChildren[i] >= 0)
+				stack.AppendL(node.iChildren[i]);
+			}
+		}
+	CleanupStack::PopAndDestroy(&stack);
+	}
+
+void CSpatialIndex::InternalizeL(RReadStream &aStream)
+	{
+	Reset();
+	
+	TInt count = StreamUtils::ReadVarUintL(aStream);
+	TPoint position(0, 0);
+	for (TInt i = 0; i < count; i++)
+		{
+		TUint32 id = StreamUtils::ReadVarUintL(aStream);
+		position.iX += StreamUtils::ReadVarIntL(aStream);
+		position.iY += StreamUtils::ReadVarIntL(aStream);
+		HBufC* name = HBufC::NewLC(aStream, KMaxFeatureNameLength);
+		InsertWorldPointL(id, position, *name);
+		CleanupStack::PopAndDestroy(name);
+		}
+	}
+
+void CSpatialIndex::SaveL(RFs &aFs, const TDesC &aFileName) const
+	{
+	TInt r = aFs.MkDirAll(aFileName);
+	if (r != KErrAlreadyExists)
+		User::LeaveIfError(r);
+	
+	// Write to temporary file first, so index file is always consistent
+	TFileName tempFileName(aFileName);
+	tempFileName.Append(KTempFileExtension);
+	
+	RFileWriteStream stream;
+	User::LeaveIfError(stream.Replace(aFs, tempFileName, EFileWrite));
+	CleanupClosePushL(stream);
+	stream.WriteUint32L(KSpatialIndexFileMagic);
+	stream.WriteUint32L(KSpatialIndexFileVersion);
+	ExternalizeL(stream);
+	stream.CommitL();
+	CleanupStack::PopAndDestroy(&stream);
+	
+	User::LeaveIfError(aFs.Replace(tempFileName, aFileName));
+	}
+
+void CSpatialIndex::LoadL(RFs &aFs, const TDesC &aFileName)
+	{
+	RFileReadStream stream;
+	User::LeaveIfError(stream.Open(aFs, aFileName, EFileRead));
+	CleanupClosePushL(stream);
+	
+	if (stream.ReadUint32L() != KSpatialIndexFileMagic
+			|| stream.ReadUint32L() != KSpatialIndexFileVersion)
+		User::Leave(KErrCorrupt);
+	TRAPD(r, InternalizeL(stream));
+	if (r != KErrNone)
+		{
+		Reset(); // Do not keep partially loaded data
+		User::Leave(r);
+		}
+	CleanupStack::PopAndDestroy(&stream);
+	}
@@ -0,0 +1,60 @@
+/*
+ * StreamUtils.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "StreamUtils.h"
+
+
+// Constants
+const TInt KMaxVarUintSize = 5; // Bytes for 32-bit value
+
+
+void StreamUtils::WriteVarUintL(RWriteStream &aStream, TUint32 aValue)
+	{
+	TBuf8<KMaxVarUintSize> buff;
+	while (aValue >= 0x80)
+		{
+		buff.Append(TUint8(aValue | 0x80));
+		aValue >>= 7;
+		}
+	buff.Append(TUint8(aValue));
+	aStream.WriteL(buff);
+	}
+
+TUint32 StreamUtils::ReadVarUintL(RReadStream &aStream)
+	{
+	TUint32 value = 0;
+	for (TInt i = 0; i < KMaxVarUintSize; i++)
+		{
+		TUint8 byte = aStream.ReadUint8L();
+		value |= TUint32(byte & 0x7F) << (7 * i);
+		if (!(byte & 0x80))
+			return value;
+		}
+	User::Leave(KErrCorrupt);
+	return 0; // Never reached, avoid compiler warning
+	}
+
+void StreamUtils::WriteVarIntL(RWriteStream &aStream, TInt32 aValue)
+	{
+	WriteVarUintL(aStream, ZigZag(aValue));
+	}
+
+TInt32 StreamUtils::ReadVarIntL(RReadStream &aStream)
+	{
+	return UnZigZag(ReadVarUintL(aStream));
+	}
+
+TInt StreamUtils::VarUintSize(TUint32 aValue)
+	{
+	TInt size = 1;
+	while (aValue >= 0x80)
+		{
+		aValue >>= 7;
+		size++;
+		}
+	return size;
+	}
@@ -0,0 +1,726 @@
+/*
+ * TileStore.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "TileStore.h"
+#include <bautils.h>
+#include <s32file.h>
+#include "Logger.h"
+#include "S60Maps.pan"
+
+
+// Constants
+_LIT(KDataFileName, "tiles.dat");
+_LIT(KIndexFileName, "tiles.idx");
+_LIT(KTempFileExtension, ".tmp");
+const TUint32 KDataFileMagic = 0x54443653; // "S6DT"
+const TUint32 KIndexFileMagic = 0x49543653; // "S6TI"
+const TUint32 KRecordMagic = 0x52543653; // "S6TR"
+const TUint32 KPendingRecordMagic = 0x50543653; // "S6TP", record is being written
+const TUint32 KStoreVersion = 2;
+const TUint32 KMinSupportedStoreVersion = 1; // Older versions are converted
+const TInt KDataFileHeaderSize = 2 * sizeof(TUint32); // Magic and version
+const TInt KMaxTileDataSize = 1024 * 1024; // Larger records are treated as damaged
+const TInt KInitialBucketsCount = 256;
+const TInt KAutoCommitInterval = 32; // Index is saved after such count of changes
+const TInt KMinWastedSizeForCompaction = 1024 * 1024;
+
+
+// Header of each record in data file
+class TTileStoreRecordHeader
+	{
+public:
+	TUint32 iMagic;
+	TUint32 iZ;
+	TUint32 iX;
+	TUint32 iY;
+	TUint32 iLength;
+	// Since version 2
+	TUint32 iFetchTime;
+	TUint32 iExpiryTime;
+	TUint32 iLastModified;
+	TUint32 iETagLength;
+	};
+
+const TInt KRecordHeaderSize = sizeof(TTileStoreRecordHeader);
+const TInt KRecordHeaderSizeV1 = _FOFF(TTileStoreRecordHeader, iFetchTime);
+const TInt KRecordTimesOffset = _FOFF(TTileStoreRecordHeader, iFetchTime);
+const TInt KRecordTimesSize = 3 * sizeof(TUint32); // Fetch, expiry and modification times
+
+// Start of time counting for metadata
+const TInt KMicroSecondsPerSecond = 1000000;
+const TInt64 KUnixEpochMicroSeconds = MAKE_TINT64(0x00dcddb3, 0x0f2f8000); // 01.01.1970 since 01.01.0000
+
+
+static TInt CompareEntriesByTile(const TTileStoreEntry &aEntry1, const TTileStoreEntry &aEntry2)
+	{
+	TUint64 key1 = aEntry1.iTile.Pack();
+	TUint64 key2 = aEntry2.iTile.Pack();
+	if (key1 < key2)
+		return -1;
+	if (key1 > key2)
+		return 1;
+	return 0;
+	}
+
+
+// TTileMetadata
+
+TTileMetadata::TTileMetadata() :
+		iFetchTime(0),
+		iExpiryTime(0),
+		iLastModified(0)
+	{
+	}
+
+TUint32 TTileMetadata::TimeToSeconds(const TTime &aTime)
+	{
+	TInt64 seconds = (aTime.Int64() - KUnixEpochMicroSeconds) / KMicroSecondsPerSecond;
+	return seconds > 0 ? TUint32(seconds) : 0;
+	}
+
+TTime TTileMetadata::SecondsToTime(TUint32 aSeconds)
+	{
+	return TTime(KUnixEpochMicroSeconds + TInt64(aSeconds) * KMicroSecondsPerSecond);
+	}
+
+TUint32 TTileMetadata::Now()
+	{
+	TTime now;
+	now.UniversalTime();
+	return TimeToSeconds(now);
+	}
+
+
+// CTileStore
+
+CTileStore::CTileStore(RFs aFs) :
+		iFs(aFs)
+	{
+	// No implementation required
+	}
+
+CTileStore::~CTileStore()
+	{
+	if (iUncommittedCount)
+		TRAP_IGNORE(CommitL());
+	
+	iDataFile.Close();
+	iEntries.Close();
+	iBuckets.Close();
+	}
+
+CTileStore* CTileStore::NewLC(RFs aFs, const TDesC &aDir)
+	{
+	CTileStore* self = new (ELeave) CTileStore(aFs);
+	CleanupStack::PushL(self);
+	self->ConstructL(aDir);
+	return self;
+	}
+
+CTileStore* CTileStore::NewL(RFs aFs, const TDesC &aDir)
+	{
+	CTileStore* self = CTileStore::NewLC(aFs, aDir);
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CTileStore::ConstructL(const TDesC &aDir)
+	{
+	iDataFileName.Copy(aDir);
+	iDataFileName.Append(KDataFileName);
+	iIndexFileName.Copy(aDir);
+	iIndexFileName.Append(KIndexFileName);
+	BaflUtils::EnsurePathExistsL(iFs, iDataFileName);
+	
+	RebuildBucketsL(KInitialBucketsCount);
+	OpenDataFileL();
+	
+	TInt indexedSize = KErrNotFound;
+	TRAPD(r, indexedSize = LoadIndexL());
+	if (r != KErrNone || indexedSize > iDataFileSize)
+		{
+		// Index is absent, damaged or doesn`t match data file - rebuild it from scratch
+		LOG(_L8("Tile store index is not valid (error: %d), rebuilding"), r);
+		iEntries.Reset();
+		RebuildBucketsL(KInitialBucketsCount);
+		iWastedSize = 0;
+		indexedSize = KDataFileHeaderSize;
+		}
+	ScanDataFileL(indexedSize);
+	
+	LOG(_L8("Tile store opened: %d tiles, data size=%d, wasted=%d, version=%u"),
+			iEntries.Count(), iDataFileSize, iWastedSize, iVersion);
+	
+	if (iVersion < KStoreVersion)
+		{
+		// Compaction rewrites all records in actual format
+		LOG(_L8("Converting tile store to version %u"), KStoreVersion);
+		CompactL();
+		}
+	else if (iWastedSize >= KMinWastedSizeForCompaction && iWastedSize > iDataFileSize / 2)
+		CompactL();
+	}
+
+void CTileStore::OpenDataFileL()
+	{
+	TInt r = iDataFile.Open(iFs, iDataFileName, EFileRead | EFileWrite);
+	if (r == KErrNone)
+		{
+		// Check file signature
+		TBuf8<KDataFileHeaderSize> header;
+		User::LeaveIfError(iDataFile.Read(0, header));
+		TUint32 version = header.Length() == KDataFileHeaderSize ?
+				*reinterpret_cast<const TUint32*>(header.Ptr() + sizeof(TUint32)) : 0;
+		if (header.Length() == KDataFileHeaderSize
+				&& *reinterpret_cast<const TUint32*>(header.Ptr()) == KDataFileMagic
+				&& version >= KMinSupportedStoreVersion && version <= KStoreVersion)
+			{
+			User::LeaveIfError(iDataFile.Size(iDataFileSize));
+			iVersion = version;
+			iRecordHeaderSize = version >= 2 ? KRecordHeaderSize : KRecordHeaderSizeV1;
+			return;
+			}
+		
+		LOG(_L8("Tile store data file has unknown format, recreating"));
+		iDataFile.Close();
+		}
+	else if (r != KErrNotFound)
+		User::Leave(r);
+	
+	User::LeaveIfError(iDataFile.Replace(iFs, iDataFileName, EFileRead | EFileWrite));
+	TUint32 header[2] = {KDataFileMagic, KStoreVersion};
+	User::LeaveIfError(iDataFile.Write(0, TPtrC8(reinterpret_cast<const TUint8*>(header),
+			KDataFileHeaderSize)));
+	iDataFileSize = KDataFileHeaderSize;
+	iVersion = KStoreVersion;
+	iRecordHeaderSize = KRecordHeaderSize;
+	}
+
+TInt CTileStore::LoadIndexL()
+	{
+	RFileReadStream stream;
+	User::LeaveIfError(stream.Open(iFs, iIndexFileName, EFileRead));
+	CleanupClosePushL(stream);
+	
+	// Index must have the same version as data file
+	if (stream.ReadUint32L() != KIndexFileMagic || stream.ReadUint32L() != iVersion)
+		User::Leave(KErrCorrupt);
+	TInt indexedSize = stream.ReadInt32L();
+	iWastedSize = stream.ReadInt32L();
+	TInt count = stream.ReadInt32L();
+	
+	iEntries.Reset();
+	iEntries.ReserveL(count);
+	TInt bucketsCount = KInitialBucketsCount;
+	while (bucketsCount < count)
+		bucketsCount <<= 1;
+	RebuildBucketsL(bucketsCount);
+	
+	for (TInt i = 0; i < count; i++)
+		{
+		TTileStoreEntry entry;
+		entry.iTile.iZ = stream.ReadUint8L();
+		entry.iTile.iX = stream.ReadUint32L();
+		entry.iTile.iY = stream.ReadUint32L();
+		entry.iOffset = stream.ReadInt32L();
+		entry.iLength = stream.ReadInt32L();
+		entry.iFetchTime = entry.iExpiryTime = entry.iLastModified = 0;
+		entry.iETagLength = 0;
+		if (iVersion >= 2)
+			{
+			entry.iFetchTime = stream.ReadUint32L();
+			entry.iExpiryTime = stream.ReadUint32L();
+			entry.iLastModified = stream.ReadUint32L();
+			entry.iETagLength = stream.ReadUint8L();
+			}
+		if (entry.iOffset + entry.iLength > indexedSize)
+			User::Leave(KErrCorrupt);
+		AddEntryL(entry);
+		}
+	
+	CleanupStack::PopAndDestroy(&stream);
+	return indexedSize;
+	}
+
+void CTileStore::SaveIndexL()
+	{
+	// Write to temporary file first and replace old index after that, so
+	// index on disk is always consistent even if writing was interrupted
+	TFileName tempFileName(iIndexFileName);
+	tempFileName.Append(KTempFileExtension);
+	
+	// Sorted order gives sequential reading of data file for neighbour tiles
+	iEntries.Sort(TLinearOrder<TTileStoreEntry>(CompareEntriesByTile));
+	RebuildBucketsL(iBuckets.Count());
+	
+	RFileWriteStream stream;
+	User::LeaveIfError(stream.Replace(iFs, tempFileName, EFileWrite));
+	CleanupClosePushL(stream);
+	
+	stream.WriteUint32L(KIndexFileMagic);
+	stream.WriteUint32L(iVersion);
+	stream.WriteInt32L(iDataFileSize);
+	stream.WriteInt32L(iWastedSize);
+	stream.WriteInt32L(iEntries.Count());
+	for (TInt i = 0; i < iEntries.Count(); i++)
+		{
+		const TTileStoreEntry &entry = iEntries[i];
+		stream.WriteUint8L(entry.iTile.iZ);
+		stream.WriteUint32L(entry.iTile.iX);
+		stream.WriteUint32L(entry.iTile.iY);
+		stream.WriteInt32L(entry.iOffset);
+		stream.WriteInt32L(entry.iLength);
+		if (iVersion >= 2)
+			{
+			stream.WriteUint32L(entry.iFetchTime);
+			stream.WriteUint32L(entry.iExpiryTime);
+			stream.WriteUint32L(entry.iLastModified);
+			stream.WriteUint8L(entry.iETagLength);
+			}
+		}
+	stream.CommitL();
+	CleanupStack::PopAndDestroy(&stream);
+	
+	User::LeaveIfError(iFs.Replace(tempFileName, iIndexFileName));
+	}
+
+void CTileStore::ScanDataFileL(TInt aStartPos)
+	{
+	TInt pos = aStartPos;
+	TInt restoredCount = 0;
+	TTileStoreRecordHeader header;
+	TPckg<TTileStoreRecordHeader> headerPckg(header);
+	
+	while (pos + iRecordHeaderSize <= iDataFileSize)
+		{
+		Mem::FillZ(&header, sizeof(header)); // Version 1 header has no metadata
+		User::LeaveIfError(iDataFile.Read(pos, headerPckg, iRecordHeaderSize));
+		if (headerPckg.Length() != iRecordHeaderSize
+				|| (header.iMagic != KRecordMagic && header.iMagic != KPendingRecordMagic)
+				|| header.iLength > TUint32(KMaxTileDataSize)
+				|| header.iETagLength > TUint32(KMaxETagLength)
+				|| pos + iRecordHeaderSize + TInt(header.iETagLength + header.iLength) > iDataFileSize)
+			break; // Incomplete or damaged record
+		
+		TTileStoreEntry entry;
+		entry.iTile.iZ = header.iZ;
+		entry.iTile.iX = header.iX;
+		entry.iTile.iY = header.iY;
+		entry.iOffset = pos + iRecordHeaderSize + header.iETagLength;
+		entry.iLength = header.iLength;
+		entry.iFetchTime = header.iFetchTime;
+		entry.iExpiryTime = header.iExpiryTime;
+		entry.iLastModified = header.iLastModified;
+		entry.iETagLength = header.iETagLength;
+		pos = entry.iOffset + entry.iLength;
+		
+		if (header.iMagic == KPendingRecordMagic)
+			{
+			// Writing of this record was not finished
+			iWastedSize += RecordSize(entry);
+			continue;
+			}
+		
+		AddEntryL(entry);
+		restoredCount++;
+		}
+	
+	if (pos < iDataFileSize)
+		{
+		// Cut off damaged tail
+		LOG(_L8("Tile store data file truncated from %d to %d bytes"), iDataFileSize, pos);
+		User::LeaveIfError(iDataFile.SetSize(pos));
+		iDataFileSize = pos;
+		}
+	
+	if (restoredCount)
+		{
+		LOG(_L8("%d tiles restored from tile store data file"), restoredCount);
+		iUncommittedCount += restoredCount;
+		}
+	}
+
+TInt CTileStore::FindEntry(const TTile &aTile) const
+	{
+	TInt idx = iBuckets[BucketIndex(aTile)];
+	while (idx != KErrNotFound && iEntries[idx].iTile != aTile)
+		idx = iEntries[idx].iNext;
+	
+	return idx;
+	}
+
+void CTileStore::AddEntryL(const TTileStoreEntry &aEntry)
+	{
+	TInt idx = FindEntry(aEntry.iTile);
+	if (idx != KErrNotFound)
+		{
+		// Old record becomes garbage
+		TTileStoreEntry &entry = iEntries[idx];
+		iWastedSize += RecordSize(entry);
+		TInt next = entry.iNext;
+		entry = aEntry;
+		entry.iNext = next;
+		return;
+		}
+	
+	if (iEntries.Count() >= iBuckets.Count())
+		RebuildBucketsL(iBuckets.Count() * 2);
+	
+	TInt bucketIdx = BucketIndex(aEntry.iTile);
+	iEntries.AppendL(aEntry);
+	iEntries[iEntries.Count() - 1].iNext = iBuckets[bucketIdx];
+	iBuckets[bucketIdx] = iEntries.Count() - 1;
+	}
+
+void CTileStore::RebuildBucketsL(TInt aCount)
+	{
+	__ASSERT_DEBUG((aCount & (aCount - 1)) == 0, Panic(ES60MapsInvalidHashTableSizePanic));
+	
+	iBuckets.Reset();
+	iBuckets.ReserveL(aCount);
+	TInt i;
+	for (i = 0; i < aCount; i++)
+		iBuckets.AppendL(KErrNotFound);
+	
+	for (i = 0; i < iEntries.Count(); i++)
+		{
+		TInt bucketIdx = BucketIndex(iEntries[i].iTile);
+		iEntries[i].iNext = iBuckets[bucketIdx];
+		iBuckets[bucketIdx] = i;
+		}
+	}
+
+TInt CTileStore::DataSize(const TTile &aTile) const
+	{
+	TInt idx = FindEntry(aTile);
+	if (idx == KErrNotFound)
+		return KErrNotFound;
+	
+	return iEntries[idx].iLength;
+	}
+
+void CTileStore::ReadL(const TTile &aTile, TDes8 &aData)
+	{
+	TInt idx = FindEntry(aTile);
+	if (idx == KErrNotFound)
+		User::Leave(KErrNotFound);
+	
+	const TTileStoreEntry &entry = iEntries[idx];
+	User::LeaveIfError(iDataFile.Read(entry.iOffset, aData, entry.iLength));
+	if (aData.Length() != entry.iLength)
+		User::Leave(KErrCorrupt);
+	}
+
+void CTileStore::Read(const TTile &aTile, TDes8 &aData, TRequestStatus &aStatus)
+	{
+	TInt idx = FindEntry(aTile);
+	if (idx == KErrNotFound)
+		{
+		TRequestStatus* status = &aStatus;
+		User::RequestComplete(status, KErrNotFound);
+		return;
+		}
+	
+	const TTileStoreEntry &entry = iEntries[idx];
+	iDataFile.Read(entry.iOffset, aData, entry.iLength, aStatus);
+	}
+
+void CTileStore::ReadCancel(TRequestStatus &aStatus)
+	{
+	iDataFile.ReadCancel(aStatus);
+	}
+
+void CTileStore::GetMetadataL(const TTile &aTile, TTileMetadata &aMetadata)
+	{
+	TInt idx = FindEntry(aTile);
+	if (idx == KErrNotFound)
+		User::Leave(KErrNotFound);
+	
+	const TTileStoreEntry &entry = iEntries[idx];
+	aMetadata.iFetchTime = entry.iFetchTime;
+	aMetadata.iExpiryTime = entry.iExpiryTime;
+	aMetadata.iLastModified = entry.iLastModified;
+	aMetadata.iETag.Zero();
+	if (entry.iETagLength)
+		{
+		User::LeaveIfError(iDataFile.Read(entry.iOffset - entry.iETagLength,
+				aMetadata.iETag, entry.iETagLength));
+		if (aMetadata.iETag.Length() != entry.iETagLength)
+			User::Leave(KErrCorrupt);
+		}
+	}
+
+void CTileStore::UpdateMetadataL(const TTile &aTile, const TTileMetadata &aMetadata)
+	{
+	__ASSERT_DEBUG(iVersion >= 2, Panic(ES60MapsTileStoreInvalidVersionPanic));
+	
+	TInt idx = FindEntry(aTile);
+	if (idx == KErrNotFound)
+		User::Leave(KErrNotFound);
+	
+	// Response to conditional request may omit headers, which haven`t
+	// changed (RFC 7232), so missing values are taken from stored entry
+	TTileStoreEntry &entry = iEntries[idx];
+	TUint32 expiryTime = aMetadata.iExpiryTime;
+	if (!expiryTime && entry.iExpiryTime > entry.iFetchTime)
+		expiryTime = aMetadata.iFetchTime + (entry.iExpiryTime - entry.iFetchTime);
+	TUint32 lastModified = aMetadata.iLastModified ? aMetadata.iLastModified : entry.iLastModified;
+	
+	// Rewrite times in record header
+	TUint32 times[3] = {aMetadata.iFetchTime, expiryTime, lastModified};
+	TInt headerPos = entry.iOffset - entry.iETagLength - iRecordHeaderSize;
+	User::LeaveIfError(iDataFile.Write(headerPos + KRecordTimesOffset,
+			TPtrC8(reinterpret_cast<const TUint8*>(times), KRecordTimesSize)));
+	if (aMetadata.iETag.Length() && aMetadata.iETag.Length() == entry.iETagLength)
+		User::LeaveIfError(iDataFile.Write(entry.iOffset - entry.iETagLength, aMetadata.iETag));
+	entry.iFetchTime = aMetadata.iFetchTime;
+	entry.iExpiryTime = expiryTime;
+	entry.iLastModified = lastModified;
+	
+	if (++iUncommittedCount >= KAutoCommitInterval)
+		CommitL();
+	}
+
+TBool CTileStore::IsStale(const TTile &aTile, TUint32 aNow, TUint32 aDefaultTtl) const
+	{
+	TInt idx = FindEntry(aTile);
+	if (idx == KErrNotFound)
+		return EFalse;
+	
+	const TTileStoreEntry &entry = iEntries[idx];
+	if (entry.iFetchTime == 0)
+		return ETrue; // Saved before caching information was introduced
+	
+	TUint32 expiryTime = entry.iExpiryTime ? entry.iExpiryTime : entry.iFetchTime + aDefaultTtl;
+	return aNow >= expiryTime;
+	}
+
+TInt CTileStore::AppendRecordHeaderL(const TTile &aTile, TInt aLength, TUint32 aMagic,
+		const TTileMetadata &aMetadata)
+	{
+	__ASSERT_DEBUG(iVersion >= 2, Panic(ES60MapsTileStoreInvalidVersionPanic));
+	
+	TTileStoreRecordHeader header;
+	header.iMagic = aMagic;
+	header.iZ = aTile.iZ;
+	header.iX = aTile.iX;
+	header.iY = aTile.iY;
+	header.iLength = aLength;
+	header.iFetchTime = aMetadata.iFetchTime;
+	header.iExpiryTime = aMetadata.iExpiryTime;
+	header.iLastModified = aMetadata.iLastModified;
+	header.iETagLength = aMetadata.iETag.Length();
+	
+	TInt pos = iDataFileSize;
+	TInt r = iDataFile.Write(pos, TPckgC<TTileStoreRecordHeader>(header));
+	if (r == KErrNone && header.iETagLength)
+		r = iDataFile.Write(pos + KRecordHeaderSize, aMetadata.iETag);
+	if (r != KErrNone)
+		DiscardAppendedRecordL(r);
+	return pos + KRecordHeaderSize + header.iETagLength;
+	}
+
+void CTileStore::DiscardAppendedRecordL(TInt aError)
+	{
+	// Otherwise next record would be written to the end of garbage
+	// instead of position saved in the index
+	iDataFile.SetSize(iDataFileSize);
+	User::Leave(aError);
+	}
+
+void CTileStore::OnRecordWrittenL(const TTileStoreEntry &aEntry)
+	{
+	AddEntryL(aEntry);
+	
+	iStats.iWrittenTiles++;
+	iStats.iWrittenBytes += RecordSize(aEntry);
+	
+	if (++iUncommittedCount >= KAutoCommitInterval)
+		CommitL();
+	}
+
+void CTileStore::AppendL(const TTile &aTile, const TDesC8 &aData, const TTileMetadata &aMetadata)
+	{
+	TInt offset = AppendRecordHeaderL(aTile, aData.Length(), KRecordMagic, aMetadata);
+	TInt r = iDataFile.Write(offset, aData);
+	if (r != KErrNone)
+		DiscardAppendedRecordL(r);
+	iDataFileSize = offset + aData.Length();
+	
+	TTileStoreEntry entry;
+	entry.iTile = aTile;
+	entry.iOffset = offset;
+	entry.iLength = aData.Length();
+	entry.iFetchTime = aMetadata.iFetchTime;
+	entry.iExpiryTime = aMetadata.iExpiryTime;
+	entry.iLastModified = aMetadata.iLastModified;
+	entry.iETagLength = aMetadata.iETag.Length();
+	OnRecordWrittenL(entry);
+	}
+
+void CTileStore::ReserveL(const TTile &aTile, TInt aLength, TTileStoreReservation &aReservation,
+		const TTileMetadata &aMetadata)
+	{
+	if (aLength > KMaxTileDataSize)
+		User::Leave(KErrTooBig);
+	
+	TInt offset = AppendRecordHeaderL(aTile, aLength, KPendingRecordMagic, aMetadata);
+	// Extend file, otherwise next records will be written at wrong position
+	TInt r = iDataFile.SetSize(offset + aLength);
+	if (r != KErrNone)
+		DiscardAppendedRecordL(r);
+	iDataFileSize = offset + aLength;
+	
+	aReservation.iTile = aTile;
+	aReservation.iOffset = offset;
+	aReservation.iLength = aLength;
+	aReservation.iWritten = 0;
+	aReservation.iFetchTime = aMetadata.iFetchTime;
+	aReservation.iExpiryTime = aMetadata.iExpiryTime;
+	aReservation.iLastModified = aMetadata.iLastModified;
+	aReservation.iETagLength = aMetadata.iETag.Length();
+	iReservationsCount++;
+	}
+
+void CTileStore::WriteL(TTileStoreReservation &aReservation, const TDesC8 &aData)
+	{
+	if (aReservation.iWritten + aData.Length() > aReservation.iLength)
+		User::Leave(KErrOverflow);
+	
+	User::LeaveIfError(iDataFile.Write(aReservation.iOffset + aReservation.iWritten, aData));
+	aReservation.iWritten += aData.Length();
+	}
+
+void CTileStore::CommitReservationL(const TTileStoreReservation &aReservation)
+	{
+	if (aReservation.iWritten != aReservation.iLength)
+		User::Leave(KErrCorrupt);
+	
+	// Mark record as complete
+	TPckgC<TUint32> magicPckg(KRecordMagic);
+	User::LeaveIfError(iDataFile.Write(aReservation.iOffset - aReservation.iETagLength
+			- KRecordHeaderSize, magicPckg));
+	iReservationsCount--;
+	
+	TTileStoreEntry entry;
+	entry.iTile = aReservation.iTile;
+	entry.iOffset = aReservation.iOffset;
+	entry.iLength = aReservation.iLength;
+	entry.iFetchTime = aReservation.iFetchTime;
+	entry.iExpiryTime = aReservation.iExpiryTime;
+	entry.iLastModified = aReservation.iLastModified;
+	entry.iETagLength = aReservation.iETagLength;
+	OnRecordWrittenL(entry);
+	}
+
+void CTileStore::CancelReservation(const TTileStoreReservation &aReservation)
+	{
+	iWastedSize += KRecordHeaderSize + aReservation.iETagLength + aReservation.iLength;
+	iReservationsCount--;
+	}
+
+void CTileStore::CommitL()
+	{
+	User::LeaveIfError(iDataFile.Flush());
+	SaveIndexL();
+	iUncommittedCount = 0;
+	LOG(_L8("Tile store index saved, %d tiles"), iEntries.Count());
+	if (iStats.iWrittenTiles)
+		LOG(_L8("Tile store writes: %u tiles, %u bytes (%u bytes per tile)"),
+				iStats.iWrittenTiles, iStats.iWrittenBytes,
+				iStats.iWrittenBytes / iStats.iWrittenTiles);
+	}
+
+void CTileStore::CompactL()
+	{
+	if (iReservationsCount)
+		User::Leave(KErrInUse);
+	
+	LOG(_L8("Tile store compaction started, data size=%d, wasted=%d"),
+			iDataFileSize, iWastedSize);
+	
+	TFileName tempFileName(iDataFileName);
+	tempFileName.Append(KTempFileExtension);
+	
+	// Copy all actual records to new file in sorted order (always in
+	// format of current version)
+	iEntries.Sort(TLinearOrder<TTileStoreEntry>(CompareEntriesByTile));
+	RebuildBucketsL(iBuckets.Count());
+	
+	RFile newFile;
+	User::LeaveIfError(newFile.Replace(iFs, tempFileName, EFileWrite));
+	CleanupClosePushL(newFile);
+	TUint32 fileHeader[2] = {KDataFileMagic, KStoreVersion};
+	User::LeaveIfError(newFile.Write(TPtrC8(reinterpret_cast<const TUint8*>(fileHeader),
+			KDataFileHeaderSize)));
+	
+	RArray<TInt> newOffsets;
+	CleanupClosePushL(newOffsets);
+	newOffsets.ReserveL(iEntries.Count());
+	RBuf8 buff;
+	buff.CleanupClosePushL();
+	TInt pos = KDataFileHeaderSize;
+	for (TInt i = 0; i < iEntries.Count(); i++)
+		{
+		const TTileStoreEntry &entry = iEntries[i];
+		TTileStoreRecordHeader header;
+		header.iMagic = KRecordMagic;
+		header.iZ = entry.iTile.iZ;
+		header.iX = entry.iTile.iX;
+		header.iY = entry.iTile.iY;
+		header.iLength = entry.iLength;
+		header.iFetchTime = entry.iFetchTime;
+		header.iExpiryTime = entry.iExpiryTime;
+		header.iLastModified = entry.iLastModified;
+		header.iETagLength = entry.iETagLength;
+		
+		// ETag and data
+		TInt length = entry.iETagLength + entry.iLength;
+		if (buff.MaxLength() < length)
+			buff.ReAllocL(length);
+		User::LeaveIfError(iDataFile.Read(entry.iOffset - entry.iETagLength, buff, length));
+		if (buff.Length() != length)
+			{
+			// Data file is truncated, tile will be downloaded again
+			LOG(_L8("Tile %S dropped from store, data is incomplete"), &entry.iTile.AsDes8());
+			newOffsets.AppendL(KErrNotFound);
+			continue;
+			}
+		User::LeaveIfError(newFile.Write(TPckgC<TTileStoreRecordHeader>(header)));
+		User::LeaveIfError(newFile.Write(buff));
+		newOffsets.AppendL(pos + KRecordHeaderSize + entry.iETagLength);
+		pos += KRecordHeaderSize + length;
+		}
+	CleanupStack::PopAndDestroy(&buff);
+	User::LeaveIfError(newFile.Flush());
+	CleanupStack::PopAndDestroy(&newFile);
+	
+	// Swap files
+	iDataFile.Close();
+	TInt r = iFs.Replace(tempFileName, iDataFileName);
+	OpenDataFileL();
+	User::LeaveIfError(r);
+	
+	TInt droppedCount = 0;
+	for (TInt i = iEntries.Count() - 1; i >= 0; i--)
+		{
+		if (newOffsets[i] == KErrNotFound)
+			{
+			iEntries.Remove(i);
+			droppedCount++;
+			}
+		else
+			iEntries[i].iOffset = newOffsets[i];
+		}
+	CleanupStack::PopAndDestroy(&newOffsets);
+	if (droppedCount)
+		RebuildBucketsL(iBuckets.Count());
+	iWastedSize = 0;
+	CommitL();
+	
+	LOG(_L8("Tile store compaction finished, data size=%d"), iDataFileSize);
+	}
@@ -0,0 +1,486 @@
+/*
+ * TrackLayer.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "TrackLayer.h"
+#include "S60MapsAppView.h"
+#include "Logger.h"
+#include <e32math.h>
+
+
+// Constants
+const TInt KTrackPointsGranularity = 1024;
+const TInt KTrackSimplificationTolerance = 1; // In pixels on the drawn zoom
+const TInt KMaxTrackSimplificationTail = 256; // In points, tail is committed when longer
+const TInt KTrackPenWidth = 3;
+#if LOGGING_ENABLED
+const TInt KTrackDrawTimesLogInterval = 50;
+#endif
+
+// Outcodes for Cohen-Sutherland clipping
+enum TOutCode
+	{
+	EOutInside = 0,
+	EOutLeft = 1,
+	EOutRight = 2,
+	EOutTop = 4,
+	EOutBottom = 8
+	};
+
+static TInt OutCode(const TRect &aRect, const TPoint &aPoint)
+	{
+	TInt code = EOutInside;
+	if (aPoint.iX < aRect.iTl.iX)
+		code |= EOutLeft;
+	else if (aPoint.iX >= aRect.iBr.iX)
+		code |= EOutRight;
+	if (aPoint.iY < aRect.iTl.iY)
+		code |= EOutTop;
+	else if (aPoint.iY >= aRect.iBr.iY)
+		code |= EOutBottom;
+	return code;
+	}
+
+// Cohen-Sutherland line clipping
+// @return EFalse if line is completely outside of rectangle
+static TBool ClipLine(const TRect &aRect, TPoint &aP0, TPoint &aP1)
+	{
+	TInt code0 = OutCode(aRect, aP0);
+	TInt code1 = OutCode(aRect, aP1);
+	FOREVER
+		{
+		if (!(code0 | code1))
+			return ETrue;
+		if (code0 & code1)
+			return EFalse;
+
+		TInt code = code0 ? code0 : code1;
+		// Intermediate products may not fit to 32 bits on high zooms
+		TInt64 dx = aP1.iX - aP0.iX;
+		TInt64 dy = aP1.iY - aP0.iY;
+		TPoint p;
+		if (code & EOutTop)
+			{
+			p.iY = aRect.iTl.iY;
+			p.iX = aP0.iX + I64INT(dx * (p.iY - aP0.iY) / dy);
+			}
+		else if (code & EOutBottom)
+			{
+			p.iY = aRect.iBr.iY - 1;
+			p.iX = aP0.iX + I64INT(dx * (p.iY - aP0.iY) / dy);
+			}
+		else if (code & EOutRight)
+			{
+			p.iX = aRect.iBr.iX - 1;
+			p.iY = aP0.iY + I64INT(dy * (p.iX - aP0.iX) / dx);
+			}
+		else
+			{
+			p.iX = aRect.iTl.iX;
+			p.iY = aP0.iY + I64INT(dy * (p.iX - aP0.iX) / dx);
+			}
+
+		if (code == code0)
+			{
+			aP0 = p;
+			code0 = OutCode(aRect, aP0);
+			}
+		else
+			{
+			aP1 = p;
+			code1 = OutCode(aRect, aP1);
+			}
+		}
+	}
+
+
+// CTrackPointStore
+
+CTrackPointStore::CTrackPointStore() :
+		iX(KTrackPointsGranularity),
+		iY(KTrackPointsGranularity),
+		iIsNewSegment(ETrue)
+	{
+	// No implementation required
+	}
+
+CTrackPointStore::~CTrackPointStore()
+	{
+	iX.Close();
+	iY.Close();
+	iSegmentStarts.Close();
+	}
+
+CTrackPointStore* CTrackPointStore::NewLC()
+	{
+	CTrackPointStore* self = new (ELeave) CTrackPointStore();
+	CleanupStack::PushL(self);
+	return self;
+	}
+
+CTrackPointStore* CTrackPointStore::NewL()
+	{
+	CTrackPointStore* self = CTrackPointStore::NewLC();
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CTrackPointStore::AppendL(const TCoordinate &aCoord)
+	{
+	AppendL(MapMath::GeoCoordsToWorldPoint(aCoord));
+	}
+
+void CTrackPointStore::AppendL(const TPoint &aWorldPoint)
+	{
+	TInt idx = iX.Count();
+	if (iIsNewSegment)
+		iSegmentStarts.AppendL(idx);
+
+	TInt r = iX.Append(aWorldPoint.iX);
+	if (r == KErrNone)
+		{
+		r = iY.Append(aWorldPoint.iY);
+		if (r != KErrNone)
+			iX.Remove(idx); // Keep arrays of equal length
+		}
+	if (r != KErrNone)
+		{
+		if (iIsNewSegment)
+			iSegmentStarts.Remove(iSegmentStarts.Count() - 1);
+		User::Leave(r);
+		}
+	iIsNewSegment = EFalse;
+
+	if (idx == 0)
+		iBounds.SetRect(aWorldPoint, TSize(1, 1));
+	else
+		{
+		iBounds.iTl.iX = Min(iBounds.iTl.iX, aWorldPoint.iX);
+		iBounds.iTl.iY = Min(iBounds.iTl.iY, aWorldPoint.iY);
+		iBounds.iBr.iX = Max(iBounds.iBr.iX, aWorldPoint.iX + 1);
+		iBounds.iBr.iY = Max(iBounds.iBr.iY, aWorldPoint.iY + 1);
+		}
+	}
+
+void CTrackPointStore::StartSegment()
+	{
+	iIsNewSegment = ETrue;
+	}
+
+void CTrackPointStore::Reset()
+	{
+	iX.Reset();
+	iY.Reset();
+	iSegmentStarts.Reset();
+	iBounds = TRect();
+	iIsNewSegment = ETrue;
+	}
+
+
+// CTrackSimplification
+
+CTrackSimplification::CTrackSimplification(TInt aTolerance) :
+		iTolerance(aTolerance),
+		iIndices(KTrackPointsGranularity)
+	{
+	// No implementation required
+	}
+
+CTrackSimplification::~CTrackSimplification()
+	{
+	iIndices.Close();
+	iStack.Close();
+	}
+
+void CTrackSimplification::UpdateL(const CTrackPointStore &aPoints)
+	{
+	TInt count = aPoints.Count();
+	if (count < iPointsCount)
+		{ // Store has been cleared
+		iIndices.Reset();
+		iCommittedCount = 0;
+		iPointsCount = 0;
+		}
+	if (count == iPointsCount)
+		return;
+
+	// Whole open tail starting from the last committed point is simplified
+	// again, so its previous result is dropped
+	TInt first = iCommittedCount ? iIndices[iCommittedCount - 1] : 0;
+	for (TInt i = iIndices.Count() - 1; i >= iCommittedCount; i--)
+		iIndices.Remove(i);
+
+	// Each segment is simplified separately, so its first and last
+	// points are always kept
+	const RArray<TInt> &segmentStarts = aPoints.SegmentStarts();
+	for (TInt i = 0; i < segmentStarts.Count(); i++)
+		{
+		TInt segmentFirst = segmentStarts[i];
+		TInt segmentLast = (i + 1 < segmentStarts.Count() ? segmentStarts[i + 1] : count) - 1;
+		if (segmentLast < first)
+			continue;
+		SimplifyRangeL(aPoints, Max(first, segmentFirst), segmentLast);
+		}
+	iPointsCount = count;
+
+	// The last point is kept only because it is the end of the tail, and
+	// the last split may move when next points arrive. All previous kept
+	// points precede a point exceeding the tolerance, so they are final.
+	TInt committedCount = Max(iCommittedCount, iIndices.Count() - 2);
+	TInt tailFirst = committedCount ? iIndices[committedCount - 1] : 0;
+	if (count - 1 - tailFirst > KMaxTrackSimplificationTail)
+		committedCount = iIndices.Count(); // Limit processing time of nearly straight tail
+	iCommittedCount = committedCount;
+	}
+
+void CTrackSimplification::SimplifyRangeL(const CTrackPointStore &aPoints, TInt aFirst, TInt aLast)
+	{
+	if (!iIndices.Count() || iIndices[iIndices.Count() - 1] != aFirst)
+		iIndices.AppendL(aFirst); // Last committed point is already there
+	if (aLast <= aFirst)
+		return;
+
+	// Iterative version with explicit stack because thread stack is small.
+	// Left subrange is always processed first, so kept indices are
+	// appended in ascending order.
+	iStack.Reset();
+	iStack.AppendL(aFirst);
+	iStack.AppendL(aLast);
+	while (iStack.Count())
+		{
+		TInt last = iStack[iStack.Count() - 1];
+		TInt first = iStack[iStack.Count() - 2];
+		iStack.Remove(iStack.Count() - 1);
+		iStack.Remove(iStack.Count() - 1);
+
+		// Find the farthest point from line between first and last points
+		TPoint a = aPoints.At(first);
+		TPoint b = aPoints.At(last);
+		TReal dx = b.iX - a.iX;
+		TReal dy = b.iY - a.iY;
+		TBool isLoop = (dx == 0 && dy == 0);
+		TReal maxDeviation = 0; // Cross product or squared distance for loops
+		TInt farthest = -1;
+		for (TInt i = first + 1; i < last; i++)
+			{
+			TPoint p = aPoints.At(i);
+			TReal px = p.iX - a.iX;
+			TReal py = p.iY - a.iY;
+			TReal deviation = isLoop ? px * px + py * py : Abs(dx * py - dy * px);
+			if (deviation > maxDeviation)
+				{
+				maxDeviation = deviation;
+				farthest = i;
+				}
+			}
+
+		TReal distance = 0;
+		if (farthest >= 0)
+			{
+			if (isLoop)
+				Math::Sqrt(distance, maxDeviation);
+			else
+				{
+				TReal length;
+				Math::Sqrt(length, dx * dx + dy * dy);
+				distance = maxDeviation / length;
+				}
+			}
+
+		if (distance > iTolerance)
+			{
+			iStack.AppendL(farthest);
+			iStack.AppendL(last);
+			iStack.AppendL(first);
+			iStack.AppendL(farthest);
+			}
+		else
+			{
+			iIndices.AppendL(last);
+			}
+		}
+	}
+
+
+// CTrackLayer
+
+CTrackLayer::CTrackLayer(CS60MapsAppView* aMapView) :
+		CMapLayerBase(aMapView)
+	{
+	iSimplifications.Reset();
+	}
+
+CTrackLayer::~CTrackLayer()
+	{
+	iSimplifications.DeleteAll();
+	iRunPoints.Close();
+	delete iPoints;
+	}
+
+CTrackLayer* CTrackLayer::NewLC(CS60MapsAppView* aMapView)
+	{
+	CTrackLayer* self = new (ELeave) CTrackLayer(aMapView);
+	CleanupStack::PushL(self);
+	self->ConstructL();
+	return self;
+	}
+
+CTrackLayer* CTrackLayer::NewL(CS60MapsAppView* aMapView)
+	{
+	CTrackLayer* self = CTrackLayer::NewLC(aMapView);
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CTrackLayer::ConstructL()
+	{
+	iPoints = CTrackPointStore::NewL();
+	}
+
+void CTrackLayer::Draw(CBitmapContext &aGc)
+	{
+	if (!iPoints->Count())
+		return;
+
+#if LOGGING_ENABLED
+	TStopwatch stopwatch;
+#endif
+
+	TRAPD(r, DrawL(aGc));
+	if (r != KErrNone)
+		{
+		LOG(_L8("Track drawing failed with code %d"), r);
+		}
+
+#if LOGGING_ENABLED
+	iDrawTimes.Add(stopwatch.ElapsedMicroSeconds());
+	if (iDrawTimes.Count() >= KTrackDrawTimesLogInterval)
+		{
+		TBuf8<200> buff;
+		iDrawTimes.AsDes(buff);
+		LOG(_L8("Track draw times (%d points, %d frames, avg=%dus, max=%dus): %S"),
+				iPoints->Count(), iDrawTimes.Count(), iDrawTimes.Average(),
+				iDrawTimes.Max(), &buff);
+		iDrawTimes.Reset();
+		}
+#endif
+	}
+
+void CTrackLayer::DrawL(CBitmapContext &aGc)
+	{
+	TZoom zoom = iMapView->GetZoom();
+	TRect screenRect = iMapView->Rect();
+
+	// Skip whole track if it is outside of the screen
+	TRect worldRect(
+			MapMath::ProjectionPointToWorldPoint(
+					iMapView->ScreenCoordsToProjectionCoords(screenRect.iTl), zoom),
+			MapMath::ProjectionPointToWorldPoint(
+					iMapView->ScreenCoordsToProjectionCoords(screenRect.iBr), zoom));
+	if (!worldRect.Intersects(iPoints->Bounds()))
+		return;
+
+	CTrackSimplification* simplification = SimplificationL(zoom);
+	const RArray<TInt> &indices = simplification->Indices();
+	const RArray<TInt> &segmentStarts = iPoints->SegmentStarts();
+
+	aGc.SetPenStyle(CGraphicsContext::ESolidPen);
+	aGc.SetPenSize(TSize(KTrackPenWidth, KTrackPenWidth));
+	aGc.SetPenColor(KRgbMagenta);
+	aGc.SetBrushStyle(CGraphicsContext::ENullBrush);
+
+	// Lines are clipped with margin to not cut off thick pen ends
+	TRect clipRect = screenRect;
+	clipRect.Grow(KTrackPenWidth, KTrackPenWidth);
+
+	iRunLength = 0;
+	TInt nextSegment = 0;
+	TPoint prevPoint;
+	TBool hasPrevPoint = EFalse;
+	for (TInt i = 0; i < indices.Count(); i++)
+		{
+		TInt idx = indices[i];
+		if (nextSegment < segmentStarts.Count() && idx >= segmentStarts[nextSegment])
+			{ // Do not connect segments
+			FlushRun(aGc);
+			hasPrevPoint = EFalse;
+			nextSegment++;
+			}
+
+		TPoint point = iMapView->ProjectionCoordsToScreenCoords(
+				MapMath::WorldPointToProjectionPoint(iPoints->At(idx), zoom));
+		if (hasPrevPoint)
+			{
+			TPoint p0 = prevPoint;
+			TPoint p1 = point;
+			if (ClipLine(clipRect, p0, p1))
+				{
+				// Start new run if the line entered clip area
+				if (!iRunLength || iRunPoints[iRunLength - 1] != p0)
+					{
+					FlushRun(aGc);
+					AppendRunPointL(p0);
+					}
+				AppendRunPointL(p1);
+				}
+			else
+				FlushRun(aGc);
+			}
+		prevPoint = point;
+		hasPrevPoint = ETrue;
+		}
+	FlushRun(aGc);
+	}
+
+CTrackSimplification* CTrackLayer::SimplificationL(TZoom aZoom)
+	{
+	if (!iSimplifications[aZoom])
+		{
+		TInt tolerance = KTrackSimplificationTolerance << (KWorldZoom - aZoom);
+		iSimplifications[aZoom] = new (ELeave) CTrackSimplification(tolerance);
+		}
+	iSimplifications[aZoom]->UpdateL(*iPoints);
+	return iSimplifications[aZoom];
+	}
+
+void CTrackLayer::AppendRunPointL(const TPoint &aPoint)
+	{
+	// Array items are reused between runs to avoid reallocations
+	if (iRunLength < iRunPoints.Count())
+		iRunPoints[iRunLength] = aPoint;
+	else
+		iRunPoints.AppendL(aPoint);
+	iRunLength++;
+	}
+
+void CTrackLayer::FlushRun(CBitmapContext &aGc)
+	{
+	if (iRunLength >= 2)
+		aGc.DrawPolyLine(&iRunPoints[0], iRunLength);
+	iRunLength = 0;
+	}
+
+void CTrackLayer::InvalidateSimplifications()
+	{
+	iSimplifications.DeleteAll();
+	iSimplifications.Reset(); // DeleteAll() does not set pointers to NULL
+	}
+
+void CTrackLayer::AppendPointL(const TCoordinate &aCoord)
+	{
+	iPoints->AppendL(aCoord);
+	}
+
+void CTrackLayer::StartSegment()
+	{
+	iPoints->StartSegment();
+	}
+
+void CTrackLayer::Reset()
+	{
+	iPoints->Reset();
+	InvalidateSimplifications();
+	}
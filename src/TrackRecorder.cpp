@@ -0,0 +1,398 @@
+/*
+ * TrackRecorder.cpp
+ *
+ *  Created on: 17.10.2026
+ *      Author: user
+ */
+
+#include "TrackRecorder.h"
+#include "StreamUtils.h"
+#include "Logger.h"
+#include "LoggingDefs.h"
+#include <e32math.h>
+#include <s32file.h>
+#include <s32mem.h>
+
+
+// Constants
+const TUint32 KTrackFileMagic = 0x52543653; // "S6TR"
+const TUint32 KTrackFileVersion = 1;
+const TInt KTrackFileHeaderSize = 8;
+const TReal KCoordUnitsPerDegree = 1e6; // About 0.1 m, enough for GPS
+const TReal32 KAltitudeUnitsPerMeter = 10;
+const TInt KTimeUnit = 100000; // In microseconds
+const TInt32 KNoAltitude = KMinTInt32;
+const TUint8 KBlockNewSegmentFlag = 0x01;
+
+_LIT8(KGpxHeader, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<gpx version=\"1.1\" creator=\"S60Maps\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+		"<trk>\n<trkseg>\n");
+_LIT8(KGpxSegmentBreak, "</trkseg>\n<trkseg>\n");
+_LIT8(KGpxFooter, "</trkseg>\n</trk>\n</gpx>\n");
+
+
+static TInt32 CoordToUnits(TReal64 aDegrees)
+	{
+	TReal r;
+	Math::Round(r, aDegrees * KCoordUnitsPerDegree, 0);
+	return (TInt32) r;
+	}
+
+static TInt32 AltitudeToUnits(TReal32 aAltitude)
+	{
+	if (Math::IsNaN(aAltitude))
+		return KNoAltitude;
+	TReal r;
+	Math::Round(r, aAltitude * KAltitudeUnitsPerMeter, 0);
+	return (TInt32) r;
+	}
+
+// Difference with wrap around, so special values do not overflow
+static inline TInt32 Delta(TInt32 aValue, TInt32 aPrevValue)
+	{
+	return TInt32(TUint32(aValue) - TUint32(aPrevValue));
+	}
+
+static inline TInt32 AddDelta(TInt32 aPrevValue, TInt32 aDelta)
+	{
+	return TInt32(TUint32(aPrevValue) + TUint32(aDelta));
+	}
+
+// Read header and payload of the next block
+// @return EFalse at the end of file or if the last block is incomplete or damaged
+static TBool ReadBlockL(RReadStream &aStream, TDes8 &aPayload, TInt &aFixesCount,
+		TUint8 &aFlags)
+	{
+	TInt payloadLength = 0;
+	TRAPD(r,
+		payloadLength = StreamUtils::ReadVarUintL(aStream);
+		aFixesCount = StreamUtils::ReadVarUintL(aStream);
+		aFlags = aStream.ReadUint8L();
+		if (payloadLength < 0 || payloadLength > aPayload.MaxLength() || aFixesCount <= 0
+				|| aFixesCount > KTrackRingBufferSize)
+			User::Leave(KErrCorrupt);
+		aStream.ReadL(aPayload, payloadLength);
+		);
+	// Blocks are never rewritten, so only the last one may be damaged
+	// by interrupted writing (garbage lengths or truncated payload)
+	if (r == KErrEof)
+		return EFalse; // Normal end or interrupted writing
+	if (r == KErrCorrupt)
+		{
+		LOG(_L8("Track file ends with damaged block"));
+		return EFalse;
+		}
+	User::LeaveIfError(r);
+	return ETrue;
+	}
+
+static void WriteGpxPointL(RWriteStream &aStream, TInt32 aLat, TInt32 aLon,
+		TInt32 aAltitude, const TTime &aTime)
+	{
+	TRealFormat format(KDefaultRealWidth, 6);
+	format.iType |= KDoNotUseTriads;
+	format.iPoint = '.';
+	
+	TBuf8<200> buff;
+	buff.Append(_L8("<trkpt lat=\""));
+	buff.AppendNum(aLat / KCoordUnitsPerDegree, format);
+	buff.Append(_L8("\" lon=\""));
+	buff.AppendNum(aLon / KCoordUnitsPerDegree, format);
+	buff.Append(_L8("\">"));
+	if (aAltitude != KNoAltitude)
+		{
+		format.iPlaces = 1;
+		buff.Append(_L8("<ele>"));
+		buff.AppendNum(aAltitude / TReal(KAltitudeUnitsPerMeter), format);
+		buff.Append(_L8("</ele>"));
+		}
+	TDateTime dt = aTime.DateTime();
+	buff.AppendFormat(_L8("<time>%04d-%02d-%02dT%02d:%02d:%02dZ</time></trkpt>\n"),
+			dt.Year(), dt.Month() + 1, dt.Day() + 1, dt.Hour(), dt.Minute(), dt.Second());
+	aStream.WriteL(buff);
+	}
+
+// Decode fixes of the block and write them as GPX points
+// @param aStream NULL to only check that payload is complete
+static void DecodeBlockL(const TDesC8 &aPayload, TInt aFixesCount, RWriteStream* aStream)
+	{
+	RDesReadStream stream(aPayload);
+	CleanupClosePushL(stream);
+	TInt64 startTime = 0;
+	TInt32 time = 0, lat = 0, lon = 0, altitude = 0;
+	for (TInt i = 0; i < aFixesCount; i++)
+		{
+		if (i == 0)
+			{
+			TInt32 high = stream.ReadInt32L();
+			TUint32 low = stream.ReadUint32L();
+			startTime = MAKE_TINT64(high, low);
+			lat = stream.ReadInt32L();
+			lon = stream.ReadInt32L();
+			altitude = stream.ReadInt32L();
+			}
+		else
+			{
+			time = AddDelta(time, StreamUtils::ReadVarIntL(stream));
+			lat = AddDelta(lat, StreamUtils::ReadVarIntL(stream));
+			lon = AddDelta(lon, StreamUtils::ReadVarIntL(stream));
+			altitude = AddDelta(altitude, StreamUtils::ReadVarIntL(stream));
+			}
+		if (aStream != NULL)
+			{
+			TTime fixTime(startTime + TInt64(time) * KTimeUnit);
+			WriteGpxPointL(*aStream, lat, lon, altitude, fixTime);
+			}
+		}
+	CleanupStack::PopAndDestroy(&stream);
+	}
+
+
+CTrackRecorder::CTrackRecorder(RFs aFs) :
+		iFs(aFs)
+	{
+	// No implementation required
+	}
+
+CTrackRecorder::~CTrackRecorder()
+	{
+	Stop();
+	}
+
+CTrackRecorder* CTrackRecorder::NewLC(RFs aFs)
+	{
+	CTrackRecorder* self = new (ELeave) CTrackRecorder(aFs);
+	CleanupStack::PushL(self);
+	return self;
+	}
+
+CTrackRecorder* CTrackRecorder::NewL(RFs aFs)
+	{
+	CTrackRecorder* self = CTrackRecorder::NewLC(aFs);
+	CleanupStack::Pop(); // self;
+	return self;
+	}
+
+void CTrackRecorder::StartL(const TDesC &aFileName)
+	{
+	Stop();
+	
+	TInt r = iFs.MkDirAll(aFileName);
+	if (r != KErrAlreadyExists)
+		User::LeaveIfError(r);
+	User::LeaveIfError(iFile.Replace(iFs, aFileName, EFileWrite | EFileShareReadersOrWriters));
+	
+	iBlockBuff.Zero();
+	RDesWriteStream stream(iBlockBuff);
+	CleanupClosePushL(stream);
+	stream.WriteUint32L(KTrackFileMagic);
+	stream.WriteUint32L(KTrackFileVersion);
+	stream.CommitL();
+	CleanupStack::PopAndDestroy(&stream);
+	r = iFile.Write(0, iBlockBuff);
+	if (r != KErrNone)
+		{
+		iFile.Close();
+		User::Leave(r);
+		}
+	
+	iFileName = aFileName;
+	iIsRecording = ETrue;
+	iFirstFix = 0;
+	iFixesCount = 0;
+	iIsNewSegment = ETrue;
+	iTotalFixesCount = 0;
+	iWrittenFixesCount = 0;
+	iLostFixesCount = 0;
+	iFileSize = KTrackFileHeaderSize;
+	LOG(_L8("Track recording started"));
+	}
+
+void CTrackRecorder::Stop()
+	{
+	if (!iIsRecording)
+		return;
+	
+	TRAPD(r, FlushL());
+	if (r != KErrNone)
+		{
+		LOG(_L8("Failed to write the last track block, error: %d"), r);
+		}
+	iFile.Close();
+	iIsRecording = EFalse;
+	
+#if LOGGING_ENABLED
+	TBuf8<16> bytesPerFix;
+	TRealFormat format(KDefaultRealWidth, 2);
+	bytesPerFix.Num(BytesPerFix(), format);
+	LOG(_L8("Track recording stopped: %d fixes written, %d lost, %d bytes (%S bytes per fix)"),
+			iWrittenFixesCount, iLostFixesCount, iFileSize, &bytesPerFix);
+#endif
+	}
+
+void CTrackRecorder::AddFixL(const TPosition &aPosition)
+	{
+	if (!iIsRecording)
+		return;
+	
+	if (iFixesCount == KTrackRingBufferSize)
+		{ // Writing fails for a long time, drop the oldest fix
+		TBool isSegmentStart = iFixes[iFirstFix].iIsSegmentStart;
+		iFirstFix = (iFirstFix + 1) % KTrackRingBufferSize;
+		iFixesCount--;
+		iLostFixesCount++;
+		if (isSegmentStart)
+			iFixes[iFirstFix].iIsSegmentStart = ETrue;
+		}
+	
+	TTrackFix &fix = iFixes[(iFirstFix + iFixesCount) % KTrackRingBufferSize];
+	fix.iTime = aPosition.Time();
+	fix.iLatitude = aPosition.Latitude();
+	fix.iLongitude = aPosition.Longitude();
+	fix.iAltitude = aPosition.Altitude();
+	fix.iIsSegmentStart = iIsNewSegment;
+	iIsNewSegment = EFalse;
+	iFixesCount++;
+	iTotalFixesCount++;
+	
+	if (iFixesCount >= KTrackFlushInterval)
+		FlushL();
+	}
+
+void CTrackRecorder::StartSegmentL()
+	{
+	if (!iIsRecording)
+		return;
+	
+	// Break is attached to the next fix, so it is not lost if flushing
+	// of previous ones fails
+	iIsNewSegment = ETrue;
+	FlushL();
+	}
+
+TReal CTrackRecorder::BytesPerFix() const
+	{
+	if (!iWrittenFixesCount)
+		return 0;
+	return TReal(iFileSize - KTrackFileHeaderSize) / iWrittenFixesCount;
+	}
+
+void CTrackRecorder::FlushL()
+	{
+	while (iFixesCount)
+		{
+		TInt count = 1;
+		while (count < iFixesCount
+				&& !iFixes[(iFirstFix + count) % KTrackRingBufferSize].iIsSegmentStart)
+			count++;
+		WriteBlockL(count);
+		}
+	}
+
+void CTrackRecorder::WriteBlockL(TInt aCount)
+	{
+	EncodeBlockL(aCount);
+	// Block is written at the end of the last complete one, so garbage
+	// from previous failed attempt (if any) is overwritten
+	User::LeaveIfError(iFile.Write(iFileSize, iBlockBuff));
+	User::LeaveIfError(iFile.Flush());
+	
+	iFileSize += iBlockBuff.Length();
+	iWrittenFixesCount += aCount;
+	iFirstFix = (iFirstFix + aCount) % KTrackRingBufferSize;
+	iFixesCount -= aCount;
+	}
+
+void CTrackRecorder::EncodeBlockL(TInt aCount)
+	{
+	// Payload
+	iPayloadBuff.Zero();
+	RDesWriteStream stream(iPayloadBuff);
+	CleanupClosePushL(stream);
+	
+	TInt64 startTime = iFixes[iFirstFix].iTime.Int64();
+	TInt32 prevTime = 0, prevLat = 0, prevLon = 0, prevAltitude = 0;
+	for (TInt i = 0; i < aCount; i++)
+		{
+		const TTrackFix &fix = iFixes[(iFirstFix + i) % KTrackRingBufferSize];
+		// Deltas of quantized values do not accumulate rounding errors
+		TInt32 time = I64INT((fix.iTime.Int64() - startTime + KTimeUnit / 2) / KTimeUnit);
+		TInt32 lat = CoordToUnits(fix.iLatitude);
+		TInt32 lon = CoordToUnits(fix.iLongitude);
+		TInt32 altitude = AltitudeToUnits(fix.iAltitude);
+		if (i == 0)
+			{
+			stream.WriteInt32L(I64HIGH(startTime));
+			stream.WriteUint32L(I64LOW(startTime));
+			stream.WriteInt32L(lat);
+			stream.WriteInt32L(lon);
+			stream.WriteInt32L(altitude);
+			}
+		else
+			{
+			StreamUtils::WriteVarIntL(stream, Delta(time, prevTime));
+			StreamUtils::WriteVarIntL(stream, Delta(lat, prevLat));
+			StreamUtils::WriteVarIntL(stream, Delta(lon, prevLon));
+			StreamUtils::WriteVarIntL(stream, Delta(altitude, prevAltitude));
+			}
+		prevTime = time;
+		prevLat = lat;
+		prevLon = lon;
+		prevAltitude = altitude;
+		}
+	stream.CommitL();
+	CleanupStack::PopAndDestroy(&stream);
+	
+	// Header
+	iBlockBuff.Zero();
+	stream.Open(iBlockBuff);
+	CleanupClosePushL(stream);
+	StreamUtils::WriteVarUintL(stream, iPayloadBuff.Length());
+	StreamUtils::WriteVarUintL(stream, aCount);
+	stream.WriteUint8L(iFixes[iFirstFix].iIsSegmentStart ? KBlockNewSegmentFlag : 0);
+	stream.CommitL();
+	CleanupStack::PopAndDestroy(&stream);
+	iBlockBuff.Append(iPayloadBuff);
+	}
+
+void CTrackRecorder::ExportGpxL(RFs &aFs, const TDesC &aTrackFileName, const TDesC &aGpxFileName)
+	{
+	RFileReadStream in;
+	User::LeaveIfError(in.Open(aFs, aTrackFileName, EFileRead | EFileShareReadersOrWriters));
+	CleanupClosePushL(in);
+	if (in.ReadUint32L() != KTrackFileMagic || in.ReadUint32L() != KTrackFileVersion)
+		User::Leave(KErrCorrupt);
+	
+	RFileWriteStream out;
+	User::LeaveIfError(out.Replace(aFs, aGpxFileName, EFileWrite));
+	CleanupClosePushL(out);
+	out.WriteL(KGpxHeader);
+	
+	HBufC8* payload = HBufC8::NewLC(KMaxTrackBlockSize);
+	TPtr8 payloadPtr = payload->Des();
+	TInt fixesCount;
+	TUint8 flags;
+	TBool isFirstBlock = ETrue;
+	while (ReadBlockL(in, payloadPtr, fixesCount, flags))
+		{
+		// Check payload before writing anything, so points of damaged
+		// last block are not exported partially
+		TRAPD(r, DecodeBlockL(payloadPtr, fixesCount, NULL));
+		if (r == KErrEof || r == KErrCorrupt)
+			{
+			LOG(_L8("Track file ends with damaged block"));
+			break;
+			}
+		User::LeaveIfError(r);
+		
+		if ((flags & KBlockNewSegmentFlag) && !isFirstBlock)
+			out.WriteL(KGpxSegmentBreak);
+		isFirstBlock = EFalse;
+		DecodeBlockL(payloadPtr, fixesCount, &out);
+		}
+	CleanupStack::PopAndDestroy(payload);
+	
+	out.WriteL(KGpxFooter);
+	out.CommitL();
+	CleanupStack::PopAndDestroy(2, &in);
+	}